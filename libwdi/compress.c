@@ -0,0 +1,309 @@
+/*
+ * Library for USB automated driver installation - resource compression
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Memory leaks detection - define _CRTDBG_MAP_ALLOC as preprocessor macro */
+#ifdef _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+
+#define LZ_MIN_MATCH            4
+#define LZ_LAST_LITERALS        5	// The last 5 bytes of a block are always literals
+#define LZ_MF_LIMIT             12	// No match may start in the last 12 bytes of a block
+#define LZ_HASH_BITS            13
+#define LZ_RUN_MASK             0x0F
+
+static __inline uint32_t read32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static __inline void write32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static __inline uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Write an LZ4 length extension. Returns NULL on overflow.
+static uint8_t* write_length(uint8_t* op, const uint8_t* oend, size_t len)
+{
+	for (; len >= 0xFF; len -= 0xFF) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 0xFF;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+// Write a sequence of literals, optionally followed by a match. Returns NULL on overflow.
+static uint8_t* write_sequence(uint8_t* op, const uint8_t* oend, const uint8_t* literals,
+	size_t literal_len, size_t offset, size_t match_len)
+{
+	uint8_t* token;
+
+	if (op >= oend)
+		return NULL;
+	token = op++;
+	*token = (uint8_t)(((literal_len < LZ_RUN_MASK) ? literal_len : LZ_RUN_MASK) << 4);
+	if ((literal_len >= LZ_RUN_MASK) && ((op = write_length(op, oend, literal_len - LZ_RUN_MASK)) == NULL))
+		return NULL;
+	if (literal_len > (size_t)(oend - op))
+		return NULL;
+	memcpy(op, literals, literal_len);
+	op += literal_len;
+	if (match_len == 0)
+		return op;
+
+	if ((size_t)(oend - op) < 2)
+		return NULL;
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+	match_len -= LZ_MIN_MATCH;
+	*token |= (uint8_t)((match_len < LZ_RUN_MASK) ? match_len : LZ_RUN_MASK);
+	if (match_len >= LZ_RUN_MASK)
+		op = write_length(op, oend, match_len - LZ_RUN_MASK);
+	return op;
+}
+
+// Compress a single block of at most LZ_BLOCK_SIZE bytes. Returns 0 if it doesn't fit in dst.
+static size_t lz_compress_block(const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size)
+{
+	// Block positions fit in 16 bits, since a block is at most 64 KB
+	uint16_t table[1 << LZ_HASH_BITS];
+	const uint8_t *ip = src, *anchor = src, *match;
+	const uint8_t *end = src + size, *mflimit = end - LZ_MF_LIMIT, *matchlimit = end - LZ_LAST_LITERALS;
+	const uint8_t* oend = dst + dst_size;
+	uint8_t* op = dst;
+	uint32_t h;
+	size_t len;
+
+	if (size > LZ_MF_LIMIT) {
+		memset(table, 0, sizeof(table));
+		for (ip++; ip < mflimit; ) {
+			h = lz_hash(read32(ip));
+			match = src + table[h];
+			table[h] = (uint16_t)(ip - src);
+			if ((match >= ip) || (read32(match) != read32(ip))) {
+				ip++;
+				continue;
+			}
+			// Extend the match backwards, then forward
+			while ((ip > anchor) && (match > src) && (ip[-1] == match[-1])) {
+				ip--;
+				match--;
+			}
+			for (len = LZ_MIN_MATCH; (ip + len < matchlimit) && (ip[len] == match[len]); len++);
+			op = write_sequence(op, oend, anchor, ip - anchor, ip - match, len);
+			if (op == NULL)
+				return 0;
+			ip += len;
+			anchor = ip;
+		}
+	}
+	op = write_sequence(op, oend, anchor, end - anchor, 0, 0);
+	return (op == NULL) ? 0 : (size_t)(op - dst);
+}
+
+// Decompress a single block, which must produce exactly dst_size bytes. Returns 0 on success.
+static int lz_decompress_block(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size)
+{
+	const uint8_t *ip = src, *iend = src + src_size, *match;
+	uint8_t *op = dst, *oend = dst + dst_size;
+	size_t len, offset;
+	uint8_t token;
+
+	while (ip < iend) {
+		token = *ip++;
+		len = token >> 4;
+		if (len == LZ_RUN_MASK) {
+			do {
+				if (ip >= iend)
+					return -1;
+				len += *ip;
+			} while (*ip++ == 0xFF);
+		}
+		if ((len > (size_t)(iend - ip)) || (len > (size_t)(oend - op)))
+			return -1;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		// The last sequence has no match
+		if (ip == iend)
+			break;
+
+		if ((size_t)(iend - ip) < 2)
+			return -1;
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if ((offset == 0) || (offset > (size_t)(op - dst)))
+			return -1;
+		len = token & LZ_RUN_MASK;
+		if (len == LZ_RUN_MASK) {
+			do {
+				if (ip >= iend)
+					return -1;
+				len += *ip;
+			} while (*ip++ == 0xFF);
+		}
+		len += LZ_MIN_MATCH;
+		if (len > (size_t)(oend - op))
+			return -1;
+		// Matches can overlap the data being written, so copy byte by byte
+		for (match = op - offset; len > 0; len--)
+			*op++ = *match++;
+	}
+	return (op == oend) ? 0 : -1;
+}
+
+// Maximum size of a compressed stream for size bytes of data
+size_t lz_compress_bound(size_t size)
+{
+	return size + LZ_BLOCK_HEADER_SIZE * ((size + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE);
+}
+
+/*
+ * Compress src into dst. Blocks that do not compress are stored as is.
+ * Returns the size of the compressed stream, or 0 if dst is too small.
+ */
+size_t lz_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size)
+{
+	size_t pos, block_size, csize, out = 0;
+
+	for (pos = 0; pos < src_size; pos += block_size) {
+		block_size = src_size - pos;
+		if (block_size > LZ_BLOCK_SIZE)
+			block_size = LZ_BLOCK_SIZE;
+		if (dst_size - out < LZ_BLOCK_HEADER_SIZE)
+			return 0;
+		csize = dst_size - out - LZ_BLOCK_HEADER_SIZE;
+		// Only keep the compressed block if it is smaller
+		if (csize >= block_size)
+			csize = block_size - 1;
+		csize = (csize == 0) ? 0 : lz_compress_block(&src[pos], block_size,
+			&dst[out + LZ_BLOCK_HEADER_SIZE], csize);
+		if (csize != 0) {
+			write32(&dst[out], (uint32_t)csize);
+		} else {
+			if (dst_size - out - LZ_BLOCK_HEADER_SIZE < block_size)
+				return 0;
+			write32(&dst[out], (uint32_t)block_size | LZ_BLOCK_STORED);
+			memcpy(&dst[out + LZ_BLOCK_HEADER_SIZE], &src[pos], block_size);
+			csize = block_size;
+		}
+		out += LZ_BLOCK_HEADER_SIZE + csize;
+	}
+	return out;
+}
+
+// Read the next block header. Returns the compressed size of the block, or 0 on error.
+static size_t next_block(const uint8_t* src, size_t src_size, size_t* pos, int* stored)
+{
+	uint32_t header;
+
+	if (src_size - *pos < LZ_BLOCK_HEADER_SIZE)
+		return 0;
+	header = read32(&src[*pos]);
+	*pos += LZ_BLOCK_HEADER_SIZE;
+	*stored = ((header & LZ_BLOCK_STORED) != 0);
+	header &= ~LZ_BLOCK_STORED;
+	if ((header == 0) || (header > src_size - *pos))
+		return 0;
+	return header;
+}
+
+/*
+ * Decompress the whole stream from src into dst, which must be exactly the size
+ * of the original data. Returns 0 on success.
+ */
+int lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size)
+{
+	size_t pos = 0, out, csize, block_size;
+	int stored;
+
+	for (out = 0; out < dst_size; out += block_size) {
+		block_size = dst_size - out;
+		if (block_size > LZ_BLOCK_SIZE)
+			block_size = LZ_BLOCK_SIZE;
+		csize = next_block(src, src_size, &pos, &stored);
+		if (csize == 0)
+			return -1;
+		if (stored) {
+			if (csize != block_size)
+				return -1;
+			memcpy(&dst[out], &src[pos], block_size);
+		} else if (lz_decompress_block(&src[pos], csize, &dst[out], block_size) != 0) {
+			return -1;
+		}
+		pos += csize;
+	}
+	return (pos == src_size) ? 0 : -1;
+}
+
+/*
+ * Decompress the stream one block at a time, and hand each block over to the
+ * write callback, so that the whole data never needs to reside in memory.
+ * size is the size of the original data. Returns 0 on success.
+ */
+int lz_decompress_stream(const uint8_t* src, size_t src_size, size_t size, lz_write_t write, void* ctx)
+{
+	uint8_t* buf = NULL;
+	size_t pos = 0, out, csize, block_size;
+	int r = -1, stored;
+
+	for (out = 0; out < size; out += block_size) {
+		block_size = size - out;
+		if (block_size > LZ_BLOCK_SIZE)
+			block_size = LZ_BLOCK_SIZE;
+		csize = next_block(src, src_size, &pos, &stored);
+		if (csize == 0)
+			goto out;
+		if (stored) {
+			// Stored blocks can be written directly
+			if ((csize != block_size) || (write(&src[pos], block_size, ctx) != 0))
+				goto out;
+		} else {
+			if ((buf == NULL) && ((buf = (uint8_t*)malloc(LZ_BLOCK_SIZE)) == NULL))
+				goto out;
+			if ( (lz_decompress_block(&src[pos], csize, buf, block_size) != 0)
+			  || (write(buf, block_size, ctx) != 0) )
+				goto out;
+		}
+		pos += csize;
+	}
+	r = (pos == src_size) ? 0 : -1;
+
+out:
+	free(buf);
+	return r;
+}
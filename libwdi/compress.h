@@ -0,0 +1,44 @@
+/*
+ * Library for USB automated driver installation - resource compression
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Simple LZ77 codec, using the LZ4 block format, for the embedded resources.
+ * This file must remain portable, as it is also used by the embedder, which
+ * runs on the build platform.
+ *
+ * A compressed stream is a sequence of independent blocks, each decompressing
+ * to LZ_BLOCK_SIZE bytes (except for the last one), so that a resource can be
+ * decompressed with a fixed size buffer. Each block is prefixed by its 32 bit
+ * little endian length, with LZ_BLOCK_STORED set if the block was stored as is.
+ */
+#define LZ_BLOCK_SIZE           (64 * 1024)
+#define LZ_BLOCK_STORED         0x80000000
+#define LZ_BLOCK_HEADER_SIZE    4
+
+// Callback used for streamed decompression. Must return 0 on success.
+typedef int (*lz_write_t)(const void* buf, size_t size, void* ctx);
+
+size_t lz_compress_bound(size_t size);
+size_t lz_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size);
+int lz_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_size);
+int lz_decompress_stream(const uint8_t* src, size_t src_size, size_t size, lz_write_t write, void* ctx);
@@ -28,8 +28,15 @@
  * with a static library (unless the library is split into .res + .lib)
  */
 
+#if defined(_WIN32) && (!defined(_WIN32_WINNT) || (_WIN32_WINNT < 0x0600))
+// Condition variables require Vista or later
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <time.h>
@@ -40,12 +47,16 @@
 #else
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #endif
 
 #include <config.h>
 #include "embedder.h"
 #include "embedder_files.h"
+#include "compress.h"
+#include "pack.h"
 
 #define safe_free(p) do {if (p != NULL) {free(p); p = NULL;}} while(0)
 #define perr(...) fprintf(stderr, "embedder : error: " __VA_ARGS__)
@@ -80,21 +91,808 @@ char initial_dir[MAX_PATH];
 #define NON_NATIVE_SEPARATOR	'\\'
 #endif
 
-void dump_buffer_hex(FILE* fd, unsigned char *buffer, size_t size)
+#if defined(_WIN32)
+typedef HANDLE					thread_t;
+typedef CRITICAL_SECTION		mutex_t;
+typedef CONDITION_VARIABLE		cond_t;
+#define THREAD_RETURN			DWORD WINAPI
+#define thread_create(t, f)		((*(t) = CreateThread(NULL, 0, f, NULL, 0, NULL)) != NULL)
+#define thread_join(t)			do {WaitForSingleObject(t, INFINITE); CloseHandle(t);} while(0)
+#define mutex_init(m)			InitializeCriticalSection(m)
+#define mutex_destroy(m)		DeleteCriticalSection(m)
+#define mutex_lock(m)			EnterCriticalSection(m)
+#define mutex_unlock(m)			LeaveCriticalSection(m)
+#define cond_init(c)			InitializeConditionVariable(c)
+#define cond_destroy(c)
+#define cond_wait(c, m)			SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c)		WakeAllConditionVariable(c)
+#else
+typedef pthread_t				thread_t;
+typedef pthread_mutex_t			mutex_t;
+typedef pthread_cond_t			cond_t;
+#define THREAD_RETURN			void*
+#define thread_create(t, f)		(pthread_create(t, NULL, f, NULL) == 0)
+#define thread_join(t)			pthread_join(t, NULL)
+#define mutex_init(m)			pthread_mutex_init(m, NULL)
+#define mutex_destroy(m)		pthread_mutex_destroy(m)
+#define mutex_lock(m)			pthread_mutex_lock(m)
+#define mutex_unlock(m)			pthread_mutex_unlock(m)
+#define cond_init(c)			pthread_cond_init(c, NULL)
+#define cond_destroy(c)			pthread_cond_destroy(c)
+#define cond_wait(c, m)			pthread_cond_wait(c, m)
+#define cond_broadcast(c)		pthread_cond_broadcast(c)
+#endif
+
+// Monotonic time, in seconds
+static double get_time(void)
 {
-	size_t i;
+#if defined(_WIN32)
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+/*
+ * Each embedded file is formatted into its own memory chunk, so that files
+ * can be processed concurrently and still be written in order.
+ */
+typedef struct {
+	char* data;
+	size_t size;
+	size_t max_size;
+	int error;
+} chunk_t;
+
+// Make room for len more bytes. Returns a pointer to the end of the data, or NULL on error
+static char* chunk_reserve(chunk_t* c, size_t len)
+{
+	char* data;
+	size_t max_size;
+
+	if (c->error)
+		return NULL;
+	if (c->size + len > c->max_size) {
+		max_size = 2 * c->max_size;
+		if (max_size < c->size + len)
+			max_size = c->size + len + 1024;
+		data = realloc(c->data, max_size);
+		if (data == NULL) {
+			c->error = 1;
+			return NULL;
+		}
+		c->data = data;
+		c->max_size = max_size;
+	}
+	return &c->data[c->size];
+}
+
+static void chunk_printf(chunk_t* c, const char* format, ...)
+{
+	va_list args;
+	char* p;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if ((len < 0) || ((p = chunk_reserve(c, (size_t)len + 1)) == NULL))
+		return;
+	va_start(args, format);
+	vsnprintf(p, (size_t)len + 1, format, args);
+	va_end(args);
+	c->size += len;
+}
+
+/*
+ * Calling fprintf() for every single byte is very slow on large payloads, so
+ * we use a precomputed byte -> "0x##," table, and format whole lines straight
+ * into the output chunk.
+ */
+#define HEX_ENTRY_SIZE			5			// "0x##,"
+#define HEX_BYTES_PER_LINE		0x10
+static char hex_table[256][HEX_ENTRY_SIZE];
+
+static void init_hex_table(void)
+{
+	const char hex_digit[] = "0123456789ABCDEF";
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		hex_table[i][0] = '0';
+		hex_table[i][1] = 'x';
+		hex_table[i][2] = hex_digit[i >> 4];
+		hex_table[i][3] = hex_digit[i & 0x0F];
+		hex_table[i][4] = ',';
+	}
+}
+
+// hex_table must have been initialized with init_hex_table() beforehand
+void dump_buffer_hex(chunk_t* c, unsigned char *buffer, size_t size)
+{
+	size_t i, j, line_size;
+	char* p;
 
 	// Make sure we output something even if the original file is empty
 	if (size == 0) {
-		fprintf(fd, "0x00");
+		chunk_printf(c, "0x00\n");
+		return;
 	}
 
+	// "\n\t" for every line, an entry for every byte and a final "\n"
+	p = chunk_reserve(c, 2 * ((size + HEX_BYTES_PER_LINE - 1) / HEX_BYTES_PER_LINE) + size * HEX_ENTRY_SIZE + 1);
+	if (p == NULL)
+		return;
+	for (i = 0; i < size; i += HEX_BYTES_PER_LINE) {
+		line_size = size - i;
+		if (line_size > HEX_BYTES_PER_LINE)
+			line_size = HEX_BYTES_PER_LINE;
+		*p++ = '\n';
+		*p++ = '\t';
+		for (j = 0; j < line_size; j++) {
+			memcpy(p, hex_table[buffer[i + j]], HEX_ENTRY_SIZE);
+			p += HEX_ENTRY_SIZE;
+		}
+	}
+	*p++ = '\n';
+	c->size = p - c->data;
+}
+
+/*
+ * Output formats for the embedded data. Compilers are a lot faster at parsing
+ * string literals than they are at parsing arrays of hex values, and faster
+ * still when the data is pulled by the assembler (.incbin) or by the
+ * preprocessor (C23 #embed). All of them produce the same file_### arrays.
+ */
+enum embed_format {
+	FORMAT_HEX = 0,
+	FORMAT_STRING,
+	FORMAT_INCBIN,
+	FORMAT_EMBED,
+	FORMAT_MAX
+};
+static const char* format_name[FORMAT_MAX] = { "hex", "string", "incbin", "embed" };
+static int embed_format = FORMAT_HEX;
+// Compress the payloads, for the formats where we produce the data ourselves
+static int compress_data = 0;
+// Optional resource pack, written in addition to the header
+static const char* pack_name = NULL;
+
+/*
+ * Version of the layout of the embedder output, such as struct res. It is recorded in the
+ * manifest, so that a header produced by a different version of the embedder is never kept.
+ * Increase it whenever the output of the embedder changes for the same input files.
+ */
+#define EMBEDDER_LAYOUT_VERSION	1
+
+#define STRING_BYTES_PER_LINE	0x40
+
+void dump_buffer_string(chunk_t* c, unsigned char *buffer, size_t size)
+{
+	size_t i;
+	unsigned char b;
+	char* p;
+
+	// An empty literal still produces a 1 byte array
+	if (size == 0) {
+		chunk_printf(c, " \"\"");
+		return;
+	}
+
+	// Worst case is "\"\n\t\"" for every line, an octal escape for every byte and a final "\""
+	p = chunk_reserve(c, 4 * ((size + STRING_BYTES_PER_LINE - 1) / STRING_BYTES_PER_LINE) + size * 4 + 1);
+	if (p == NULL)
+		return;
 	for (i = 0; i < size; i++) {
-		if (!(i%0x10))
-			fprintf(fd, "\n\t");
-		fprintf(fd, "0x%02X,", buffer[i]);
+		if (!(i%STRING_BYTES_PER_LINE)) {
+			if (i != 0)
+				*p++ = '"';
+			*p++ = '\n';
+			*p++ = '\t';
+			*p++ = '"';
+		}
+		b = buffer[i];
+		// Octal escapes are always 3 digits, so they can be followed by anything.
+		// '?' is escaped to avoid trigraphs.
+		if ((b >= 0x20) && (b < 0x7F) && (b != '"') && (b != '\\') && (b != '?')) {
+			*p++ = (char)b;
+		} else {
+			*p++ = '\\';
+			*p++ = '0' + (b >> 6);
+			*p++ = '0' + ((b >> 3) & 7);
+			*p++ = '0' + (b & 7);
+		}
+	}
+	*p++ = '"';
+	c->size = p - c->data;
+}
+
+/*
+ * Output a path for the assembler or the preprocessor, which both accept '/' as separator
+ * on Windows. For .incbin, the path is an assembler string within a C string literal, so
+ * that quotes, backslashes and control characters need to be escaped twice. #embed does
+ * not process escapes, so paths with such characters cannot be used there.
+ * Returns 0 on success, -1 if the path cannot be represented.
+ */
+static int dump_path(chunk_t* c, const char* path, int is_asm)
+{
+	size_t i, len = strlen(path);
+	// Worst case is a control character, that becomes "\\ooo"
+	char* p = chunk_reserve(c, 5 * len);
+	unsigned char ch;
+
+	if (p == NULL)
+		return 0;
+	for (i = 0; i < len; i++) {
+		ch = (unsigned char)path[i];
+		if ((NATIVE_SEPARATOR == '\\') && (ch == '\\'))
+			ch = '/';
+		if ((ch == '"') || (ch == '\\') || (ch < 0x20) || (ch == 0x7F)) {
+			if (!is_asm)
+				return -1;
+			*p++ = '\\';
+			*p++ = '\\';
+			if ((ch < 0x20) || (ch == 0x7F)) {
+				*p++ = '0' + (ch >> 6);
+				*p++ = '0' + ((ch >> 3) & 7);
+				*p++ = '0' + (ch & 7);
+				continue;
+			}
+			*p++ = '\\';
+		}
+		*p++ = (char)ch;
+	}
+	c->size = p - c->data;
+	return 0;
+}
+
+// GCC and Clang only, since MSVC doesn't support top level assembly
+void dump_file_incbin(chunk_t* c, const char* internal_name, const char* path, size_t size)
+{
+	chunk_printf(c, "extern const unsigned char %s[] __asm__(\"wdi_%s\");\n", internal_name, internal_name);
+	chunk_printf(c, "__asm__(INCBIN_SECTION\n" \
+		"\t\".balign 16\\n\"\n" \
+		"\t\"wdi_%s:\\n\"\n" \
+		"\t\".incbin \\\"", internal_name);
+	dump_path(c, path, 1);
+	chunk_printf(c, "\\\"\\n\"\n");
+	if (size == 0)
+		chunk_printf(c, "\t\".byte 0\\n\"\n");
+	// Restore whatever section the compiler was using
+	chunk_printf(c, "\t\".popsection\\n\");\n\n");
+}
+
+int dump_file_embed(chunk_t* c, const char* internal_name, const char* path)
+{
+	chunk_printf(c, "const unsigned char %s[] = {\n#embed \"", internal_name);
+	if (dump_path(c, path, 0) != 0)
+		return -1;
+	chunk_printf(c, "\" if_empty(0)\n};\n\n");
+	return 0;
+}
+
+static void dump_preamble(FILE* fd)
+{
+	switch (embed_format) {
+	case FORMAT_INCBIN:
+		fprintf(fd, "#if defined(_MSC_VER)\n" \
+			"#error This embedded.h uses .incbin, which MSVC does not support. Use a different embedder format.\n" \
+			"#endif\n" \
+			"#if defined(_WIN32)\n" \
+			"#define INCBIN_SECTION \".pushsection .rdata,\\\"dr\\\"\\n\"\n" \
+			"#else\n" \
+			"#define INCBIN_SECTION \".pushsection .rodata\\n\"\n" \
+			"#endif\n\n");
+		break;
+	case FORMAT_EMBED:
+		fprintf(fd, "#if !defined(__has_embed)\n" \
+			"#error This embedded.h uses #embed, which your compiler does not support. Use a different embedder format.\n" \
+			"#endif\n\n");
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * SHA-1, used to detect content changes in the embedded files.
+ * Based on the public domain implementation from Steve Reid.
+ */
+#define SHA1_HASH_SIZE	20
+typedef struct {
+	uint32_t state[5];
+	uint64_t count;
+	unsigned char buffer[64];
+} sha1_ctx;
+
+#define ROL32(v, n)		(((v) << (n)) | ((v) >> (32 - (n))))
+
+static void sha1_transform(uint32_t state[5], const unsigned char block[64])
+{
+	uint32_t a, b, c, d, e, t, w[80];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = ((uint32_t)block[4*i] << 24) | ((uint32_t)block[4*i+1] << 16) |
+			((uint32_t)block[4*i+2] << 8) | (uint32_t)block[4*i+3];
+	for (; i < 80; i++)
+		w[i] = ROL32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4];
+	for (i = 0; i < 80; i++) {
+		if (i < 20)
+			t = ((b & c) | (~b & d)) + 0x5A827999;
+		else if (i < 40)
+			t = (b ^ c ^ d) + 0x6ED9EBA1;
+		else if (i < 60)
+			t = ((b & c) | (b & d) | (c & d)) + 0x8F1BBCDC;
+		else
+			t = (b ^ c ^ d) + 0xCA62C1D6;
+		t += ROL32(a, 5) + e + w[i];
+		e = d; d = c; c = ROL32(b, 30); b = a; a = t;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+static void sha1_init(sha1_ctx* ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xEFCDAB89;
+	ctx->state[2] = 0x98BADCFE;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xC3D2E1F0;
+	ctx->count = 0;
+}
+
+static void sha1_update(sha1_ctx* ctx, const unsigned char* data, size_t len)
+{
+	size_t used = (size_t)(ctx->count & 63), n;
+
+	ctx->count += len;
+	if (used != 0) {
+		n = 64 - used;
+		if (len < n) {
+			memcpy(&ctx->buffer[used], data, len);
+			return;
+		}
+		memcpy(&ctx->buffer[used], data, n);
+		sha1_transform(ctx->state, ctx->buffer);
+		data += n;
+		len -= n;
+	}
+	for (; len >= 64; data += 64, len -= 64)
+		sha1_transform(ctx->state, data);
+	memcpy(ctx->buffer, data, len);
+}
+
+static void sha1_final(sha1_ctx* ctx, unsigned char hash[SHA1_HASH_SIZE])
+{
+	unsigned char pad[72] = { 0x80 };
+	uint64_t bits = ctx->count * 8;
+	size_t pad_len = (size_t)(((ctx->count & 63) < 56) ? (56 - (ctx->count & 63)) : (120 - (ctx->count & 63)));
+	int i;
+
+	for (i = 0; i < 8; i++)
+		pad[pad_len + i] = (unsigned char)(bits >> (56 - 8 * i));
+	sha1_update(ctx, pad, pad_len + 8);
+	for (i = 0; i < SHA1_HASH_SIZE; i++)
+		hash[i] = (unsigned char)(ctx->state[i >> 2] >> (24 - 8 * (i & 3)));
+}
+
+// fopen() that accepts UTF-8 paths on Windows
+static FILE* fopen_utf8(const char* path, const char* mode)
+{
+#if defined(_WIN32)
+	wchar_t wpath[MAX_PATH], wmode[8];
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, MAX_PATH);
+	MultiByteToWideChar(CP_UTF8, 0, mode, -1, wmode, 8);
+	return _wfopen(wpath, wmode);
+#else
+	return fopen(path, mode);
+#endif
+}
+
+// returns 0 on success, non zero on error
+static int hash_file(const char* path, unsigned char hash[SHA1_HASH_SIZE], size_t* size)
+{
+	unsigned char buf[64 * 1024];
+	size_t len;
+	sha1_ctx ctx;
+	FILE* fd = fopen_utf8(path, "rb");
+
+	if (fd == NULL)
+		return 1;
+	sha1_init(&ctx);
+	*size = 0;
+	while ((len = fread(buf, 1, sizeof(buf), fd)) != 0) {
+		sha1_update(&ctx, buf, len);
+		*size += len;
+	}
+	len = ferror(fd);
+	fclose(fd);
+	sha1_final(&ctx, hash);
+	return (int)len;
+}
+
+// returns 1 if both files exist and have the same content, 0 otherwise
+static int same_content(const char* path1, const char* path2)
+{
+	static unsigned char buf1[64 * 1024], buf2[64 * 1024];
+	size_t len1, len2;
+	int r = 0;
+	FILE *fd1 = fopen_utf8(path1, "rb"), *fd2 = fopen_utf8(path2, "rb");
+
+	if ((fd1 == NULL) || (fd2 == NULL))
+		goto out;
+	do {
+		len1 = fread(buf1, 1, sizeof(buf1), fd1);
+		len2 = fread(buf2, 1, sizeof(buf2), fd2);
+		if ((len1 != len2) || (memcmp(buf1, buf2, len1) != 0))
+			goto out;
+	} while (len1 != 0);
+	r = 1;
+out:
+	if (fd1 != NULL)
+		fclose(fd1);
+	if (fd2 != NULL)
+		fclose(fd2);
+	return r;
+}
+
+// Replace dst with src, unless they are the same, so that dst keeps its timestamp
+// returns 0 on success, non zero on error
+static int replace_if_different(const char* src, const char* dst)
+{
+	if (same_content(src, dst)) {
+		NATIVE_UNLINK(src);
+		return 0;
+	}
+#if defined(_WIN32)
+	return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING) ? 0 : 1;
+#else
+	return rename(src, dst);
+#endif
+}
+
+/*
+ * Minimal PE parser, to retrieve the VS_FIXEDFILEINFO of the embedded DLLs and
+ * executables at build time, so that the library doesn't have to extract them
+ * to call GetFileVersionInfo(). Any input must be handled, as we attempt to
+ * parse every single file we embed.
+ */
+#define VERSION_INFO_SIZE		13			// VS_FIXEDFILEINFO size, in DWORDs
+#define VERSION_INFO_SIGNATURE	0xFEEF04BD
+#define RT_VERSION_ID			16
+
+static __inline uint16_t get_le16(const unsigned char* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static __inline uint32_t get_le32(const unsigned char* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Convert an RVA to a file offset, and return the number of bytes available from there
+static size_t pe_map_rva(const unsigned char* buf, size_t size, size_t sections, int nb_sections,
+	uint32_t rva, size_t* offset)
+{
+	const unsigned char* section;
+	uint32_t va, virtual_size, raw_size, raw_offset;
+	int i;
+
+	for (i = 0; i < nb_sections; i++) {
+		section = &buf[sections + 40 * i];
+		virtual_size = get_le32(&section[8]);
+		va = get_le32(&section[12]);
+		raw_size = get_le32(&section[16]);
+		raw_offset = get_le32(&section[20]);
+		if ((rva < va) || (rva - va >= ((virtual_size > raw_size) ? virtual_size : raw_size)))
+			continue;
+		if ((rva - va >= raw_size) || (raw_offset >= size) || (rva - va >= size - raw_offset))
+			return 0;
+		*offset = raw_offset + (rva - va);
+		return ((raw_size - (rva - va)) < (size - *offset)) ? (raw_size - (rva - va)) : (size - *offset);
+	}
+	return 0;
+}
+
+// Return the offset of the first resource entry matching id (any entry if id is 0), or 0 on error
+static uint32_t pe_resource_entry(const unsigned char* rsrc, size_t rsrc_size, uint32_t dir, uint32_t id, int is_dir)
+{
+	uint32_t i, nb_entries, entry, offset;
+
+	if ((rsrc_size < 16) || (dir > rsrc_size - 16))
+		return 0;
+	nb_entries = get_le16(&rsrc[dir + 12]) + get_le16(&rsrc[dir + 14]);
+	for (i = 0; i < nb_entries; i++) {
+		entry = dir + 16 + 8 * i;
+		if (entry > rsrc_size - 8)
+			return 0;
+		// Named entries have bit 31 set, so they never match an id
+		if ((id != 0) && (get_le32(&rsrc[entry]) != id))
+			continue;
+		offset = get_le32(&rsrc[entry + 4]);
+		if (((offset & 0x80000000) != 0) != is_dir)
+			return 0;
+		return offset & 0x7FFFFFFF;
+	}
+	return 0;
+}
+
+/*
+ * Locate the optional header of a PE file, along with the offset of its data
+ * directories (relative to the optional header). Returns 0 if the file is a PE.
+ */
+static int pe_get_headers(const unsigned char* buf, size_t size, size_t* opt, size_t* opt_size,
+	size_t* dirs, int* nb_sections)
+{
+	size_t pe;
+
+	if ((size < 0x40) || (buf[0] != 'M') || (buf[1] != 'Z'))
+		return 1;
+	pe = get_le32(&buf[0x3C]);
+	if ((pe > size - 24) || (memcmp(&buf[pe], "PE\0\0", 4) != 0))
+		return 1;
+	*nb_sections = get_le16(&buf[pe + 6]);
+	*opt_size = get_le16(&buf[pe + 20]);
+	*opt = pe + 24;
+	if ((*opt_size < 2) || (*opt_size > size - *opt))
+		return 1;
+	// The data directories are at a different offset for PE32 and PE32+
+	switch (get_le16(&buf[*opt])) {
+	case 0x10B:
+		*dirs = 96;
+		break;
+	case 0x20B:
+		*dirs = 112;
+		break;
+	default:
+		return 1;
+	}
+	return (*opt_size < *dirs) ? 1 : 0;
+}
+
+// returns 0 if a VS_FIXEDFILEINFO was found, non zero otherwise
+static int pe_get_version_info(const unsigned char* buf, size_t size, uint32_t info[VERSION_INFO_SIZE])
+{
+	// "VS_VERSION_INFO" in UTF-16
+	const unsigned char key[] = { 'V',0,'S',0,'_',0,'V',0,'E',0,'R',0,'S',0,'I',0,'O',0,'N',0,'_',0,'I',0,'N',0,'F',0,'O',0,0,0 };
+	size_t opt, opt_size, dirs, sections, rsrc = 0, rsrc_size, data = 0, data_size;
+	uint32_t entry;
+	int i, nb_sections;
+
+	if (pe_get_headers(buf, size, &opt, &opt_size, &dirs, &nb_sections) != 0)
+		return 1;
+	// We want the resource directory, which is the third one
+	if ((opt_size < dirs + 3 * 8) || (get_le32(&buf[opt + dirs - 4]) < 3))
+		return 1;
+	sections = opt + opt_size;
+	if ((size_t)nb_sections * 40 > size - sections)
+		return 1;
+	rsrc_size = pe_map_rva(buf, size, sections, nb_sections, get_le32(&buf[opt + dirs + 16]), &rsrc);
+	if (rsrc_size > get_le32(&buf[opt + dirs + 20]))
+		rsrc_size = get_le32(&buf[opt + dirs + 20]);
+
+	// Type -> Name -> Language
+	entry = pe_resource_entry(&buf[rsrc], rsrc_size, 0, RT_VERSION_ID, 1);
+	if (entry != 0)
+		entry = pe_resource_entry(&buf[rsrc], rsrc_size, entry, 0, 1);
+	if (entry != 0)
+		entry = pe_resource_entry(&buf[rsrc], rsrc_size, entry, 0, 0);
+	if ((entry == 0) || (entry > rsrc_size - 16))
+		return 1;
+	data_size = pe_map_rva(buf, size, sections, nb_sections, get_le32(&buf[rsrc + entry]), &data);
+	if (data_size > get_le32(&buf[rsrc + entry + 4]))
+		data_size = get_le32(&buf[rsrc + entry + 4]);
+
+	// VS_VERSIONINFO: 3 WORDs, the UTF-16 key, padding to a DWORD boundary then VS_FIXEDFILEINFO
+	if ( (data_size < 40 + 4 * VERSION_INFO_SIZE)
+	  || (get_le16(&buf[data + 2]) < 4 * VERSION_INFO_SIZE)
+	  || (memcmp(&buf[data + 6], key, sizeof(key)) != 0)
+	  || (get_le32(&buf[data + 40]) != VERSION_INFO_SIGNATURE) )
+		return 1;
+	for (i = 0; i < VERSION_INFO_SIZE; i++)
+		info[i] = get_le32(&buf[data + 40 + 4 * i]);
+	return 0;
+}
+
+/*
+ * Authenticode digest of a PE file, as computed by CryptCATAdminCalcHashFromFileHandle()
+ * when creating a cat file: a SHA-1 of the whole file, minus the checksum, the certificate
+ * table directory entry and the certificate table itself.
+ * Returns non zero if the file is not a PE, in which case the digest is a plain SHA-1.
+ */
+static int pe_get_authenticode_hash(const unsigned char* buf, size_t size, unsigned char hash[SHA1_HASH_SIZE])
+{
+	size_t opt, opt_size, dirs, pos, cert_dir, cert_offset, end = size;
+	int nb_sections;
+	sha1_ctx ctx;
+
+	if (pe_get_headers(buf, size, &opt, &opt_size, &dirs, &nb_sections) != 0)
+		return 1;
+	sha1_init(&ctx);
+	// The checksum is at the same offset for PE32 and PE32+
+	sha1_update(&ctx, buf, opt + 64);
+	pos = opt + 68;
+	// The certificate table is the fifth data directory, and its address is a file offset
+	if ((opt_size >= dirs + 5 * 8) && (get_le32(&buf[opt + dirs - 4]) >= 5)) {
+		cert_dir = opt + dirs + 4 * 8;
+		sha1_update(&ctx, &buf[pos], cert_dir - pos);
+		pos = cert_dir + 8;
+		cert_offset = get_le32(&buf[cert_dir]);
+		if ((get_le32(&buf[cert_dir + 4]) != 0) && (cert_offset >= pos) && (cert_offset < size))
+			end = cert_offset;
+	}
+	sha1_update(&ctx, &buf[pos], end - pos);
+	sha1_final(&ctx, hash);
+	return 0;
+}
+
+/*
+ * Content-addressed deduplication: identical files (e.g. the same DLL found in
+ * multiple USER_DIR subdirectories) are only embedded once, with every
+ * matching resource pointing to the data of the first instance.
+ */
+static const unsigned char (*dedup_hash)[SHA1_HASH_SIZE];
+static const size_t* dedup_size;
+
+static int dedup_cmp(const void* p1, const void* p2)
+{
+	int i1 = *(const int*)p1, i2 = *(const int*)p2, r;
+
+	if (dedup_size[i1] != dedup_size[i2])
+		return (dedup_size[i1] < dedup_size[i2]) ? -1 : 1;
+	r = memcmp(dedup_hash[i1], dedup_hash[i2], SHA1_HASH_SIZE);
+	if (r != 0)
+		return r;
+	return i1 - i2;
+}
+
+// Fill file_source[] with the index of the embeddable holding the data, and return the bytes saved
+static uint64_t dedup_files(int* file_source, const unsigned char (*file_hash)[SHA1_HASH_SIZE],
+	const size_t* file_size, int* nb_duplicates)
+{
+	int i, n, last, *order = NULL;
+	uint64_t saved = 0;
+
+	*nb_duplicates = 0;
+	for (n = 0, last = 0, i = 0; i < nb_embeddables; i++) {
+		if (embeddable[i].reuse_last) {
+			file_source[i] = last;
+			continue;
+		}
+		file_source[i] = i;
+		last = i;
+		n++;
 	}
-	fprintf(fd, "\n");
+	order = malloc(n * sizeof(int));
+	if (order == NULL)
+		return 0;
+	for (n = 0, i = 0; i < nb_embeddables; i++) {
+		if (!embeddable[i].reuse_last)
+			order[n++] = i;
+	}
+	dedup_hash = file_hash;
+	dedup_size = file_size;
+	qsort(order, n, sizeof(int), dedup_cmp);
+	// Identical files are now adjacent, with the lowest index first
+	for (i = 1; i < n; i++) {
+		if ( (file_size[order[i]] == file_size[order[i-1]])
+		  && (memcmp(file_hash[order[i]], file_hash[order[i-1]], SHA1_HASH_SIZE) == 0) ) {
+			file_source[order[i]] = file_source[order[i-1]];
+			saved += file_size[order[i]];
+			(*nb_duplicates)++;
+		}
+	}
+	// Resources that reuse the last file must follow its deduplicated source
+	for (i = 0; i < nb_embeddables; i++) {
+		if (embeddable[i].reuse_last)
+			file_source[i] = file_source[file_source[i]];
+	}
+	free(order);
+	return saved;
+}
+
+/*
+ * Lookup indexes: the resource[] indexes sorted by name, and by (subdir, name),
+ * so that the library can find a resource with a binary search. Ties are broken
+ * on the index, so that a search returns the same entry as a linear scan would.
+ */
+static char** index_name;
+static char** index_subdir;
+
+static int name_cmp(const void* p1, const void* p2)
+{
+	int i1 = *(const int*)p1, i2 = *(const int*)p2;
+	int r = strcmp(index_name[i1], index_name[i2]);
+
+	return (r != 0) ? r : (i1 - i2);
+}
+
+static int path_cmp(const void* p1, const void* p2)
+{
+	int i1 = *(const int*)p1, i2 = *(const int*)p2;
+	int r = strcmp(index_subdir[i1], index_subdir[i2]);
+
+	return (r != 0) ? r : name_cmp(p1, p2);
+}
+
+// returns 0 on success, non zero on error
+static int dump_index(FILE* fd, const char* array_name, int (*cmp)(const void*, const void*))
+{
+	int i, *order = malloc(nb_embeddables * sizeof(int));
+
+	if (order == NULL)
+		return 1;
+	for (i = 0; i < nb_embeddables; i++)
+		order[i] = i;
+	qsort(order, nb_embeddables, sizeof(int), cmp);
+	fprintf(fd, "\nconst int %s[] = {", array_name);
+	for (i = 0; i < nb_embeddables; i++)
+		fprintf(fd, "%s%d,", (i % 16) ? " " : "\n\t", order[i]);
+	fprintf(fd, "\n};\n");
+	free(order);
+	return 0;
+}
+
+// Pad a resource pack with zeroes up to position end. Returns 0 on success.
+static int pack_pad(FILE* fd, uint64_t* pos, uint64_t end)
+{
+	for (; *pos < end; (*pos)++) {
+		if (fputc(0, fd) == EOF)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Complete a resource pack, for which the data has already been written up to
+ * pos, by appending the string table and filling the header and the table of
+ * contents. entry[] is indexed by source file.
+ * returns 0 on success, non zero on error
+ */
+static int finish_pack(FILE* fd, uint64_t pos, const struct pack_entry* entry, const int* file_source)
+{
+	uint8_t buf[PACK_ENTRY_SIZE];
+	struct pack_entry e;
+	uint32_t strings_size = 0, name_len, subdir_len;
+	int i;
+
+	if (pos > UINT32_MAX)
+		return 1;
+	// The string table comes after the data
+	for (i = 0; i < nb_embeddables; i++) {
+		name_len = (uint32_t)strlen(index_name[i]) + 1;
+		subdir_len = (uint32_t)strlen(index_subdir[i]) + 1;
+		if ( (fwrite(index_name[i], 1, name_len, fd) != name_len)
+		  || (fwrite(index_subdir[i], 1, subdir_len, fd) != subdir_len) )
+			return 1;
+		strings_size += name_len + subdir_len;
+	}
+
+	if (fseek(fd, 0, SEEK_SET) != 0)
+		return 1;
+	pack_write_header(buf, nb_embeddables, (uint32_t)pos, strings_size, pos + strings_size);
+	if (fwrite(buf, 1, PACK_HEADER_SIZE, fd) != PACK_HEADER_SIZE)
+		return 1;
+	for (strings_size = 0, i = 0; i < nb_embeddables; i++) {
+		name_len = (uint32_t)strlen(index_name[i]) + 1;
+		// Duplicates share the data of their source, but keep their own tags
+		e = entry[file_source[i]];
+		e.tags = embeddable[i].tags;
+		pack_write_entry(buf, strings_size, strings_size + name_len, &e);
+		if (fwrite(buf, 1, PACK_ENTRY_SIZE, fd) != PACK_ENTRY_SIZE)
+			return 1;
+		strings_size += name_len + (uint32_t)strlen(index_subdir[i]) + 1;
+	}
+	return 0;
 }
 
 void handle_separators(char* path)
@@ -176,154 +974,480 @@ int get_full_path(char* src, char* dst, size_t dst_size)
 }
 
 #if defined(USER_DIR)
-// Modified from http://www.zemris.fer.hr/predmeti/os1/misc/Unix2Win.htm
-void scan_dir(char *dirname, int countfiles)
+/*
+ * The user files are collected in a single pass, and then sorted, so that
+ * the resources don't depend on the order in which the directories are read.
+ */
+static struct {
+	struct emb* entry;
+	int nb_entries;
+	int max_entries;
+} user_files;
+
+// dirname is either empty or starts with a separator. Returns 0 on success.
+static int add_user_file(const char* dirname, const char* entry)
+{
+	struct emb* new_entry;
+	int max_entries;
+
+	if (user_files.nb_entries >= user_files.max_entries) {
+		max_entries = (user_files.max_entries == 0) ? 256 : 2 * user_files.max_entries;
+		new_entry = realloc(user_files.entry, max_entries * sizeof(struct emb));
+		if (new_entry == NULL)
+			return 1;
+		user_files.entry = new_entry;
+		user_files.max_entries = max_entries;
+	}
+	new_entry = &user_files.entry[user_files.nb_entries];
+	new_entry->reuse_last = 0;
+	new_entry->tags = 0;
+	new_entry->file_name = malloc(strlen(initial_dir) + strlen(dirname) + strlen(entry) + 2);
+	new_entry->extraction_subdir = NATIVE_STRDUP((dirname[0] == 0) ? "." : &dirname[1]);
+	if ((new_entry->file_name == NULL) || (new_entry->extraction_subdir == NULL)) {
+		safe_free(new_entry->file_name);
+		safe_free(new_entry->extraction_subdir);
+		return 1;
+	}
+	sprintf(new_entry->file_name, "%s%s%c%s", initial_dir, dirname, NATIVE_SEPARATOR, entry);
+	user_files.nb_entries++;
+	return 0;
+}
+
+static int user_file_cmp(const void* p1, const void* p2)
+{
+	return strcmp(((const struct emb*)p1)->file_name, ((const struct emb*)p2)->file_name);
+}
+
+// Returns 0 on success, non zero on error
+#if defined(_WIN32)
+static int scan_dir(const char* dirname)
 {
 	char dir[MAX_PATH+1];
 	char subdir[MAX_PATH+1];
-#if defined(_WIN32)
 	char entry[MAX_PATH];
 	wchar_t wdir[MAX_PATH+1];
 	HANDLE hList;
 	WIN32_FIND_DATAW FileData;
-#else
-	char* entry;
-	int r;
-	DIR *dp;
-	char cwd[MAX_PATH];
-	struct dirent* dir_entry;
-	struct stat stat_info;
-#endif
+	int len, r = 0;
 
-	// Get the proper directory path
-	if ( (strlen(initial_dir) + strlen(dirname) + 4) > sizeof(dir) ) {
+	len = snprintf(dir, sizeof(dir), "%s%s\\*", initial_dir, dirname);
+	if ((len < 0) || ((size_t)len >= sizeof(dir))) {
 		perr("Path overflow.\n");
-		return;
+		return 1;
 	}
-	sprintf(dir, "%s%c%s", initial_dir, NATIVE_SEPARATOR, dirname);
-
-	// Get the first file
-#if defined(_WIN32)
-	strcat(dir, "\\*");
 	MultiByteToWideChar(CP_UTF8, 0, dir, -1, wdir, MAX_PATH);
 	hList = FindFirstFileW(wdir, &FileData);
-	if (hList == INVALID_HANDLE_VALUE) return;
-#else
-	dp = opendir(dir);
-	if (dp == NULL) return;
-	dir_entry = readdir(dp);
-	if (dir_entry == NULL) return;
-#endif
+	if (hList == INVALID_HANDLE_VALUE)
+		return 0;
 
-	// Traverse through the directory structure
+	// FindFirstFile() already provides the attributes, so we don't need to stat
 	do {
-		// Check if the object is a directory or not
-#if defined(_WIN32)
 		WideCharToMultiByte(CP_UTF8, 0, FileData.cFileName, -1, entry, MAX_PATH, NULL, NULL);
-		if (FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-#else
-		entry = dir_entry->d_name;
-		getcwd(cwd, sizeof(cwd));
-		chdir(dir);
-		r = NATIVE_STAT(entry, &stat_info);
-		chdir(cwd);
-		if (r != 0) {
-			continue;
-		}
-		if (S_ISDIR(stat_info.st_mode)) {
-#endif
-			if ( (strcmp(entry, ".") != 0)
-			  && (strcmp(entry, "..") != 0)) {
-				// Get the full path for sub directory
-				if ( (strlen(dirname) + strlen(entry) + 2) > sizeof(subdir) ) {
-					perr("Path overflow.\n");
-					return;
-				}
-				sprintf(subdir, "%s%c%s", dirname, NATIVE_SEPARATOR, entry);
-				scan_dir(subdir, countfiles);
-			}
-		} else {
-			if (!countfiles) {
-				if ( (embeddable[nb_embeddables].file_name =
-					  malloc(strlen(initial_dir) + strlen(dirname) +
-					  strlen(entry) + 2) ) == NULL) {
-					return;
-				}
-				if ( (embeddable[nb_embeddables].extraction_subdir =
-					  malloc(strlen(dirname)) ) == NULL) {
-					return;
-				}
-				sprintf(embeddable[nb_embeddables].file_name,
-					"%s%s%c%s", initial_dir, dirname, NATIVE_SEPARATOR, entry);
-				if (dirname[0] == NATIVE_SEPARATOR) {
-					sprintf(embeddable[nb_embeddables].extraction_subdir,
-						"%s", dirname+1);
-				} else {
-					safe_free(embeddable[nb_embeddables].extraction_subdir);
-					embeddable[nb_embeddables].extraction_subdir = NATIVE_STRDUP(".");
-				}
+		if (!(FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			r = add_user_file(dirname, entry);
+		} else if ((strcmp(entry, ".") != 0) && (strcmp(entry, "..") != 0)) {
+			len = snprintf(subdir, sizeof(subdir), "%s%c%s", dirname, NATIVE_SEPARATOR, entry);
+			if ((len < 0) || ((size_t)len >= sizeof(subdir))) {
+				perr("Path overflow.\n");
+				r = 1;
+				break;
 			}
-			nb_embeddables++;
+			r = scan_dir(subdir);
 		}
-	}
-#if defined(_WIN32)
-	while ( FindNextFileW(hList, &FileData) || (GetLastError() != ERROR_NO_MORE_FILES) );
+	} while ( (r == 0) && (FindNextFileW(hList, &FileData) || (GetLastError() != ERROR_NO_MORE_FILES)) );
 	FindClose(hList);
+	return r;
+}
 #else
-	while ((dir_entry = readdir(dp)) != NULL);
-	closedir(dp);
+static int scan_dir(DIR* dp, const char* dirname)
+{
+	char subdir[MAX_PATH+1];
+	struct dirent* dir_entry;
+	struct stat stat_info;
+	DIR* sub_dp;
+	int fd, is_dir, len, r = 0;
+
+	while ((r == 0) && ((dir_entry = readdir(dp)) != NULL)) {
+		if ((strcmp(dir_entry->d_name, ".") == 0) || (strcmp(dir_entry->d_name, "..") == 0))
+			continue;
+#if defined(DT_UNKNOWN)
+		// Only symlinks, and file systems that don't report the type, need a stat
+		if ((dir_entry->d_type != DT_UNKNOWN) && (dir_entry->d_type != DT_LNK)) {
+			is_dir = (dir_entry->d_type == DT_DIR);
+		} else
 #endif
+		{
+			if (fstatat(dirfd(dp), dir_entry->d_name, &stat_info, 0) != 0)
+				continue;
+			is_dir = S_ISDIR(stat_info.st_mode);
+		}
+		if (!is_dir) {
+			r = add_user_file(dirname, dir_entry->d_name);
+			continue;
+		}
+		len = snprintf(subdir, sizeof(subdir), "%s%c%s", dirname, NATIVE_SEPARATOR, dir_entry->d_name);
+		if ((len < 0) || ((size_t)len >= sizeof(subdir))) {
+			perr("Path overflow.\n");
+			r = 1;
+			break;
+		}
+		// Open the subdirectory relative to the current one, rather than through its path
+		fd = openat(dirfd(dp), dir_entry->d_name, O_RDONLY | O_DIRECTORY);
+		if (fd < 0)
+			continue;
+		sub_dp = fdopendir(fd);
+		if (sub_dp == NULL) {
+			close(fd);
+			continue;
+		}
+		r = scan_dir(sub_dp, subdir);
+		closedir(sub_dp);
+	}
+	return r;
 }
+#endif
 
 void add_user_files(void) {
-	int i;
+	int i, r = 0;
+#if !defined(_WIN32)
+	DIR* dp;
+#endif
 
 	get_full_path(USER_DIR, initial_dir, sizeof(initial_dir));
-	// Dry run to count additional files
-	scan_dir("", -1);
-	if (nb_embeddables == nb_embeddables_fixed) {
+#if defined(_WIN32)
+	r = scan_dir("");
+#else
+	dp = opendir(initial_dir);
+	if (dp != NULL) {
+		r = scan_dir(dp, "");
+		closedir(dp);
+	}
+#endif
+	if (r != 0) {
+		perr("Could not include user embeddable files.\n");
+		goto out;
+	}
+	if (user_files.nb_entries == 0) {
 		perr("No user embeddable files found.\nNote that the USER_DIR path must be provided in Windows format\n" \
 			"(eg: 'C:\\signed-driver'), if compiling from a Windows platform.\n");
-		return;
+		goto out;
 	}
+	qsort(user_files.entry, user_files.nb_entries, sizeof(struct emb), user_file_cmp);
 
-	// Extend the array to add the user files
-	embeddable = calloc(nb_embeddables, sizeof(struct emb));
+	// Extend the array to add the user files, after the fixed part of our table
+	embeddable = calloc(nb_embeddables_fixed + user_files.nb_entries, sizeof(struct emb));
 	if (embeddable == NULL) {
 		perr("Could not include user embeddable files.\n");
+		embeddable = embeddable_fixed;
+		goto out;
+	}
+	memcpy(embeddable, embeddable_fixed, nb_embeddables_fixed * sizeof(struct emb));
+	memcpy(&embeddable[nb_embeddables_fixed], user_files.entry, user_files.nb_entries * sizeof(struct emb));
+	nb_embeddables = nb_embeddables_fixed + user_files.nb_entries;
+	// The strings now belong to embeddable[]
+	user_files.nb_entries = 0;
+
+out:
+	for (i = 0; i < user_files.nb_entries; i++) {
+		safe_free(user_files.entry[i].file_name);
+		safe_free(user_files.entry[i].extraction_subdir);
+	}
+	safe_free(user_files.entry);
+}
+#endif
+
+/*
+ * Embedding pipeline: worker threads read, compress and format the files
+ * into memory chunks, which the main thread then writes to the header, in
+ * the original resource order, so that the output is always the same.
+ * Workers can only run so far ahead of the writer, to keep memory in check.
+ */
+#define MAX_THREADS				64
+#define JOBS_PER_THREAD			4
+
+struct embed_job {
+	int index;				// index in embeddable[]
+	const char* path;
+	size_t size;
+	size_t csize;			// 0 if not compressed
+	int64_t time;
+	int has_version;
+	uint32_t version[VERSION_INFO_SIZE];
+	int has_digest;
+	unsigned char digest[SHA1_HASH_SIZE];	// Authenticode digest of PE files
+	unsigned char* payload;	// data to add to the resource pack, if any
+	size_t payload_size;
+	const char* error;		// NULL on success
+	double read_time;
+	double format_time;
+	chunk_t chunk;
+	int done;
+};
+
+static struct {
+	struct embed_job* job;
+	int nb_jobs;
+	int nb_threads;
+	int next;				// next job to be processed
+	int written;			// number of jobs written to the header
+	int window;				// max number of processed jobs awaiting write
+	int abort;
+	int running;
+	mutex_t lock;
+	cond_t cond;
+	thread_t thread[MAX_THREADS];
+} pipeline;
+
+static void process_job(struct embed_job* job)
+{
+	FILE* fd;
+	struct NATIVE_STAT stbuf;
+	char internal_name[16];
+	unsigned char magic[2];
+	unsigned char *buffer = NULL, *cbuffer = NULL;
+	size_t data_size, cbound;
+	int i, read_data;
+	double t0 = get_time(), t1 = t0;
+
+	sprintf(internal_name, "file_%03X", job->index);
+	fd = fopen_utf8(job->path, "rb");
+	if (fd == NULL) {
+		job->error = "Could not open file";
 		return;
 	}
-	// Copy the fixed part of our table into our new array
-	for (i = 0; i < nb_embeddables_fixed; i++) {
-		embeddable[i].reuse_last = embeddable_fixed[i].reuse_last;
-		embeddable[i].file_name = embeddable_fixed[i].file_name;
-		embeddable[i].extraction_subdir = embeddable_fixed[i].extraction_subdir;
+
+	// Read the creation date and size
+	if (NATIVE_STAT(job->path, &stbuf) != 0) {
+		fclose(fd);
+		job->error = "Could not stat file";
+		return;
 	}
-	nb_embeddables = nb_embeddables_fixed;
+	job->time = (int64_t)stbuf.st_ctime;
+	job->size = (size_t)stbuf.st_size;
 
-	// Fill in the array
-	scan_dir("", 0);
+	read_data = (embed_format == FORMAT_HEX) || (embed_format == FORMAT_STRING) || (pack_name != NULL);
+	if (!read_data) {
+		// The assembler or the preprocessor read the file themselves, so we
+		// only need the data of PE files, for their version info
+		read_data = (fread(magic, 1, 2, fd) == 2) && (magic[0] == 'M') && (magic[1] == 'Z');
+		rewind(fd);
+	}
+	if (read_data) {
+		buffer = (unsigned char*) malloc(job->size + 1);
+		if (buffer == NULL) {
+			fclose(fd);
+			job->error = "Could not allocate buffer for";
+			return;
+		}
+		if (fread(buffer, 1, job->size, fd) != job->size) {
+			fclose(fd);
+			job->error = "Could not read file";
+			goto out;
+		}
+		job->has_version = (pe_get_version_info(buffer, job->size, job->version) == 0);
+		job->has_digest = (pe_get_authenticode_hash(buffer, job->size, job->digest) == 0);
+	}
+	fclose(fd);
+	t1 = get_time();
+
+	data_size = job->size;
+	if (embed_format == FORMAT_INCBIN) {
+		dump_file_incbin(&job->chunk, internal_name, job->path, job->size);
+	} else if (embed_format == FORMAT_EMBED) {
+		if (dump_file_embed(&job->chunk, internal_name, job->path) != 0) {
+			job->error = "#embed cannot use the path of";
+			goto out;
+		}
+	} else {
+		if (compress_data && (job->size != 0)) {
+			cbound = lz_compress_bound(job->size);
+			cbuffer = (unsigned char*) malloc(cbound);
+			if (cbuffer == NULL) {
+				job->error = "Could not allocate buffer for";
+				goto out;
+			}
+			job->csize = lz_compress(buffer, job->size, cbuffer, cbound);
+			// Only keep the compressed data if it is actually smaller
+			if ((job->csize != 0) && (job->csize < job->size)) {
+				safe_free(buffer);
+				buffer = cbuffer;
+				data_size = job->csize;
+			} else {
+				job->csize = 0;
+				safe_free(cbuffer);
+			}
+			cbuffer = NULL;
+		}
+
+		if (embed_format == FORMAT_STRING) {
+			chunk_printf(&job->chunk, "const unsigned char %s[] =", internal_name);
+			dump_buffer_string(&job->chunk, buffer, data_size);
+			chunk_printf(&job->chunk, ";\n\n");
+		} else {
+			chunk_printf(&job->chunk, "const unsigned char %s[] = {", internal_name);
+			dump_buffer_hex(&job->chunk, buffer, data_size);
+			chunk_printf(&job->chunk, "};\n\n");
+		}
+	}
+
+	if (job->has_version) {
+		chunk_printf(&job->chunk, "const uint32_t %s_version[] = {", internal_name);
+		for (i = 0; i < VERSION_INFO_SIZE; i++)
+			chunk_printf(&job->chunk, "%s0x%08X,", (i % 4) ? " " : "\n\t", job->version[i]);
+		chunk_printf(&job->chunk, "\n};\n\n");
+	}
+
+	// The resource pack holds the same data as the header
+	if (pack_name != NULL) {
+		job->payload = buffer;
+		job->payload_size = data_size;
+		buffer = NULL;
+	}
+
+out:
+	if ((job->error == NULL) && job->chunk.error)
+		job->error = "Could not allocate buffer for";
+	job->read_time = t1 - t0;
+	job->format_time = get_time() - t1;
+	safe_free(buffer);
 }
-#endif
 
+static THREAD_RETURN worker_thread(void* param)
+{
+	struct embed_job* job;
+
+	mutex_lock(&pipeline.lock);
+	while ((!pipeline.abort) && (pipeline.next < pipeline.nb_jobs)) {
+		if (pipeline.next >= pipeline.written + pipeline.window) {
+			cond_wait(&pipeline.cond, &pipeline.lock);
+			continue;
+		}
+		job = &pipeline.job[pipeline.next++];
+		mutex_unlock(&pipeline.lock);
+		process_job(job);
+		mutex_lock(&pipeline.lock);
+		job->done = 1;
+		cond_broadcast(&pipeline.cond);
+	}
+	mutex_unlock(&pipeline.lock);
+	return 0;
+}
+
+static void start_pipeline(int nb_threads)
+{
+	int i;
+
+	mutex_init(&pipeline.lock);
+	cond_init(&pipeline.cond);
+	pipeline.next = 0;
+	pipeline.written = 0;
+	pipeline.abort = 0;
+	pipeline.window = JOBS_PER_THREAD * nb_threads;
+	pipeline.running = 1;
+	// With a single thread, the writer processes the jobs itself
+	for (pipeline.nb_threads = 0, i = 0; (nb_threads > 1) && (i < nb_threads); i++) {
+		if (!thread_create(&pipeline.thread[pipeline.nb_threads], worker_thread)) {
+			perr("Could not create thread - continuing with %d thread(s).\n", pipeline.nb_threads);
+			break;
+		}
+		pipeline.nb_threads++;
+	}
+}
+
+static void stop_pipeline(void)
+{
+	int i;
+
+	if (!pipeline.running)
+		return;
+	mutex_lock(&pipeline.lock);
+	pipeline.abort = 1;
+	cond_broadcast(&pipeline.cond);
+	mutex_unlock(&pipeline.lock);
+	for (i = 0; i < pipeline.nb_threads; i++)
+		thread_join(pipeline.thread[i]);
+	pipeline.nb_threads = 0;
+	cond_destroy(&pipeline.cond);
+	mutex_destroy(&pipeline.lock);
+	pipeline.running = 0;
+}
+
+static void free_pipeline(void)
+{
+	int i;
+
+	if (pipeline.job == NULL)
+		return;
+	for (i = 0; i < pipeline.nb_jobs; i++) {
+		safe_free(pipeline.job[i].chunk.data);
+		safe_free(pipeline.job[i].payload);
+	}
+	safe_free(pipeline.job);
+}
+
+// Wait for job n to be processed
+static struct embed_job* wait_job(int n)
+{
+	struct embed_job* job = &pipeline.job[n];
+
+	if (pipeline.nb_threads == 0) {
+		pipeline.next++;
+		process_job(job);
+		job->done = 1;
+		return job;
+	}
+	mutex_lock(&pipeline.lock);
+	while (!job->done)
+		cond_wait(&pipeline.cond, &pipeline.lock);
+	mutex_unlock(&pipeline.lock);
+	return job;
+}
+
+// Release the memory of a job that was written, and let the workers proceed
+static void release_job(int n)
+{
+	safe_free(pipeline.job[n].chunk.data);
+	safe_free(pipeline.job[n].payload);
+	mutex_lock(&pipeline.lock);
+	pipeline.written = n + 1;
+	cond_broadcast(&pipeline.cond);
+	mutex_unlock(&pipeline.lock);
+}
+
+// The host tests include this file, to test its static functions, and provide their own main()
+#if !defined(EMBEDDER_NO_MAIN)
 int
 #ifdef DDKBUILD
 __cdecl
 #endif
 main (int argc, char *argv[])
 {
-	int ret = 1, i, j, rebuild;
+	int ret = 1, i, j;
 	char* file_name = NULL;
+	char* header_name;
+	char *header_tmp_name = NULL, *manifest_name = NULL, *manifest_tmp_name = NULL, *pack_tmp_name = NULL;
 	char* junk;
+	size_t len;
 	size_t* file_size = NULL;
+	size_t* file_csize = NULL;
+	int* file_has_version = NULL;
+	uint64_t total_size = 0, total_csize = 0;
 	int64_t* file_time = NULL;
-	FILE *fd, *header_fd;
-	time_t header_time;
+	unsigned char (*file_hash)[SHA1_HASH_SIZE] = NULL;
+	unsigned char (*file_digest)[SHA1_HASH_SIZE] = NULL;
+	char** file_path = NULL;
+	FILE *header_fd = NULL, *manifest_fd, *pack_fd = NULL;
+	struct pack_entry* pack_entry = NULL;
+	uint64_t pack_pos = 0;
 	struct NATIVE_STAT stbuf;
 	struct tm* ltm;
-	char internal_name[] = "file_###";
-	unsigned char* buffer = NULL;
-	unsigned char last;
+	time_t creation_time;
+	char internal_name[16];
+	struct embed_job* job;
+	int src, nb_duplicates, nb_threads = 1;
+	double start_time, t, hash_time, read_time = 0.0, format_time = 0.0, write_time = 0.0;
+	int* file_source = NULL;
+	uint64_t saved;
 	char fullpath[MAX_PATH];
 #if defined(_WIN32)
 	wchar_t wfullpath[MAX_PATH];
@@ -332,119 +1456,259 @@ main (int argc, char *argv[])
 	// Disable stdout buffering
 	setvbuf(stdout, NULL, _IONBF, 0);
 
-	if (argc != 2) {
-		perr("You must supply a header name.\n");
+	for (i = 1; i < argc - 1; i++) {
+		if ((strcmp(argv[i], "--format") == 0) || (strcmp(argv[i], "-f") == 0)) {
+			if (++i >= argc - 1) {
+				perr("You must supply a format and a header name.\n");
+				return 1;
+			}
+			for (embed_format = 0; embed_format < FORMAT_MAX; embed_format++) {
+				if (strcmp(argv[i], format_name[embed_format]) == 0)
+					break;
+			}
+			if (embed_format == FORMAT_MAX) {
+				perr("Unknown format '%s'.\n", argv[i]);
+				return 1;
+			}
+		} else if ((strcmp(argv[i], "--compress") == 0) || (strcmp(argv[i], "-z") == 0)) {
+			compress_data = 1;
+		} else if ((strcmp(argv[i], "--pack") == 0) || (strcmp(argv[i], "-p") == 0)) {
+			if (++i >= argc - 1) {
+				perr("You must supply a pack name and a header name.\n");
+				return 1;
+			}
+			pack_name = argv[i];
+		} else if ((strcmp(argv[i], "--jobs") == 0) || (strcmp(argv[i], "-j") == 0)) {
+			if (++i >= argc - 1) {
+				perr("You must supply a number of jobs and a header name.\n");
+				return 1;
+			}
+			nb_threads = atoi(argv[i]);
+			if ((nb_threads < 1) || (nb_threads > MAX_THREADS)) {
+				perr("The number of jobs must be between 1 and %d.\n", MAX_THREADS);
+				return 1;
+			}
+		} else {
+			break;
+		}
+	}
+	if ((argc < 2) || (i != argc - 1) || (argv[i][0] == '-')) {
+		perr("You must supply a header name.\n" \
+			"Usage: embedder [--format hex|string|incbin|embed] [--compress] [--pack FILE] [--jobs N] <header>\n");
+		return 1;
+	}
+	if (compress_data && (embed_format != FORMAT_HEX) && (embed_format != FORMAT_STRING)) {
+		perr("Compression can only be used with the hex or string formats.\n");
 		return 1;
 	}
+	header_name = argv[argc - 1];
 
 	nb_embeddables = nb_embeddables_fixed;
 #if defined(USER_DIR)
 	add_user_files();
 #endif
-	// Check if any of the embedded files have changed
-	rebuild = 0;
-	// coverity[fs_check_call]
-	if (NATIVE_STAT(argv[1], &stbuf) == 0) {
-		header_time = stbuf.st_mtime;	// make sure to use modification time!
-		for (i=0; i<nb_embeddables; i++) {
-			if (embeddable[i].reuse_last) continue;
-			if (get_full_path(embeddable[i].file_name, fullpath, MAX_PATH)) {
-				perr("Unable to get full path for '%s'.\n", embeddable[i].file_name);
-				goto out1;
-			}
-			if (NATIVE_STAT(fullpath, &stbuf) != 0) {
-				printf("unable to stat '%s' - assuming rebuild needed\n", fullpath);
-				rebuild = 1;
-				break;
-			}
-			if (stbuf.st_mtime > header_time) {
-				printf("detected change for '%s'\n", fullpath);
-				rebuild = 1;
-				break;
-			}
-		}
-		if (!rebuild) {
-			printf("  resources haven't changed - skipping step\n");
-			ret = 0; goto out1;
-		}
-	}
-
 	file_size = calloc(nb_embeddables, sizeof(size_t));
 	if (file_size == NULL) goto out1;
 	file_time = calloc(nb_embeddables, sizeof(int64_t));
 	if (file_time == NULL) goto out1;
+	file_csize = calloc(nb_embeddables, sizeof(size_t));
+	if (file_csize == NULL) goto out1;
+	file_has_version = calloc(nb_embeddables, sizeof(int));
+	if (file_has_version == NULL) goto out1;
+	file_hash = calloc(nb_embeddables, SHA1_HASH_SIZE);
+	if (file_hash == NULL) goto out1;
+	file_digest = calloc(nb_embeddables, SHA1_HASH_SIZE);
+	if (file_digest == NULL) goto out1;
+	file_source = calloc(nb_embeddables, sizeof(int));
+	if (file_source == NULL) goto out1;
+	file_path = calloc(nb_embeddables, sizeof(char*));
+	if (file_path == NULL) goto out1;
+	index_name = calloc(nb_embeddables, sizeof(char*));
+	if (index_name == NULL) goto out1;
+	index_subdir = calloc(nb_embeddables, sizeof(char*));
+	if (index_subdir == NULL) goto out1;
+	len = strlen(header_name) + sizeof(".manifest.tmp");
+	manifest_name = malloc(len);
+	manifest_tmp_name = malloc(len);
+	header_tmp_name = malloc(len);
+	if ((manifest_name == NULL) || (manifest_tmp_name == NULL) || (header_tmp_name == NULL)) goto out1;
+	sprintf(manifest_name, "%s.manifest", header_name);
+	sprintf(manifest_tmp_name, "%s.manifest.tmp", header_name);
+	sprintf(header_tmp_name, "%s.tmp", header_name);
+	if (pack_name != NULL) {
+		pack_tmp_name = malloc(strlen(pack_name) + sizeof(".tmp"));
+		pack_entry = calloc(nb_embeddables, sizeof(struct pack_entry));
+		if ((pack_tmp_name == NULL) || (pack_entry == NULL)) goto out1;
+		sprintf(pack_tmp_name, "%s.tmp", pack_name);
+	}
 
-	header_fd = fopen(argv[1], "w");
-	if (header_fd == NULL) {
-		perr("Could not create file '%s'.\n", argv[1]);
+	/*
+	 * Rather than relying on timestamps, which get updated on checkouts or cache
+	 * restores, we only rebuild if the content hash of an embedded file, or the
+	 * list of files, differs from the one recorded in our manifest.
+	 */
+	start_time = get_time();
+	manifest_fd = fopen(manifest_tmp_name, "w");
+	if (manifest_fd == NULL) {
+		perr("Could not create file '%s'.\n", manifest_tmp_name);
 		goto out1;
 	}
-	fprintf(header_fd, "#pragma once\n");
-
+	fprintf(manifest_fd, "layout\t%d\t%d\n", EMBEDDER_LAYOUT_VERSION, PACK_VERSION);
+	fprintf(manifest_fd, "format\t%s\n", format_name[embed_format]);
+	fprintf(manifest_fd, "compress\t%d\n", compress_data);
+	fprintf(manifest_fd, "pack\t%s\n", (pack_name == NULL) ? "-" : pack_name);
 	for (i = 0; i < nb_embeddables; i++) {
 		if (embeddable[i].reuse_last) {
+			fprintf(manifest_fd, "-\t-\t%s\t%s\t%x\n", embeddable[i].extraction_subdir,
+				embeddable[i].file_name, embeddable[i].tags);
 			continue;
 		}
 		if (get_full_path(embeddable[i].file_name, fullpath, MAX_PATH)) {
-			perr("Could not get full path for '%s'.\n", embeddable[i].file_name);
+			perr("Unable to get full path for '%s'.\n", embeddable[i].file_name);
+			fclose(manifest_fd);
+			goto out2;
+		}
+		file_path[i] = NATIVE_STRDUP(fullpath);
+		if (file_path[i] == NULL) {
+			perr("Could not allocate path.\n");
+			fclose(manifest_fd);
+			goto out2;
+		}
+		if (hash_file(fullpath, file_hash[i], &file_size[i]) != 0) {
+			perr("Could not read file '%s'.\n", fullpath);
+			fclose(manifest_fd);
 			goto out2;
 		}
+		for (j = 0; j < SHA1_HASH_SIZE; j++)
+			fprintf(manifest_fd, "%02x", file_hash[i][j]);
+		fprintf(manifest_fd, "\t%" PRIu64 "\t%s\t%s\t%x\n", (uint64_t)file_size[i],
+			embeddable[i].extraction_subdir, fullpath, embeddable[i].tags);
+	}
+	fclose(manifest_fd);
+	hash_time = get_time() - start_time;
+	// coverity[fs_check_call]
+	if ( (NATIVE_STAT(header_name, &stbuf) == 0) && same_content(manifest_tmp_name, manifest_name)
+	  && ((pack_name == NULL) || (NATIVE_STAT(pack_name, &stbuf) == 0)) ) {
+		printf("  resources haven't changed - skipping step\n");
+		NATIVE_UNLINK(manifest_tmp_name);
+		ret = 0; goto out1;
+	}
+
+	saved = dedup_files(file_source, file_hash, file_size, &nb_duplicates);
+
+	header_fd = fopen(header_tmp_name, "w");
+	if (header_fd == NULL) {
+		perr("Could not create file '%s'.\n", header_tmp_name);
+		goto out2;
+	}
+	fprintf(header_fd, "#pragma once\n");
+	dump_preamble(header_fd);
+
+	// The header and table of contents of the pack are only filled once we're done
+	if (pack_name != NULL) {
+		pack_fd = fopen(pack_tmp_name, "wb");
+		if ( (pack_fd == NULL)
+		  || (pack_pad(pack_fd, &pack_pos, PACK_HEADER_SIZE + (uint64_t)nb_embeddables * PACK_ENTRY_SIZE) != 0) ) {
+			perr("Could not create file '%s'.\n", pack_tmp_name);
+			goto out2;
+		}
+	}
+
+	// Queue the files that need to be embedded
+	pipeline.job = calloc(nb_embeddables, sizeof(struct embed_job));
+	if (pipeline.job == NULL) {
+		perr("Could not allocate jobs.\n");
+		goto out2;
+	}
+	for (pipeline.nb_jobs = 0, i = 0; i < nb_embeddables; i++) {
+		// Also skips the resources that reuse the last file
+		if (file_source[i] != i) {
+			continue;
+		}
+		pipeline.job[pipeline.nb_jobs].index = i;
+		pipeline.job[pipeline.nb_jobs].path = file_path[i];
+		pipeline.nb_jobs++;
+	}
+
+	init_hex_table();
+	start_pipeline(nb_threads);
+	for (j = 0; j < pipeline.nb_jobs; j++) {
+		job = wait_job(j);
+		i = job->index;
 #if defined(_WIN32)
-		MultiByteToWideChar(CP_UTF8, 0, fullpath, -1, wfullpath, MAX_PATH);
+		MultiByteToWideChar(CP_UTF8, 0, job->path, -1, wfullpath, MAX_PATH);
 		// coverity[bad_printf_format_string]
 		printf("  EMBED  %S ", wfullpath);
-		fd = _wfopen(wfullpath, L"rb");
 #else
-		printf("  EMBED  %s ", fullpath);
-		fd = fopen(fullpath, "rb");
+		printf("  EMBED  %s ", job->path);
 #endif
-		if (fd == NULL) {
-			perr("Could not open file '%s'.\n", fullpath);
+		if (job->error != NULL) {
+			perr("%s '%s'.\n", job->error, job->path);
 			goto out2;
 		}
-
-		// Read the creation date
-		memset(&stbuf, 0, sizeof(stbuf));
-		if ( (NATIVE_STAT(fullpath, &stbuf) == 0) && ((ltm = localtime(&stbuf.st_ctime)) != NULL) ) {
+		creation_time = (time_t)job->time;
+		if ((ltm = localtime(&creation_time)) != NULL) {
 			printf("(%04d.%02d.%02d)\n", ltm->tm_year+1900, ltm->tm_mon+1, ltm->tm_mday);
 		} else {
 			printf("\n");
 		}
-		file_time[i] = (int64_t)stbuf.st_ctime;
-		file_size[i] = (size_t)stbuf.st_size;
-
-		buffer = (unsigned char*) malloc(file_size[i]);
-		if (buffer == NULL) {
-			perr("Could not allocate buffer.\n");
-			goto out3;
+		file_time[i] = job->time;
+		file_size[i] = job->size;
+		file_csize[i] = job->csize;
+		file_has_version[i] = job->has_version;
+		// PE files are referenced by their Authenticode digest in cat files
+		memcpy(file_digest[i], job->has_digest ? job->digest : file_hash[i], SHA1_HASH_SIZE);
+		if (compress_data) {
+			total_size += job->size;
+			total_csize += (job->csize != 0) ? job->csize : job->size;
 		}
+		read_time += job->read_time;
+		format_time += job->format_time;
 
-		if (fread(buffer, 1, file_size[i], fd) != file_size[i]) {
-			perr("Could not read file '%s'.\n", fullpath);
-			goto out4;
+		t = get_time();
+		if (fwrite(job->chunk.data, 1, job->chunk.size, header_fd) != job->chunk.size) {
+			perr("Could not write file '%s'.\n", header_tmp_name);
+			goto out2;
 		}
-		fclose(fd);
-
-		sprintf(internal_name, "file_%03X", (unsigned char)i);
-		fprintf(header_fd, "const unsigned char %s[] = {", internal_name);
-		dump_buffer_hex(header_fd, buffer, file_size[i]);
-		fprintf(header_fd, "};\n\n");
-		safe_free(buffer);
+		if (pack_fd != NULL) {
+			pack_entry[i].size = job->size;
+			pack_entry[i].compressed_size = job->csize;
+			pack_entry[i].creation_time = job->time;
+			pack_entry[i].flags = job->has_version ? PACK_HAS_VERSION : 0;
+			memcpy(pack_entry[i].version_info, job->version, sizeof(pack_entry[i].version_info));
+			memcpy(pack_entry[i].hash, file_digest[i], PACK_HASH_SIZE);
+			memcpy(pack_entry[i].content_hash, file_hash[i], PACK_HASH_SIZE);
+			if ( (pack_pad(pack_fd, &pack_pos, (pack_pos + PACK_ALIGNMENT - 1) & ~((uint64_t)PACK_ALIGNMENT - 1)) != 0)
+			  || (fwrite(job->payload, 1, job->payload_size, pack_fd) != job->payload_size) ) {
+				perr("Could not write file '%s'.\n", pack_tmp_name);
+				goto out2;
+			}
+			pack_entry[i].offset = pack_pos;
+			pack_pos += job->payload_size;
+		}
+		write_time += get_time() - t;
+		release_job(j);
 	}
+	nb_threads = (pipeline.nb_threads == 0) ? 1 : pipeline.nb_threads;
+	stop_pipeline();
+
 	fprintf(header_fd, "struct res {\n" \
 		"\tchar* subdir;\n" \
 		"\tchar* name;\n" \
 		"\tsize_t size;\n" \
 		"\tint64_t creation_time;\n" \
 		"\tconst unsigned char* data;\n" \
+		"\tsize_t compressed_size;\t// 0 if data is not compressed\n" \
+		"\tconst uint32_t* version_info;\t// VS_FIXEDFILEINFO of PE files, NULL otherwise\n" \
+		"\tunsigned char hash[20];\t// Authenticode SHA-1 digest for PE files, plain SHA-1 otherwise\n" \
+		"\tunsigned char content_hash[20];\t// SHA-1 of the whole file\n" \
+		"\tuint32_t tags;\t// RES_TAG_### platforms and drivers that need the file, 0 for all\n" \
 		"};\n\n");
 
 	fprintf(header_fd, "const struct res resource[] = {\n");
-	for (last = 0,i = 0; i < nb_embeddables; i++) {
-		if (!embeddable[i].reuse_last) {
-			last = (unsigned char)i;
-		}
-		sprintf(internal_name, "file_%03X", last);
+	for (i = 0; i < nb_embeddables; i++) {
+		src = file_source[i];
+		sprintf(internal_name, "file_%03X", src);
 		fprintf(header_fd, "\t{ \"");
 		// Backslashes need to be escaped
 		for (j = 0; j < (int)strlen(embeddable[i].extraction_subdir); j++) {
@@ -457,25 +1721,87 @@ main (int argc, char *argv[])
 			}
 		}
 		basename_split(embeddable[i].file_name, &junk, &file_name);
-		fprintf(header_fd, "\", \"%s\", %d, INT64_C(%"PRId64"), %s },\n",
-			file_name, (int)file_size[last], file_time[last], internal_name);
+		fprintf(header_fd, "\", \"%s\", %d, INT64_C(%"PRId64"), %s, %d, %s%s,\n\t\t{",
+			file_name, (int)file_size[src], file_time[src], internal_name, (int)file_csize[src],
+			file_has_version[src] ? internal_name : "NULL", file_has_version[src] ? "_version" : "");
+		for (j = 0; j < SHA1_HASH_SIZE; j++)
+			fprintf(header_fd, "%s0x%02x", (j == 0) ? " " : ", ", file_digest[src][j]);
+		fprintf(header_fd, " },\n\t\t{");
+		for (j = 0; j < SHA1_HASH_SIZE; j++)
+			fprintf(header_fd, "%s0x%02x", (j == 0) ? " " : ", ", file_hash[src][j]);
+		fprintf(header_fd, " }, 0x%04x },\n", embeddable[i].tags);
+		// Keep the strings, as seen by the library, for the lookup indexes
+		index_name[i] = NATIVE_STRDUP(file_name);
+		index_subdir[i] = NATIVE_STRDUP(embeddable[i].extraction_subdir);
 		basename_free(embeddable[i].file_name);
+		if ((index_name[i] == NULL) || (index_subdir[i] == NULL)) {
+			perr("Could not allocate index.\n");
+			goto out2;
+		}
+		for (j = 0; j < (int)strlen(index_subdir[i]); j++) {
+			if ( (index_subdir[i][j] == NATIVE_SEPARATOR)
+			  || (index_subdir[i][j] == NON_NATIVE_SEPARATOR) )
+				index_subdir[i][j] = '\\';
+		}
 	}
 	fprintf(header_fd, "};\n");
 	fprintf(header_fd, "\nconst int nb_resources = sizeof(resource)/sizeof(resource[0]);\n");
 
+	if ( (dump_index(header_fd, "resource_name_index", name_cmp) != 0)
+	  || (dump_index(header_fd, "resource_path_index", path_cmp) != 0) ) {
+		perr("Could not create resource indexes.\n");
+		goto out2;
+	}
+
 	fclose(header_fd);
+	header_fd = NULL;
+	if (pack_fd != NULL) {
+		if (finish_pack(pack_fd, pack_pos, pack_entry, file_source) != 0) {
+			perr("Could not write file '%s'.\n", pack_tmp_name);
+			goto out2;
+		}
+		fclose(pack_fd);
+		pack_fd = NULL;
+	}
+	if (nb_duplicates != 0)
+		printf("  DEDUP  %d duplicate file(s) embedded once - saved %" PRIu64 " bytes\n", nb_duplicates, saved);
+	if (compress_data)
+		printf("  LZ     %" PRIu64 " bytes compressed to %" PRIu64 " bytes\n", total_size, total_csize);
+	// Read and format times are cumulated over all the threads
+	printf("  TIME   hash %.2fs, read %.2fs, format %.2fs, write %.2fs - %.2fs total with %d thread(s)\n",
+		hash_time, read_time, format_time, write_time, get_time() - start_time, nb_threads);
+
+	// Only replace the existing header if it changed, so that it keeps its timestamp
+	if (replace_if_different(header_tmp_name, header_name) != 0) {
+		perr("Could not create file '%s'.\n", header_name);
+		goto out2;
+	}
+	if ((pack_name != NULL) && (replace_if_different(pack_tmp_name, pack_name) != 0)) {
+		perr("Could not create file '%s'.\n", pack_name);
+		goto out2;
+	}
+	if (replace_if_different(manifest_tmp_name, manifest_name) != 0) {
+		perr("Could not create file '%s'.\n", manifest_name);
+		goto out2;
+	}
 	ret = 0; goto out1;
 
-out4:
-	safe_free(buffer);
-out3:
-	fclose(fd);
 out2:
-	fclose(header_fd);
+	stop_pipeline();
+	if (header_fd != NULL)
+		fclose(header_fd);
+	if (pack_fd != NULL)
+		fclose(pack_fd);
 	// Must delete a failed file so that Make can relaunch its build
 	// coverity[tainted_string]
-	NATIVE_UNLINK(argv[1]);
+	NATIVE_UNLINK(header_tmp_name);
+	if (pack_name != NULL) {
+		NATIVE_UNLINK(pack_tmp_name);
+		NATIVE_UNLINK(pack_name);
+	}
+	NATIVE_UNLINK(manifest_tmp_name);
+	NATIVE_UNLINK(manifest_name);
+	NATIVE_UNLINK(header_name);
 out1:
 #if defined(USER_DIR)
 	for (i=nb_embeddables_fixed; i<nb_embeddables; i++) {
@@ -488,5 +1814,30 @@ out1:
 #endif
 	safe_free(file_size);
 	safe_free(file_time);
+	safe_free(file_csize);
+	safe_free(file_has_version);
+	safe_free(file_hash);
+	safe_free(file_digest);
+	safe_free(file_source);
+	if (file_path != NULL) {
+		for (i = 0; i < nb_embeddables; i++)
+			safe_free(file_path[i]);
+		safe_free(file_path);
+	}
+	free_pipeline();
+	for (i = 0; i < nb_embeddables; i++) {
+		if (index_name != NULL)
+			safe_free(index_name[i]);
+		if (index_subdir != NULL)
+			safe_free(index_subdir[i]);
+	}
+	safe_free(index_name);
+	safe_free(index_subdir);
+	safe_free(header_tmp_name);
+	safe_free(manifest_name);
+	safe_free(manifest_tmp_name);
+	safe_free(pack_tmp_name);
+	safe_free(pack_entry);
 	return ret;
 }
+#endif
@@ -19,6 +19,8 @@
  */
 #pragma once
 
+#include "pack.h"
+
 /*
  * This include defines the driver files that should be embedded in the library.
  * This file is meant to be used by libwdi developers only.
@@ -31,6 +33,7 @@ struct emb {
 	int reuse_last;
 	char* file_name;
 	char* extraction_subdir;
+	uint32_t tags;	// platforms and drivers that need the file (see pack.h)
 };
 
 #define _STR(s) #s
@@ -44,41 +47,41 @@ struct emb embeddable_fixed[] = {
 // WinUSB
 #if defined(WDK_DIR)
 #	if defined(OPT_M32)
-		{ 0, WDK_DIR "\\redist\\wdf\\x86\\WdfCoInstaller0" STR(WDF_VER) ".dll", "x86" },
-		{ 0, WDK_DIR "\\redist\\" COINSTALLER_DIR "\\x86\\winusbcoinstaller2.dll", "x86" },
+		{ 0, WDK_DIR "\\redist\\wdf\\x86\\WdfCoInstaller0" STR(WDF_VER) ".dll", "x86", RES_TAG_X86 | RES_TAG_WINUSB | RES_TAG_LIBUSBK },
+		{ 0, WDK_DIR "\\redist\\" COINSTALLER_DIR "\\x86\\winusbcoinstaller2.dll", "x86", RES_TAG_X86 | RES_TAG_WINUSB },
 #	endif	// OPT_M32
 #	if defined(OPT_M64)
-		{ 0, WDK_DIR "\\redist\\wdf\\" X64_DIR "\\WdfCoInstaller0" STR(WDF_VER) ".dll", "amd64" },
-		{ 0, WDK_DIR "\\redist\\" COINSTALLER_DIR "\\" X64_DIR "\\winusbcoinstaller2.dll", "amd64" },
+		{ 0, WDK_DIR "\\redist\\wdf\\" X64_DIR "\\WdfCoInstaller0" STR(WDF_VER) ".dll", "amd64", RES_TAG_X64 | RES_TAG_WINUSB | RES_TAG_LIBUSBK },
+		{ 0, WDK_DIR "\\redist\\" COINSTALLER_DIR "\\" X64_DIR "\\winusbcoinstaller2.dll", "amd64", RES_TAG_X64 | RES_TAG_WINUSB },
 #	endif	// OPT_M64
 #endif	// WDK_DIR
 
 // libusb0
 #if defined(LIBUSB0_DIR)
-	{ 0, LIBUSB0_DIR "\\bin\\x86\\install-filter.exe", "x86" },
-	{ 0, LIBUSB0_DIR "\\bin\\x86\\libusb0_x86.dll", "x86" },
+	{ 0, LIBUSB0_DIR "\\bin\\x86\\install-filter.exe", "x86", RES_TAG_X86 | RES_TAG_ARM64 | RES_TAG_LIBUSB0 },
+	{ 0, LIBUSB0_DIR "\\bin\\x86\\libusb0_x86.dll", "x86", RES_TAG_X86 | RES_TAG_X64 | RES_TAG_LIBUSB0 },
 #	if defined(LIBUSBK_DIR)
 #		if defined(OPT_M32)
-			{ 1, "libusb0.dll", "x86" },	// reuse
+			{ 1, "libusb0.dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSBK },	// reuse
 #		endif	// OPT_M32
 #		if defined(OPT_M64)
-			{ 1, "libusb0_x86.dll", "amd64" },	// reuse
+			{ 1, "libusb0_x86.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },	// reuse
 #		endif	// OPT_M64
 #	endif	// LIBUSBK_DIR
 #	if defined(OPT_M32)
-		{ 0, LIBUSB0_DIR "\\bin\\x86\\libusb0.sys", "x86" },
+		{ 0, LIBUSB0_DIR "\\bin\\x86\\libusb0.sys", "x86", RES_TAG_X86 | RES_TAG_LIBUSB0 },
 #	endif	// OPT_M32
 #	if defined(OPT_M64)
-		{ 0, LIBUSB0_DIR "\\bin\\amd64\\libusb0.dll", "amd64" },
-		{ 0, LIBUSB0_DIR "\\bin\\amd64\\libusb0.sys", "amd64" },
-		{ 0, LIBUSB0_DIR "\\bin\\amd64\\install-filter.exe", "amd64" },
+		{ 0, LIBUSB0_DIR "\\bin\\amd64\\libusb0.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },
+		{ 0, LIBUSB0_DIR "\\bin\\amd64\\libusb0.sys", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 },
+		{ 0, LIBUSB0_DIR "\\bin\\amd64\\install-filter.exe", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 },
 #	endif	// OPT_M64
 #	if defined(OPT_ARM)
-		{ 0, LIBUSB0_DIR "\\bin\\arm64\\libusb0.dll", "arm64" },
-		{ 0, LIBUSB0_DIR "\\bin\\arm64\\libusb0.sys", "arm64" },
-		{ 0, LIBUSB0_DIR "\\bin\\arm64\\install-filter.exe", "arm64" },
+		{ 0, LIBUSB0_DIR "\\bin\\arm64\\libusb0.dll", "arm64", RES_TAG_ARM64 | RES_TAG_LIBUSB0 },
+		{ 0, LIBUSB0_DIR "\\bin\\arm64\\libusb0.sys", "arm64", RES_TAG_ARM64 | RES_TAG_LIBUSB0 },
+		{ 0, LIBUSB0_DIR "\\bin\\arm64\\install-filter.exe", "arm64", RES_TAG_ARM64 | RES_TAG_LIBUSB0 },
 #	endif	// OPT_ARM
-	{ 0, LIBUSB0_DIR "\\installer_license.txt", "license\\libusb0" },
+	{ 0, LIBUSB0_DIR "\\installer_license.txt", "license\\libusb0", RES_TAG_LIBUSB0 },
 #endif	// LIBUSB0_DIR
 
 // libusbK
@@ -86,37 +89,37 @@ struct emb embeddable_fixed[] = {
 
 #	if	defined(OPT_M32)
 #		if !defined(WDK_DIR)
-			{ 0, LIBUSBK_DIR "\\sys\\x86\\WdfCoInstaller" STR(WDF_VER) ".dll", "x86" },
+			{ 0, LIBUSBK_DIR "\\sys\\x86\\WdfCoInstaller" STR(WDF_VER) ".dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSBK },
 #		endif	// WDK_DIR
-		{ 0, LIBUSBK_DIR "\\sys\\x86\\libusbK.sys", "x86" },
-		{ 0, LIBUSBK_DIR "\\dll\\x86\\libusbK.dll", "x86" },
+		{ 0, LIBUSBK_DIR "\\sys\\x86\\libusbK.sys", "x86", RES_TAG_X86 | RES_TAG_LIBUSBK },
+		{ 0, LIBUSBK_DIR "\\dll\\x86\\libusbK.dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },
 #		if defined(OPT_M64)
-			{ 1, "libusbK_x86.dll", "amd64" },	// reuse
+			{ 1, "libusbK_x86.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },	// reuse
 #		endif	// OPT_M64
 #		if !defined(LIBUSB0_DIR)
-			{ 0, LIBUSBK_DIR "\\dll\\x86\\libusb0.dll", "x86" },
+			{ 0, LIBUSBK_DIR "\\dll\\x86\\libusb0.dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSBK },
 #			if defined(OPT_M64)
-				{ 1, "libusb0_x86.dll", "amd64" },	// reuse
+				{ 1, "libusb0_x86.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },	// reuse
 #			endif	// OPT_M64
 #		endif	// LIBUSB0_DIR
 #	endif	// OPT_M32
 
 #	if defined(OPT_M64)
 #		if !defined(WDK_DIR)
-			{ 0, LIBUSBK_DIR "\\sys\\amd64\\WdfCoInstaller" STR(WDF_VER) ".dll", "amd64" },
+			{ 0, LIBUSBK_DIR "\\sys\\amd64\\WdfCoInstaller" STR(WDF_VER) ".dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },
 #		endif	// WDK_DIR
-		{ 0, LIBUSBK_DIR "\\sys\\amd64\\libusbK.sys", "amd64" },
-		{ 0, LIBUSBK_DIR "\\dll\\amd64\\libusbK.dll", "amd64" },
+		{ 0, LIBUSBK_DIR "\\sys\\amd64\\libusbK.sys", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },
+		{ 0, LIBUSBK_DIR "\\dll\\amd64\\libusbK.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },
 #		if !defined(LIBUSB0_DIR)
-			{ 0, LIBUSBK_DIR "\\dll\\amd64\\libusb0.dll", "amd64" },
+			{ 0, LIBUSBK_DIR "\\dll\\amd64\\libusb0.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },
 #		endif	// LIBUSB0_DIR
 #		if !defined(OPT_M32)
 			// The x86/ DLLs will not be used, but they are required for rename to _x86
-			{ 0, LIBUSBK_DIR "\\dll\\x86\\libusbK.dll", "x86" },
-			{ 1, "libusbK_x86.dll", "amd64" },
+			{ 0, LIBUSBK_DIR "\\dll\\x86\\libusbK.dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },
+			{ 1, "libusbK_x86.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSB0 | RES_TAG_LIBUSBK },
 #			if !defined(LIBUSB0_DIR)
-				{ 0, LIBUSBK_DIR "\\dll\\x86\\libusb0.dll", "x86" },
-				{ 1, "libusb0_x86.dll", "amd64" },
+				{ 0, LIBUSBK_DIR "\\dll\\x86\\libusb0.dll", "x86", RES_TAG_X86 | RES_TAG_LIBUSBK },
+				{ 1, "libusb0_x86.dll", "amd64", RES_TAG_X64 | RES_TAG_LIBUSBK },
 #			endif	// LIBUSB0_DIR
 #		endif	// OPT_M32
 #	endif	// OPT_M64
@@ -125,22 +128,22 @@ struct emb embeddable_fixed[] = {
 
 // Common files
 #if defined(OPT_M32)
-	{ 0, INSTALLER_PATH_32 "\\installer_x86.exe", "." },
+	{ 0, INSTALLER_PATH_32 "\\installer_x86.exe", ".", RES_TAG_X86 },
 #endif
 #if defined(OPT_M64)
-	{ 0, INSTALLER_PATH_64 "\\installer_x64.exe", "." },
+	{ 0, INSTALLER_PATH_64 "\\installer_x64.exe", ".", RES_TAG_X64 },
 #endif
 #if defined(OPT_ARM)
-	{ 0, INSTALLER_PATH_ARM "\\installer_arm64.exe", "." },
+	{ 0, INSTALLER_PATH_ARM "\\installer_arm64.exe", ".", RES_TAG_ARM64 },
 #endif
 // inf templates for the tokenizer ("" directory means no extraction)
-	{ 0, "winusb.inf.in", "" },
-	{ 0, "libusb0.inf.in", "" },
-	{ 0, "libusbk.inf.in", "" },
-	{ 0, "usbser.inf.in", "" },
+	{ 0, "winusb.inf.in", "", 0 },
+	{ 0, "libusb0.inf.in", "", 0 },
+	{ 0, "libusbk.inf.in", "", 0 },
+	{ 0, "usbser.inf.in", "", 0 },
 // cat file lists for self signing
-	{ 0, "winusb.cat.in", "" },
-	{ 0, "libusb0.cat.in", "" },
-	{ 0, "libusbk.cat.in", "" },
-	{ 0, "usbser.cat.in", "" },
+	{ 0, "winusb.cat.in", "", 0 },
+	{ 0, "libusb0.cat.in", "", 0 },
+	{ 0, "libusbk.cat.in", "", 0 },
+	{ 0, "usbser.cat.in", "", 0 },
 };
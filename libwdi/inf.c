@@ -0,0 +1,306 @@
+/*
+ * Library for USB automated driver installation - inf generation
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+/* Memory leaks detection - define _CRTDBG_MAP_ALLOC as preprocessor macro */
+#ifdef _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inf.h"
+
+#if !defined(_WIN32)
+#define ERROR_WRITE_FAULT           29
+#endif
+
+token_entity_t inf_entities[]=
+{
+	{"INF_FILENAME",""},
+	{"CAT_FILENAME",""},
+	{"DEVICE_DESCRIPTION",""},
+	{"DEVICE_HARDWARE_ID",""},
+	{"DEVICE_INTERFACE_GUID",""},
+	{"DEVICE_MANUFACTURER",""},
+	{"DRIVER_DATE",""},
+	{"DRIVER_VERSION",""},
+	{"USE_DEVICE_INTERFACE_GUID",""},
+	{"WDF_VERSION",""},
+	{"KMDF_VERSION",""},
+	{"LK_COMMA",""},
+	{"LK_DLL",""},
+	{"LK_X86_DLL",""},
+	{"LK_EQ_X86",""},
+	{"LK_EQ_X64",""},
+	{NULL, ""} // DO NOT REMOVE!
+};
+
+/*
+ * List of Android devices that need to be assigned a specific Device Interface GUID
+ * so that they are recognized with Google's debug tools.
+ * This list gets updated from https://github.com/gu1dry/android_winusb/ (Cyanogenmod)
+ * and http://developer.android.com/sdk/win-usb.html (Google USB driver) as well as
+ * http://www.linux-usb.org/usb.ids (for newer Google devices as well as Samsung's)
+ * NB: We don't specify an MI, as the assumption is that the MTP driver has already been
+ * installed automatically, which will only leave the driverless debug interface to pick
+ * a driver for.
+ */
+static const char* android_device_guid = "{f72fe0d4-cbcb-407d-8814-9ed673d0dd6b}";
+static const struct {uint16_t vid; uint16_t pid;} android_device[] = {
+	{0x0451, 0xD022},
+	{0x0451, 0xD101},
+	{0x0489, 0xC001},
+	{0x04E8, 0x685B},	// Samsung Galaxy
+	{0x04E8, 0x685C},
+	{0x04E8, 0x685D},
+	{0x04E8, 0x685E},
+	{0x04E8, 0x6860},
+	{0x04E8, 0x6863},
+	{0x04E8, 0x6864},
+	{0x04E8, 0x6865},
+	{0x04E8, 0x6866},
+	{0x04E8, 0x6868},
+	{0x04E8, 0x6877},
+	{0x04E8, 0x689e},
+	{0x05C6, 0x9018},	// Qualcomm HSUSB Device
+	{0x05C6, 0x9025},
+	{0x0955, 0x7030},	// NVidia Tegra
+	{0x0955, 0x7100},
+	{0x0955, 0xB400},	// NVidia Shield
+	{0x0955, 0xB401},
+	{0x0955, 0xCF05},
+	{0x0955, 0xCF06},
+	{0x0955, 0xCF07},
+	{0x0955, 0xCF08},
+	{0x0955, 0xCF09},
+	{0x0B05, 0x4D00},	// Asus Transformer
+	{0x0B05, 0x4D01},
+	{0x0B05, 0x4D02},
+	{0x0B05, 0x4D03},
+	{0x0B05, 0x4E01},
+	{0x0B05, 0x4E03},
+	{0x0B05, 0x4E1F},
+	{0x0B05, 0x4E3F},
+	{0x0BB4, 0x0C01},	// HTC
+	{0x0BB4, 0x0C02},
+	{0x0BB4, 0x0C03},
+	{0x0BB4, 0x0C13},
+	{0x0BB4, 0x0C1F},	// Sony Ericsson Xperia X1
+	{0x0BB4, 0x0C5F},
+	{0x0BB4, 0x0C86},
+	{0x0BB4, 0x0C87},
+	{0x0BB4, 0x0C8B},
+	{0x0BB4, 0x0C8D},
+	{0x0BB4, 0x0C91},
+	{0x0BB4, 0x0C92},
+	{0x0BB4, 0x0C93},
+	{0x0BB4, 0x0C94},
+	{0x0BB4, 0x0C95},
+	{0x0BB4, 0x0C96},
+	{0x0BB4, 0x0C97},
+	{0x0BB4, 0x0C98},
+	{0x0BB4, 0x0C99},
+	{0x0BB4, 0x0C9E},
+	{0x0BB4, 0x0CA2},
+	{0x0BB4, 0x0CA3},
+	{0x0BB4, 0x0CA4},
+	{0x0BB4, 0x0CA5},
+	{0x0BB4, 0x0CAC},
+	{0x0BB4, 0x0CAD},
+	{0x0BB4, 0x0CAE},
+	{0x0BB4, 0x0CBA},
+	{0x0BB4, 0x0CED},
+	{0x0BB4, 0x0E03},
+	{0x0BB4, 0x0F64},
+	{0x0BB4, 0x0FF8},
+	{0x0BB4, 0x0FF9},
+	{0x0BB4, 0x0FFE},
+	{0x0BB4, 0x0FFF},
+	{0x0FCE, 0x0DDE},	// Sony Ericsson
+	{0x0FCE, 0x4E30},
+	{0x0FCE, 0x6860},
+	{0x0FCE, 0xD001},
+	{0x1004, 0x618E},	// LG
+	{0x12D1, 0x1501},
+	{0x18D1, 0x0D02},
+	{0x18D1, 0x2C10},
+	{0x18D1, 0x2C11},
+	{0x18D1, 0x4D00},	// Project Tango
+	{0x18D1, 0x4D02},
+	{0x18D1, 0x4D04},
+	{0x18D1, 0x4D06},
+	{0x18D1, 0x4D07},
+	{0x18D1, 0x4E10},	// Project Tango
+	{0x18D1, 0x4E11},
+	{0x18D1, 0x4E12},
+	{0x18D1, 0x4E13},
+	{0x18D1, 0x4E20},	// Nexus S
+	{0x18D1, 0x4E21},
+	{0x18D1, 0x4E22},
+	{0x18D1, 0x4E23},
+	{0x18D1, 0x4E24},
+	{0x18D1, 0x4E30},	// Galaxy Nexus
+	{0x18D1, 0x4E40},	// Nexus 7
+	{0x18D1, 0x4E41},
+	{0x18D1, 0x4E42},
+	{0x18D1, 0x4E43},
+	{0x18D1, 0x4E44},
+	{0x18D1, 0x4EE0},	// Nexus 4/5
+	{0x18D1, 0x4EE1},
+	{0x18D1, 0x4EE2},
+	{0x18D1, 0x4EE3},
+	{0x18D1, 0x4EE4},
+	{0x18D1, 0x4EE5},
+	{0x18D1, 0x4EE6},
+	{0x18D1, 0x4EE7},
+	{0x18D1, 0x708C},
+	{0x18D1, 0x708C},
+	{0x18D1, 0x7102},	// Toshiba Thrive tablet
+	{0x18D1, 0x9001},
+	{0x18D1, 0xB004},
+	{0x18D1, 0xD001},	// Nexus 4
+	{0x18D1, 0xD002},
+	{0x18D1, 0xD109},	// LG G2x
+	{0x18D1, 0xD10A},
+	{0x19D2, 0x1351},
+	{0x19D2, 0x1354},
+	{0x2080, 0x0001},	// Nook
+	{0x2080, 0x0002},
+	{0x2080, 0x0003},
+	{0x2080, 0x0004},
+	{0x22B8, 0x2D66},	// Motorola
+	{0x22B8, 0x41DB},
+	{0x22B8, 0x4286},
+	{0x22B8, 0x42A4},
+	{0x22B8, 0x42DA},
+	{0x22B8, 0x4331},
+	{0x22B8, 0x70A9},
+};
+
+// Returns the Device Interface GUID that Google's debug tools expect, if the device needs it, or NULL
+const char* inf_android_guid(uint16_t vid, uint16_t pid)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(android_device) / sizeof(android_device[0]); i++) {
+		if ((android_device[i].vid == vid) && (android_device[i].pid == pid))
+			return android_device_guid;
+	}
+	return NULL;
+}
+
+/*
+ * Set the values of the inf entities from params, with copies held in arena.
+ * The LK_ entities, which only depend on the drivers that are available, are left as is.
+ * Returns 0 on success, non zero if a value could not be allocated.
+ */
+int inf_set_entities(token_arena_t* arena, token_entity_t* entities, const struct inf_params* params)
+{
+	char str[64], *cat_name;
+	size_t len;
+
+	token_set(arena, &entities[INF_FILENAME], params->inf_name);
+	if (params->cat_name != NULL) {
+		token_set(arena, &entities[CAT_FILENAME], params->cat_name);
+	} else {
+		// Use the name of the inf, with a '.cat' extension
+		len = strlen(params->inf_name);
+		if (len < 3)
+			return -1;
+		cat_name = malloc(len + 1);
+		if (cat_name == NULL)
+			return -1;
+		memcpy(cat_name, params->inf_name, len - 3);
+		memcpy(&cat_name[len - 3], "cat", 4);
+		token_set(arena, &entities[CAT_FILENAME], cat_name);
+		free(cat_name);
+	}
+
+	// Populate the Device Description, Hardware ID and Device Interface GUID
+	token_set(arena, &entities[DEVICE_DESCRIPTION], params->desc);
+	if (params->compat_id != NULL) {
+		token_set(arena, &entities[DEVICE_HARDWARE_ID], params->compat_id);
+		token_set(arena, &entities[USE_DEVICE_INTERFACE_GUID], "NoDeviceInterfaceGUID");
+		token_set(arena, &entities[DEVICE_INTERFACE_GUID], "UNUSED");
+	} else {
+		if (params->is_composite) {
+			snprintf(str, sizeof(str), "VID_%04X&PID_%04X&MI_%02X", params->vid, params->pid, params->mi);
+		} else {
+			snprintf(str, sizeof(str), "VID_%04X&PID_%04X", params->vid, params->pid);
+		}
+		token_set(arena, &entities[DEVICE_HARDWARE_ID], str);
+		token_set(arena, &entities[USE_DEVICE_INTERFACE_GUID], "AddDeviceInterfaceGUID");
+		token_set(arena, &entities[DEVICE_INTERFACE_GUID], params->device_guid);
+	}
+
+	// Resolve the Manufacturer (Vendor Name)
+	token_set(arena, &entities[DEVICE_MANUFACTURER],
+		(params->vendor_name != NULL) ? params->vendor_name : "(Undefined Vendor)");
+
+	// Set the WDF and KMDF versions for WinUSB and libusbK
+	snprintf(str, sizeof(str), "%05d", params->wdf_version);
+	token_set(arena, &entities[WDF_VERSION], str);
+	snprintf(str, sizeof(str), "%d.%d", params->wdf_version / 1000, params->wdf_version % 1000);
+	token_set(arena, &entities[KMDF_VERSION], str);
+
+	// Write the date and version data
+	snprintf(str, sizeof(str), "%02d/%02d/%04d", params->month, params->day, params->year);
+	token_set(arena, &entities[DRIVER_DATE], str);
+	snprintf(str, sizeof(str), "%d.%d.%d.%d", (int)(params->version_ms >> 16), (int)(params->version_ms & 0xFFFF),
+		(int)(params->version_ls >> 16), (int)(params->version_ls & 0xFFFF));
+	token_set(arena, &entities[DRIVER_VERSION], str);
+	return arena->failed ? -1 : 0;
+}
+
+// Sink that converts the tokenized inf to UTF-16, as it is produced
+static int inf_sink(const char* data, long size, void* context)
+{
+	return (utf16_write_utf8((struct utf16_writer*)context, data, (size_t)size) == 0) ? 0 : -ERROR_WRITE_FAULT;
+}
+
+/*
+ * Tokenize an inf template, either compiled or as the src_size bytes of src if compiled
+ * is NULL, and pass it to <write> as UTF-16 data with a BOM. The tokenized inf is converted
+ * as it is produced, without any intermediate copy of the inf.
+ * Converting to UTF-16 is the only way to get devices using a non-English locale
+ * to display properly in device manager. UTF-8 will not do.
+ * Returns the size of the tokenized inf, or a negative error code.
+ */
+long inf_render(const token_template_t* compiled, const char* src, long src_size,
+	const token_entity_t* entities, utf16_write_t write, void* ctx)
+{
+	struct utf16_writer writer;
+	long size;
+
+	// Start with the UTF-8 encoding of the BOM (U+FEFF)
+	utf16_init(&writer, write, ctx);
+	if (utf16_write_utf8(&writer, "\xEF\xBB\xBF", 3) != 0)
+		return -ERROR_WRITE_FAULT;
+	if (compiled != NULL)
+		size = tokenize_render_to_sink(compiled, entities, inf_sink, &writer);
+	else
+		size = tokenize_to_sink(src, src_size, entities, "#", "#", inf_sink, &writer);
+	if (size <= 0)
+		return size;
+	if (utf16_flush(&writer) != 0)
+		return -ERROR_WRITE_FAULT;
+	return size;
+}
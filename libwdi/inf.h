@@ -0,0 +1,79 @@
+/*
+ * Library for USB automated driver installation - inf generation
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tokenizer.h"
+#include "utf16.h"
+
+/*
+ * Generation of the inf of a driver package, from an inf template. This file must
+ * remain portable, so that it can be built and tested on any platform: the values
+ * that depend on the system, such as the Device Interface GUID, the vendor name or
+ * the date, are provided by the caller, so that the output is fully determined by
+ * the parameters below.
+ */
+
+// Tokenizer data
+enum INF_TAGS
+{
+	INF_FILENAME,
+	CAT_FILENAME,
+	DEVICE_DESCRIPTION,
+	DEVICE_HARDWARE_ID,
+	DEVICE_INTERFACE_GUID,
+	DEVICE_MANUFACTURER,
+	DRIVER_DATE,
+	DRIVER_VERSION,
+	USE_DEVICE_INTERFACE_GUID,
+	WDF_VERSION,
+	KMDF_VERSION,
+	LK_COMMA,
+	LK_DLL,
+	LK_X86_DLL,
+	LK_EQ_X86,
+	LK_EQ_X64,
+};
+
+extern token_entity_t inf_entities[];
+
+struct inf_params {
+	const char* inf_name;		// name of the inf, without a path
+	const char* cat_name;		// NULL to use the name of the inf, with a .cat extension
+	const char* desc;
+	const char* compat_id;		// for WCID drivers, e.g. "MS_COMP_WINUSB". NULL to use the VID/PID
+	uint16_t vid;
+	uint16_t pid;
+	uint8_t mi;
+	int is_composite;
+	const char* device_guid;	// Device Interface GUID. Unused for WCID drivers
+	const char* vendor_name;	// NULL for an undefined vendor
+	int wdf_version;			// e.g. 1011 for KMDF 1.11
+	int year;					// driver date
+	int month;
+	int day;
+	uint32_t version_ms;		// driver version, as in VS_FIXEDFILEINFO
+	uint32_t version_ls;
+};
+
+const char* inf_android_guid(uint16_t vid, uint16_t pid);
+int inf_set_entities(token_arena_t* arena, token_entity_t* entities, const struct inf_params* params);
+long inf_render(const token_template_t* compiled, const char* src, long src_size,
+	const token_entity_t* entities, utf16_write_t write, void* ctx);
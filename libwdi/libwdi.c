@@ -30,7 +30,9 @@
 #include <io.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <time.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <objbase.h>
 #include <shellapi.h>
 #include <config.h>
@@ -47,6 +49,10 @@
 #include "logging.h"
 #include "tokenizer.h"
 #include "embedded.h"	// auto-generated during compilation
+#include "compress.h"
+#include "pack.h"
+#include "zip.h"
+#include "utf16.h"
 #include "msapi_utf8.h"
 #include "stdfn.h"
 
@@ -59,7 +65,26 @@ static VS_FIXEDFILEINFO driver_version[WDI_NB_DRIVERS-1] = { {0}, {0}, {0}, {0}
 static const char* driver_name[WDI_NB_DRIVERS-1] = {"winusbcoinstaller2.dll", "libusb0.dll", "libusbK.dll", ""};
 static const char* inf_template[WDI_NB_DRIVERS-1] = {"winusb.inf.in", "libusb0.inf.in", "libusbk.inf.in", "usbser.inf.in"};
 static const char* cat_template[WDI_NB_DRIVERS-1] = {"winusb.cat.in", "libusb0.cat.in", "libusbk.cat.in", "usbser.cat.in"};
+// Compiled inf and cat templates, that are only parsed once per driver type
+static token_template_t* inf_compiled[WDI_NB_DRIVERS-1] = { 0 };
+static token_template_t* cat_compiled[WDI_NB_DRIVERS-1] = { 0 };
+// Storage for the inf token values, that are set again on each prepare
+static token_arena_t inf_arena = { 0 };
 static const char* ms_compat_id[WDI_NB_DRIVERS-1] = {"MS_COMP_WINUSB", "MS_COMP_LIBUSB0", "MS_COMP_LIBUSBK", "MS_COMP_USBSER"};
+// The resources in use: the embedded ones, unless a resource pack was loaded
+static const struct res* res_table = resource;
+static int res_count = sizeof(resource) / sizeof(resource[0]);
+static const int* res_name_index = resource_name_index;
+static const int* res_path_index = resource_path_index;
+static struct {
+	HANDLE file;
+	HANDLE mapping;
+	const uint8_t* view;
+	struct res* table;
+	uint32_t (*version_info)[PACK_VERSION_INFO_SIZE];
+	int* name_index;
+	int* path_index;
+} pack = { INVALID_HANDLE_VALUE, NULL, NULL, NULL, NULL, NULL, NULL };
 int nWindowsVersion = WINDOWS_UNDEFINED;
 int nWindowsBuildNumber = -1;
 char WindowsVersionStr[128] = "Windows ";
@@ -539,6 +564,47 @@ static int check_dir(const char* path, BOOL create)
 	return WDI_SUCCESS;
 }
 
+/*
+ * The directories that are known to exist, during the extraction of a driver package, so
+ * that check_dir() is only called once for each of them. nb_saved is the number of
+ * check_dir() calls, each of which stats or creates a directory, that the cache avoided.
+ */
+#define DIR_CACHE_MAX_ENTRIES 32
+struct dir_cache {
+	char* path[DIR_CACHE_MAX_ENTRIES];
+	int nb_entries;
+	int nb_saved;
+};
+
+// Same as check_dir(path, TRUE), for a path that may already be in cache
+static int cached_check_dir(struct dir_cache* cache, const char* path)
+{
+	int i, r;
+
+	for (i=0; i<cache->nb_entries; i++) {
+		if (safe_stricmp(cache->path[i], path) == 0) {
+			cache->nb_saved++;
+			return WDI_SUCCESS;
+		}
+	}
+	r = check_dir(path, TRUE);
+	if ((r == WDI_SUCCESS) && (cache->nb_entries < DIR_CACHE_MAX_ENTRIES)) {
+		cache->path[cache->nb_entries] = safe_strdup(path);
+		if (cache->path[cache->nb_entries] != NULL)
+			cache->nb_entries++;
+	}
+	return r;
+}
+
+static void free_dir_cache(struct dir_cache* cache)
+{
+	int i;
+
+	for (i=0; i<cache->nb_entries; i++)
+		safe_free(cache->path[i]);
+	cache->nb_entries = 0;
+}
+
 /*
  * fopen equivalent, that uses CreateFile with security attributes
  * to create file as the user of the application. Supports UTF-8.
@@ -597,6 +663,93 @@ static FILE *fopen_as_userU(const char *filename, const char *mode)
 	return _fdopen(lowlevel_fd, mode);
 }
 
+/*
+ * Find a resource, using the sorted indexes generated by the embedder.
+ * If subdir is NULL, only the name is matched. When more than one resource
+ * matches, the one that comes first in the resource table is returned.
+ * Returns the index of the resource, or -1 if not found.
+ */
+static int find_resource(const char* subdir, const char* name)
+{
+	const int* index = (subdir == NULL) ? res_name_index : res_path_index;
+	int low = 0, high = res_count, mid, r;
+
+	if (name == NULL)
+		return -1;
+	while (low < high) {
+		mid = (low + high) / 2;
+		r = (subdir == NULL) ? 0 : strcmp(res_table[index[mid]].subdir, subdir);
+		if (r == 0)
+			r = strcmp(res_table[index[mid]].name, name);
+		if (r < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if ( (low < res_count) && (strcmp(res_table[index[low]].name, name) == 0)
+	  && ((subdir == NULL) || (strcmp(res_table[index[low]].subdir, subdir) == 0)) )
+		return index[low];
+	return -1;
+}
+
+static int fwrite_block(const void* buf, size_t size, void* ctx)
+{
+	return (fwrite(buf, 1, size, (FILE*)ctx) == size) ? 0 : -1;
+}
+
+/*
+ * Write an embedded resource to file, decompressing it on the fly if needed,
+ * so that we never need a full size copy of the data.
+ * Returns 0 on success.
+ */
+static int write_resource(FILE* fd, const struct res* r)
+{
+	if (r->compressed_size == 0)
+		return fwrite_block(r->data, r->size, fd);
+	return lz_decompress_stream(r->data, r->compressed_size, r->size, fwrite_block, fd);
+}
+
+// Return the uncompressed data of a resource, to be released with free_resource_data()
+static const unsigned char* get_resource_data(const struct res* r)
+{
+	unsigned char* data;
+
+	if (r->compressed_size == 0)
+		return r->data;
+	data = (unsigned char*)malloc(r->size);
+	if (data == NULL) {
+		wdi_err("Could not allocate buffer to decompress '%s'", r->name);
+		return NULL;
+	}
+	if (lz_decompress(r->data, r->compressed_size, data, r->size) != 0) {
+		wdi_err("Could not decompress '%s'", r->name);
+		free(data);
+		return NULL;
+	}
+	return data;
+}
+
+static void free_resource_data(const struct res* r, const unsigned char* data)
+{
+	if (data != r->data)
+		free((void*)data);
+}
+
+/*
+ * Retrieve the precomputed Authenticode SHA-1 of an extracted resource, so that
+ * cat files can be created without rehashing the files. As a safeguard against
+ * files that were replaced after extraction, the size must also match.
+ */
+BOOL get_resource_hash(const char* subdir, const char* name, uint64_t size, BYTE* hash)
+{
+	int i = find_resource(subdir, name);
+
+	if ((i < 0) || ((uint64_t)res_table[i].size != size))
+		return FALSE;
+	memcpy(hash, res_table[i].hash, sizeof(res_table[i].hash));
+	return TRUE;
+}
+
 
 // Retrieve the version info from the WinUSB, libusbK or libusb0 drivers
 int get_version_info(int driver_type, VS_FIXEDFILEINFO* driver_info)
@@ -629,23 +782,30 @@ int get_version_info(int driver_type, VS_FIXEDFILEINFO* driver_info)
 		goto out;
 	}
 
+	// Identify the WinUSB and libusb0 files we'll pick the date & version of
+	res = find_resource(NULL, driver_name[driver_type]);
+	if (res < 0) {
+		r = WDI_ERROR_NOT_FOUND;
+		goto out;
+	}
+
+	// Use the version info that the embedder retrieved, if available
+	if (res_table[res].version_info != NULL) {
+		memcpy(&driver_version[driver_type], res_table[res].version_info, sizeof(VS_FIXEDFILEINFO));
+		t = unixtime_to_msfiletime((time_t)res_table[res].creation_time);
+		driver_version[driver_type].dwFileDateLS = (DWORD)t;
+		driver_version[driver_type].dwFileDateMS = t >> 32;
+		memcpy(driver_info, &driver_version[driver_type], sizeof(VS_FIXEDFILEINFO));
+		r = WDI_SUCCESS;
+		goto out;
+	}
+
 	// Avoid the need for end user apps to link against version.lib
 	r = WDI_ERROR_RESOURCE;
 	PF_INIT_OR_OUT(VerQueryValueW, Version);
 	PF_INIT_OR_OUT(GetFileVersionInfoW, Version);
 	PF_INIT_OR_OUT(GetFileVersionInfoSizeW, Version);
 
-	for (res=0; res<nb_resources; res++) {
-		// Identify the WinUSB and libusb0 files we'll pick the date & version of
-		if (safe_strcmp(resource[res].name, driver_name[driver_type]) == 0) {
-			break;
-		}
-	}
-	if (res == nb_resources) {
-		r = WDI_ERROR_NOT_FOUND;
-		goto out;
-	}
-
 	// First, we need a physical file => extract it
 	tmpdir = getenvU("TEMP");
 	if (tmpdir == NULL) {
@@ -662,8 +822,8 @@ int get_version_info(int driver_type, VS_FIXEDFILEINFO* driver_info)
 	safe_strcpy(filename, MAX_PATH, tmpdir);
 	free(tmpdir);
 	safe_strcat(filename, MAX_PATH, "\\");
-	if (resource[res].name != NULL)	// Stupid Clang!
-		safe_strcat(filename, MAX_PATH, resource[res].name);
+	if (res_table[res].name != NULL)	// Stupid Clang!
+		safe_strcat(filename, MAX_PATH, res_table[res].name);
 
 	fd = fopen_as_userU(filename, "w");
 	if (fd == NULL) {
@@ -672,7 +832,13 @@ int get_version_info(int driver_type, VS_FIXEDFILEINFO* driver_info)
 		goto out;
 	}
 
-	fwrite(resource[res].data, 1, resource[res].size, fd);
+	if (write_resource(fd, &res_table[res]) != 0) {
+		wdi_warn("Failed to write file '%s'", filename);
+		fclose(fd);
+		DeleteFileU(filename);
+		r = WDI_ERROR_RESOURCE;
+		goto out;
+	}
 	fclose(fd);
 
 	// Read the version
@@ -684,7 +850,7 @@ int get_version_info(int driver_type, VS_FIXEDFILEINFO* driver_info)
 	  && (pfGetFileVersionInfoW(wfilename, 0, version_size, version_buf))
 	  && (pfVerQueryValueW(version_buf, L"\\", (void*)&file_info, &junk)) ) {
 		// Fill the creation date of VS_FIXEDFILEINFO with the one from embedded.h
-		t = unixtime_to_msfiletime((time_t)resource[res].creation_time);
+		t = unixtime_to_msfiletime((time_t)res_table[res].creation_time);
 		file_info->dwFileDateLS = (DWORD)t;
 		file_info->dwFileDateMS = t >> 32;
 		memcpy(&driver_version[driver_type], file_info, sizeof(VS_FIXEDFILEINFO));
@@ -759,20 +925,152 @@ BOOL LIBWDI_API wdi_is_driver_supported(int driver_type, VS_FIXEDFILEINFO* drive
  * path is the relative path for
  */
 BOOL LIBWDI_API wdi_is_file_embedded(const char* path, const char* name)
+{
+	return (find_resource(path, name) >= 0);
+}
+
+// Sort functions for the indexes of a resource pack, which must match the embedder's
+static int pack_name_cmp(const void* p1, const void* p2)
+{
+	int i1 = *(const int*)p1, i2 = *(const int*)p2;
+	int r = strcmp(pack.table[i1].name, pack.table[i2].name);
+
+	return (r != 0) ? r : (i1 - i2);
+}
+
+static int pack_path_cmp(const void* p1, const void* p2)
+{
+	int i1 = *(const int*)p1, i2 = *(const int*)p2;
+	int r = strcmp(pack.table[i1].subdir, pack.table[i2].subdir);
+
+	return (r != 0) ? r : pack_name_cmp(p1, p2);
+}
+
+static void free_compiled_templates(void)
 {
 	int i;
 
-	for (i = 0; i < nb_resources; i++) {
-		if (safe_strcmp(name, resource[i].name) == 0) {
-			if (path == NULL) {
-				return TRUE;
-			}
-			if (safe_strcmp(path, resource[i].subdir) == 0) {
-				return TRUE;
-			}
-		}
+	for (i = 0; i < WDI_NB_DRIVERS-1; i++) {
+		tokenize_free(inf_compiled[i]);
+		tokenize_free(cat_compiled[i]);
+		inf_compiled[i] = NULL;
+		cat_compiled[i] = NULL;
+	}
+}
+
+static void unload_resource_pack(void)
+{
+	if (pack.view != NULL)
+		UnmapViewOfFile(pack.view);
+	if (pack.mapping != NULL)
+		CloseHandle(pack.mapping);
+	if (pack.file != INVALID_HANDLE_VALUE)
+		CloseHandle(pack.file);
+	safe_free(pack.table);
+	safe_free(pack.version_info);
+	safe_free(pack.name_index);
+	safe_free(pack.path_index);
+	pack.view = NULL;
+	pack.mapping = NULL;
+	pack.file = INVALID_HANDLE_VALUE;
+}
+
+/*
+ * Use the resources from a pack file, created with the embedder's --pack option,
+ * instead of the embedded ones. The file is mapped rather than read, so that all
+ * the applications using the same pack share a single read-only copy.
+ * A NULL path reverts to the embedded resources.
+ */
+int LIBWDI_API wdi_load_resource_pack(const char* path)
+{
+	LARGE_INTEGER file_size;
+	struct pack_entry entry;
+	uint32_t i, nb_entries;
+	int r = WDI_ERROR_RESOURCE;
+
+	// Serialize with the calls that extract resources, which use the same table
+	MUTEX_START_NAMED("wdi_prepare_driver");
+
+	unload_resource_pack();
+	// The compiled templates come from the resources we are replacing
+	free_compiled_templates();
+	res_table = resource;
+	res_count = sizeof(resource) / sizeof(resource[0]);
+	res_name_index = resource_name_index;
+	res_path_index = resource_path_index;
+	// The cached driver versions may no longer apply
+	memset(driver_version, 0, sizeof(driver_version));
+	if (path == NULL) {
+		r = WDI_SUCCESS;
+		goto out;
 	}
-	return FALSE;
+
+	pack.file = CreateFileU(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pack.file == INVALID_HANDLE_VALUE) {
+		wdi_err("Could not open resource pack '%s': %s", path, wdi_windows_error_str(0));
+		r = (GetLastError() == ERROR_FILE_NOT_FOUND) ? WDI_ERROR_NOT_FOUND : WDI_ERROR_ACCESS;
+		goto out;
+	}
+	if ( (!GetFileSizeEx(pack.file, &file_size)) || ((uint64_t)file_size.QuadPart > SIZE_MAX)
+	  || ((pack.mapping = CreateFileMappingA(pack.file, NULL, PAGE_READONLY, 0, 0, NULL)) == NULL)
+	  || ((pack.view = (const uint8_t*)MapViewOfFile(pack.mapping, FILE_MAP_READ, 0, 0, 0)) == NULL) ) {
+		wdi_err("Could not map resource pack '%s': %s", path, wdi_windows_error_str(0));
+		r = WDI_ERROR_IO;
+		goto out;
+	}
+	if ((pack_open(pack.view, (size_t)file_size.QuadPart, &nb_entries) != 0) || (nb_entries > INT_MAX)) {
+		wdi_err("'%s' is not a valid resource pack", path);
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
+	}
+
+	pack.table = calloc(nb_entries, sizeof(struct res));
+	pack.version_info = calloc(nb_entries, sizeof(pack.version_info[0]));
+	pack.name_index = calloc(nb_entries, sizeof(int));
+	pack.path_index = calloc(nb_entries, sizeof(int));
+	if ( (nb_entries != 0) && ((pack.table == NULL) || (pack.version_info == NULL)
+	  || (pack.name_index == NULL) || (pack.path_index == NULL)) ) {
+		wdi_err("Could not allocate resource table");
+		goto out;
+	}
+	for (i = 0; i < nb_entries; i++) {
+		if ((pack_read_entry(pack.view, (size_t)file_size.QuadPart, i, &entry) != 0) || (entry.size > SIZE_MAX)) {
+			wdi_err("Invalid entry %u in resource pack '%s'", i, path);
+			r = WDI_ERROR_INVALID_PARAM;
+			goto out;
+		}
+		// The strings and data are used directly from the mapped view
+		pack.table[i].subdir = (char*)entry.subdir;
+		pack.table[i].name = (char*)entry.name;
+		pack.table[i].size = (size_t)entry.size;
+		pack.table[i].creation_time = entry.creation_time;
+		pack.table[i].data = entry.data;
+		pack.table[i].compressed_size = (size_t)entry.compressed_size;
+		if (entry.flags & PACK_HAS_VERSION) {
+			memcpy(pack.version_info[i], entry.version_info, sizeof(pack.version_info[i]));
+			pack.table[i].version_info = pack.version_info[i];
+		}
+		memcpy(pack.table[i].hash, entry.hash, sizeof(pack.table[i].hash));
+		memcpy(pack.table[i].content_hash, entry.content_hash, sizeof(pack.table[i].content_hash));
+		pack.table[i].tags = entry.tags;
+		pack.name_index[i] = i;
+		pack.path_index[i] = i;
+	}
+	qsort(pack.name_index, nb_entries, sizeof(int), pack_name_cmp);
+	qsort(pack.path_index, nb_entries, sizeof(int), pack_path_cmp);
+
+	res_table = pack.table;
+	res_count = (int)nb_entries;
+	res_name_index = pack.name_index;
+	res_path_index = pack.path_index;
+	wdi_info("Using %d resources from '%s'", res_count, path);
+	r = WDI_SUCCESS;
+
+out:
+	if (r != WDI_SUCCESS)
+		unload_resource_pack();
+	CloseHandle(mutex);
+	return r;
 }
 
 /*
@@ -1153,218 +1451,731 @@ int LIBWDI_API wdi_destroy_list(struct wdi_device_info* list)
 	return WDI_SUCCESS;
 }
 
-// extract the embedded binary resources
-static int extract_binaries(const char* path)
+// Check if an existing file has the same size and content as a resource
+static BOOL is_unchanged_file(HCRYPTPROV hProv, const char* filename, const struct res* r)
+{
+	HANDLE handle;
+	HCRYPTHASH hHash = 0;
+	LARGE_INTEGER size;
+	BYTE buf[16 * 1024], hash[sizeof(r->content_hash)];
+	DWORD read_size, hash_size = sizeof(hash);
+	BOOL same = FALSE;
+
+	handle = CreateFileU(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return FALSE;
+	// Only hash files that have the expected size
+	if ( (!GetFileSizeEx(handle, &size)) || ((uint64_t)size.QuadPart != (uint64_t)r->size)
+	  || (!CryptCreateHash(hProv, CALG_SHA1, 0, 0, &hHash)) )
+		goto out;
+	do {
+		if (!ReadFile(handle, buf, sizeof(buf), &read_size, NULL))
+			goto out;
+		if ((read_size != 0) && (!CryptHashData(hHash, buf, read_size, 0)))
+			goto out;
+	} while (read_size != 0);
+	if (CryptGetHashParam(hHash, HP_HASHVAL, hash, &hash_size, 0))
+		same = (hash_size == sizeof(hash)) && (memcmp(hash, r->content_hash, sizeof(hash)) == 0);
+
+out:
+	if (hHash != 0)
+		CryptDestroyHash(hHash);
+	CloseHandle(handle);
+	return same;
+}
+
+/*
+ * Write a resource through a temporary file, which then replaces the target,
+ * so that the target never ends up partially written.
+ */
+static int write_resource_file(const char* filename, const struct res* r)
 {
 	FILE *fd;
-	char filename[MAX_PATH];
-	int i, r;
+	char tmp_name[MAX_PATH];
+
+	if (safe_strlen(filename) + sizeof(".tmp") > MAX_PATH) {
+		wdi_err("Qualified path is too long: '%s'", filename);
+		return WDI_ERROR_RESOURCE;
+	}
+	static_sprintf(tmp_name, "%s.tmp", filename);
+	fd = fopen_as_userU(tmp_name, "w");
+	if (fd == NULL) {
+		wdi_err("Could not create file '%s' (%s)", tmp_name, wdi_windows_error_str(0));
+		return WDI_ERROR_RESOURCE;
+	}
+	if (write_resource(fd, r) != 0) {
+		wdi_err("Could not write file '%s'", tmp_name);
+		fclose(fd);
+		DeleteFileU(tmp_name);
+		return WDI_ERROR_RESOURCE;
+	}
+	if (fclose(fd) != 0) {
+		wdi_err("Could not write file '%s'", tmp_name);
+		DeleteFileU(tmp_name);
+		return WDI_ERROR_RESOURCE;
+	}
+	if (!MoveFileExU(tmp_name, filename, MOVEFILE_REPLACE_EXISTING)) {
+		wdi_err("Could not replace file '%s' (%s)", filename, wdi_windows_error_str(0));
+		DeleteFileU(tmp_name);
+		return WDI_ERROR_RESOURCE;
+	}
+	return WDI_SUCCESS;
+}
+
+/*
+ * Return the resource tags that are needed to install driver_type on the current
+ * platform. Untagged resources, such as the licenses, are always needed. As we
+ * don't know what a custom driver uses, all the driver files are kept for it.
+ */
+static uint32_t get_required_tags(int driver_type)
+{
+	uint32_t tags = 0;
+
+	switch (GetPlatformArch()) {
+	case IMAGE_FILE_MACHINE_I386:
+		tags |= RES_TAG_X86;
+		break;
+	case IMAGE_FILE_MACHINE_AMD64:
+		tags |= RES_TAG_X64;
+		break;
+	case IMAGE_FILE_MACHINE_ARM64:
+		tags |= RES_TAG_ARM64;
+		break;
+	default:
+		tags |= RES_TAG_ARCH_MASK;
+		break;
+	}
+	switch (driver_type) {
+	case WDI_WINUSB:
+		tags |= RES_TAG_WINUSB;
+		break;
+	case WDI_LIBUSB0:
+		tags |= RES_TAG_LIBUSB0;
+		break;
+	case WDI_LIBUSBK:
+		tags |= RES_TAG_LIBUSBK;
+		break;
+	case WDI_CDC:
+		// usbser.sys is part of Windows, so only the untagged files are needed
+		break;
+	default:
+		tags |= RES_TAG_DRIVER_MASK;
+		break;
+	}
+	return tags;
+}
+
+// Check if a resource with the tags of r is required by a required_tags filter
+static __inline BOOL is_required_resource(const struct res* r, uint32_t required_tags)
+{
+	if ((r->tags & RES_TAG_ARCH_MASK) && !(r->tags & required_tags & RES_TAG_ARCH_MASK))
+		return FALSE;
+	if ((r->tags & RES_TAG_DRIVER_MASK) && !(r->tags & required_tags & RES_TAG_DRIVER_MASK))
+		return FALSE;
+	return TRUE;
+}
+
+/*
+ * Create the directories needed by the resources that match required_tags, in a single
+ * pass, before any file is extracted. Each resource checks its directory through cache,
+ * so that a directory is only checked once, rather than once per resource.
+ */
+static int create_skeleton(const char* path, uint32_t required_tags, struct dir_cache* cache)
+{
+	char dirname[MAX_PATH];
+	const char* subdir;
+	int i, j, r;
 
-	for (i=0; i<nb_resources; i++) {
+	for (j=0; j<res_count; j++) {
+		i = res_path_index[j];
 		// Ignore tokenizer files
-		if (resource[i].subdir[0] == 0) {
+		if ((res_table[i].subdir[0] == 0) || !is_required_resource(&res_table[i], required_tags)) {
 			continue;
 		}
-		safe_strcpy(filename, MAX_PATH, path);
-		safe_strcat(filename, MAX_PATH, "\\");
-		safe_strcat(filename, MAX_PATH, resource[i].subdir);
-
-		r = check_dir(filename, TRUE);
+		subdir = res_table[i].subdir;
+		if ((safe_strlen(path) + safe_strlen(subdir)) > (MAX_PATH - 2)) {
+			wdi_err("Qualified path is too long: '%s\\%s'", path, subdir);
+			return WDI_ERROR_RESOURCE;
+		}
+		safe_strcpy(dirname, MAX_PATH, path);
+		if (strcmp(subdir, ".") != 0) {
+			safe_strcat(dirname, MAX_PATH, "\\");
+			safe_strcat(dirname, MAX_PATH, subdir);
+		}
+		r = cached_check_dir(cache, dirname);
 		if (r != WDI_SUCCESS) {
 			return r;
 		}
+	}
+	return WDI_SUCCESS;
+}
+
+/*
+ * extract the embedded binary resources
+ * Only the resources that match required_tags are extracted (see get_required_tags()).
+ * If skip_unchanged is set, the files that already exist with the same content
+ * are left alone, and the other ones are replaced through a temporary file.
+ * The directories that are known to exist are kept in cache, which the caller
+ * can reuse across extractions.
+ */
+static int extract_binaries(const char* path, BOOL skip_unchanged, uint32_t required_tags,
+	struct dir_cache* cache)
+{
+	FILE *fd;
+	char filename[MAX_PATH];
+	int i, r = WDI_SUCCESS, nb_written = 0, nb_skipped = 0, nb_filtered = 0, nb_saved = cache->nb_saved;
+	uint64_t written_size = 0, skipped_size = 0;
+	HCRYPTPROV hProv = 0;
+
+	if ( skip_unchanged
+	  && (!CryptAcquireContextA(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)) ) {
+		wdi_warn("Could not acquire crypto context (%s) - all files will be extracted", wdi_windows_error_str(0));
+		hProv = 0;
+	}
+
+	r = create_skeleton(path, required_tags, cache);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+	wdi_info("Created directory skeleton (%d directory checks avoided)", cache->nb_saved - nb_saved);
+
+	for (i=0; i<res_count; i++) {
+		// Ignore tokenizer files
+		if (res_table[i].subdir[0] == 0) {
+			continue;
+		}
+		if (!is_required_resource(&res_table[i], required_tags)) {
+			nb_filtered++;
+			continue;
+		}
+		safe_strcpy(filename, MAX_PATH, path);
+		safe_strcat(filename, MAX_PATH, "\\");
+		safe_strcat(filename, MAX_PATH, res_table[i].subdir);
 		safe_strcat(filename, MAX_PATH, "\\");
-		safe_strcat(filename, MAX_PATH, resource[i].name);
+		safe_strcat(filename, MAX_PATH, res_table[i].name);
 
-		if ( (safe_strlen(path) + safe_strlen(resource[i].subdir) + safe_strlen(resource[i].name)) > (MAX_PATH - 3)) {
+		if ( (safe_strlen(path) + safe_strlen(res_table[i].subdir) + safe_strlen(res_table[i].name)) > (MAX_PATH - 3)) {
 			wdi_err("Qualified path is too long: '%s'", filename);
-			return WDI_ERROR_RESOURCE;
+			r = WDI_ERROR_RESOURCE;
+			goto out;
 		}
 
-		fd = fopen_as_userU(filename, "w");
-		if (fd == NULL) {
-			wdi_err("Could not create file '%s' (%s)", filename, wdi_windows_error_str(0));
-			return WDI_ERROR_RESOURCE;
+		if (skip_unchanged) {
+			if ((hProv != 0) && is_unchanged_file(hProv, filename, &res_table[i])) {
+				nb_skipped++;
+				skipped_size += res_table[i].size;
+				continue;
+			}
+			r = write_resource_file(filename, &res_table[i]);
+			if (r != WDI_SUCCESS) {
+				goto out;
+			}
+		} else {
+			fd = fopen_as_userU(filename, "w");
+			if (fd == NULL) {
+				wdi_err("Could not create file '%s' (%s)", filename, wdi_windows_error_str(0));
+				r = WDI_ERROR_RESOURCE;
+				goto out;
+			}
+
+			if (write_resource(fd, &res_table[i]) != 0) {
+				wdi_err("Could not write file '%s'", filename);
+				fclose(fd);
+				r = WDI_ERROR_RESOURCE;
+				goto out;
+			}
+			fclose(fd);
 		}
+		nb_written++;
+		written_size += res_table[i].size;
+	}
 
-		fwrite(resource[i].data, 1, resource[i].size, fd);
-		fclose(fd);
+	if (skip_unchanged) {
+		wdi_info("Successfully extracted driver files to '%s' (%d written, %" PRIu64 " bytes - "
+			"%d unchanged, %" PRIu64 " bytes skipped)", path, nb_written, written_size, nb_skipped, skipped_size);
+	} else {
+		wdi_info("Successfully extracted driver files to '%s'", path);
 	}
+	if (nb_filtered != 0)
+		wdi_dbg("%d file(s) not needed by this driver and platform were not extracted", nb_filtered);
 
-	wdi_info("Successfully extracted driver files to '%s'", path);
-	return WDI_SUCCESS;
+out:
+	if (hProv != 0)
+		CryptReleaseContext(hProv, 0);
+	return r;
 }
 
-// tokenizes a resource stored in resource.h and write it to file <dst>
-static long wdi_tokenize_resource(const char* resource_name, char** dst, const token_entity_t* token_entities,
-								  const char* tok_prefix, const char* tok_suffix, int recursive)
+/*
+ * Compiles a resource stored in resource.h into the template pointed by <compiled>,
+ * unless this was already done. The template must always be rendered against the
+ * same token entity list and markers.
+ */
+static long wdi_compile_resource(const char* resource_name, token_template_t** compiled,
+								 const token_entity_t* token_entities, const char* tok_prefix, const char* tok_suffix)
 {
 	int i;
+	const unsigned char* data;
+
+	if (*compiled == NULL) {
+		// Tokenizer files are the ones that have no subdir
+		i = find_resource("", resource_name);
+		if (i < 0)
+			return -ERROR_RESOURCE_DATA_NOT_FOUND;
+		data = get_resource_data(&res_table[i]);
+		if (data == NULL)
+			return -ERROR_NOT_ENOUGH_MEMORY;
+		*compiled = tokenize_compile((const char*)data, (long)res_table[i].size,
+			token_entities, tok_prefix, tok_suffix);
+		free_resource_data(&res_table[i], data);
+		if (*compiled == NULL)
+			return -ERROR_NOT_ENOUGH_MEMORY;
+	}
+	return 0;
+}
 
-	for (i=0; i<nb_resources; i++) {
-		// Ignore driver files
-		if (resource[i].subdir[0] != 0) {
-			continue;
-		}
-		if (strcmp(resource[i].name, resource_name) == 0) {
-			return tokenize_string(resource[i].data, (long)resource[i].size,
-				dst, token_entities, tok_prefix, tok_suffix, recursive);
-		}
-	}
-	return -ERROR_RESOURCE_DATA_NOT_FOUND;
+// tokenizes a resource stored in resource.h into <dst>
+static long wdi_tokenize_resource(const char* resource_name, token_template_t** compiled, char** dst,
+								  const token_entity_t* token_entities, const char* tok_prefix, const char* tok_suffix)
+{
+	long r = wdi_compile_resource(resource_name, compiled, token_entities, tok_prefix, tok_suffix);
+
+	if (r < 0)
+		return r;
+	return tokenize_render(*compiled, dst, token_entities);
 }
 
-// tokenizes an external file pointed by <src> into destination file <dst>
-static long wdi_tokenize_file(const char* src, char** dst, const token_entity_t* token_entities,
-							  const char* tok_prefix, const char* tok_suffix, int recursive)
+// Read an external file into a NUL terminated buffer, to be freed by the caller
+static char* wdi_read_file(const char* src, long* size)
 {
 	FILE* fd = NULL;
-	long size, ret = -ERROR_RESOURCE_DATA_NOT_FOUND;
 	char* buffer = NULL;
 
 	fd = fopen(src, "r");
-	if (fd == NULL)
+	if (fd == NULL) {
+		wdi_err("Could not open file '%s'", src);
 		goto out;
+	}
 	fseek(fd, 0L, SEEK_END);
-	size = ftell(fd);
-	if (size < 0)
+	*size = ftell(fd);
+	if (*size < 0)
 		goto out;
 	fseek(fd, 0L, SEEK_SET);
 	// +1  for NUL terminator since we pass the whole file as a text string
-	buffer = (char*)calloc(size + 1, 1);
+	buffer = (char*)calloc(*size + 1, 1);
 	if (buffer == NULL) {
 		wdi_err("Could not allocate tokenization buffer");
-		ret = WDI_ERROR_RESOURCE;
 		goto out;
 	}
-	if (fread(buffer, 1, size, fd) != size) {
+	// Text mode may read less than the size of the file
+	*size = (long)fread(buffer, 1, *size, fd);
+	if (ferror(fd)) {
 		wdi_err("Could not read file to tokenize");
-		ret = -ERROR_RESOURCE_DATA_NOT_FOUND;
-		goto out;
+		safe_free(buffer);
 	}
-	ret = tokenize_string(buffer, size, dst, token_entities, tok_prefix, tok_suffix, recursive);
 
 out:
-	free(buffer);
 	if (fd)
 		fclose(fd);
-	return ret;
+	return buffer;
 }
 
-#define CAT_LIST_MAX_ENTRIES 16
-// Create an inf and extract coinstallers in the directory pointed by path
-int LIBWDI_API wdi_prepare_driver(struct wdi_device_info* device_info, const char* path,
-								  const char* inf, struct wdi_options_prepare_driver* options)
+// Validate the requested driver type, and fall back to a supported one if needed
+static int get_driver_type(struct wdi_options_prepare_driver* options, int* driver_type)
 {
-	PF_DECL_LIBRARY(Ntdll);
-	PF_TYPE_DECL(NTAPI, NTSTATUS, NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG));
-	const wchar_t bom = 0xFEFF;
 #if defined(ENABLE_DEBUG_LOGGING) || defined(INCLUDE_DEBUG_LOGGING)
 	const char* driver_display_name[WDI_NB_DRIVERS] = { "WinUSB", "libusb0.sys", "libusbK.sys", "Generic USB CDC", "user driver" };
 #endif
-	const char* inf_ext = ".inf";
-	const char* vendor_name = NULL;
-	const char* cat_list[CAT_LIST_MAX_ENTRIES+1];
-	char drv_path[MAX_PATH], inf_path[MAX_PATH], cat_path[MAX_PATH], hw_id[40], cert_subject[64];
-	char *strguid, *token, *cat_name = NULL, *dst = NULL, *inf_name;
-	wchar_t *wdst = NULL;
-	int i, nb_entries, driver_type = WDI_WINUSB, r = WDI_ERROR_OTHER;
-	long inf_file_size, cat_file_size;
-	BOOL is_android_device = FALSE, is_test_signing_enabled = FALSE;
-	FILE* fd;
-	GUID guid;
-	SYSTEMTIME system_time;
-	FILETIME file_time, local_time;
-	SYSTEM_CODEINTEGRITY_INFORMATION sci = { 0 };
-	ULONG dwcbSz = 0;
 
-	MUTEX_START;
-
-	GET_WINDOWS_VERSION;
-	if (nWindowsVersion < WINDOWS_7) {
-		wdi_err("This version of Windows is no longer supported");
-		r = WDI_ERROR_NOT_SUPPORTED;
-		goto out;
-	}
+	*driver_type = (options != NULL) ? options->driver_type : WDI_WINUSB;
 
-	if ((device_info == NULL) || (inf == NULL)) {
-		wdi_err("One of the required parameter is NULL");
-		r = WDI_ERROR_INVALID_PARAM;
-		goto out;
+	// Ensure driver_type is what we expect
+	if ((*driver_type < 0) || (*driver_type > WDI_USER)) {
+		wdi_err("Program assertion failed - Unknown driver type");
+		return WDI_ERROR_INVALID_PARAM;
 	}
 
-	// If we are dealing with a path (e.g. option 'external_inf'), remove the directory part
-	inf_name = (char*)filename(inf);
+	if (!wdi_is_driver_supported(*driver_type, &driver_version[*driver_type])) {
+		for (*driver_type = 0; *driver_type < WDI_NB_DRIVERS; (*driver_type)++) {
+			if (wdi_is_driver_supported(*driver_type, NULL)) {
+				wdi_warn("unsupported or no driver type specified, will use %s",
+					driver_display_name[*driver_type]);
+				break;
+			}
+		}
+		if (*driver_type == WDI_NB_DRIVERS) {
+			wdi_warn("Program assertion failed - no driver supported");
+			return WDI_ERROR_NOT_FOUND;
+		}
+	}
+
+	// If the target is libusb-win32 and we have the K DLLs, add them to the inf
+	if ((*driver_type == WDI_LIBUSB0) && (wdi_is_driver_supported(WDI_LIBUSBK, NULL))) {
+		wdi_info("K driver available - adding the libusbK DLLs to the libusb-win32 inf");
+		token_set_static(&inf_entities[LK_COMMA], ",");
+		token_set_static(&inf_entities[LK_DLL], "libusbk.dll");
+		token_set_static(&inf_entities[LK_X86_DLL], "libusbk_x86.dll");
+		token_set_static(&inf_entities[LK_EQ_X86], "= 1,x86");
+		token_set_static(&inf_entities[LK_EQ_X64], "= 1,amd64");
+	}
+	return WDI_SUCCESS;
+}
+
+/*
+ * Generate the inf of a driver package, from the inf template of driver_type or from
+ * the external inf, and pass it to <write> as UTF-16 data with a BOM.
+ * The inf itself is produced by the portable inf_render(), with the values that
+ * depend on the system (GUID, vendor name, date) resolved here.
+ * If cat_name is NULL, the inf references a cat with the same name as the inf.
+ */
+static int create_inf(struct wdi_device_info* device_info, const char* inf, const char* cat_name,
+	struct wdi_options_prepare_driver* options, int driver_type, utf16_write_t write, void* write_context)
+{
+	struct inf_params params;
+	char* buffer;
+	long inf_file_size, size;
+	GUID guid;
+	SYSTEMTIME system_time;
+	FILETIME file_time, local_time;
+
+	// Extra check, in case somebody modifies our code
+	if ((driver_type < 0) && (driver_type >= WDI_USER)) {
+		wdi_err("Program assertion failed - driver_version[] index out of range");
+		return WDI_ERROR_OTHER;
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.inf_name = filename(inf);
+	params.cat_name = cat_name;
+	params.desc = device_info->desc;
+	params.vid = device_info->vid;
+	params.pid = device_info->pid;
+	params.mi = device_info->mi;
+	params.is_composite = device_info->is_composite;
+
+	// Populate the Hardware ID and Device Interface GUID
+	if ((options != NULL) && (options->use_wcid_driver)) {
+		params.compat_id = ms_compat_id[driver_type];
+	} else if ((options != NULL) && (options->device_guid != NULL)) {
+		params.device_guid = options->device_guid;
+	} else if ((params.device_guid = inf_android_guid(device_info->vid, device_info->pid)) != NULL) {
+		wdi_info("Using Android Device Interface GUID");
+	} else {
+		IGNORE_RETVAL(CoCreateGuid(&guid));
+		params.device_guid = guid_to_string(guid);
+	}
+
+	// Resolve the Manufacturer (Vendor Name)
+	if ((options != NULL) && (options->vendor_name != NULL)) {
+		params.vendor_name = options->vendor_name;
+	} else {
+		params.vendor_name = wdi_get_vendor_name(device_info->vid);
+	}
+
+	// Set the date and version data
+	params.wdf_version = WDF_VER;
+	file_time.dwHighDateTime = driver_version[driver_type].dwFileDateMS;
+	file_time.dwLowDateTime = driver_version[driver_type].dwFileDateLS;
+	if ( ((file_time.dwHighDateTime == 0) && (file_time.dwLowDateTime == 0))
+	  || (!FileTimeToLocalFileTime(&file_time, &local_time))
+	  || (!FileTimeToSystemTime(&local_time, &system_time)) ) {
+		GetLocalTime(&system_time);
+	}
+	params.year = system_time.wYear;
+	params.month = system_time.wMonth;
+	params.day = system_time.wDay;
+	params.version_ms = driver_version[driver_type].dwFileVersionMS;
+	params.version_ls = driver_version[driver_type].dwFileVersionLS;
+
+	// Release the values of the previous call, that are all set again
+	token_arena_free(&inf_arena);
+	if (inf_set_entities(&inf_arena, inf_entities, &params) != 0) {
+		wdi_err("Could not allocate inf token values");
+		return WDI_ERROR_RESOURCE;
+	}
+
+	if ((options != NULL) && (options->external_inf)) {
+		buffer = wdi_read_file(inf, &size);
+		if (buffer == NULL)
+			return WDI_ERROR_ACCESS;
+		inf_file_size = inf_render(NULL, buffer, size, inf_entities, write, write_context);
+		free(buffer);
+	} else {
+		inf_file_size = wdi_compile_resource(inf_template[driver_type], &inf_compiled[driver_type],
+			inf_entities, "#", "#");
+		if (inf_file_size == 0)
+			inf_file_size = inf_render(inf_compiled[driver_type], NULL, 0, inf_entities, write, write_context);
+	}
+	if (inf_file_size <= 0) {
+		wdi_err("Could not tokenize inf file (%d)", inf_file_size);
+		return WDI_ERROR_ACCESS;
+	}
+	return WDI_SUCCESS;
+}
+
+// Writes the UTF-16 inf to a file
+static int inf_file_write(const void* buf, size_t size, void* ctx)
+{
+	return (fwrite(buf, 1, size, (FILE*)ctx) == size) ? 0 : -1;
+}
+
+// Appends the UTF-16 inf to a growing buffer, for the package sink
+struct inf_buffer {
+	unsigned char* data;
+	size_t size;
+	size_t max_size;
+};
 
-	// Check the inf file provided and create the cat file name
-	if (strcmp(inf_name + safe_strlen(inf_name) - 4, inf_ext) != 0) {
+static int inf_buffer_write(const void* buf, size_t size, void* ctx)
+{
+	struct inf_buffer* inf_buf = (struct inf_buffer*)ctx;
+	unsigned char* data;
+	size_t max_size;
+
+	if (inf_buf->size + size > inf_buf->max_size) {
+		max_size = max(2 * inf_buf->max_size, inf_buf->size + size);
+		data = realloc(inf_buf->data, max_size);
+		if (data == NULL)
+			return -1;
+		inf_buf->data = data;
+		inf_buf->max_size = max_size;
+	}
+	memcpy(&inf_buf->data[inf_buf->size], buf, size);
+	inf_buf->size += size;
+	return 0;
+}
+
+#define CAT_LIST_MAX_ENTRIES 16
+// Return the file part of inf (e.g. with option 'external_inf'), or NULL if it isn't an '.inf'
+static const char* get_inf_name(const char* inf)
+{
+	const char* inf_name = filename(inf);
+
+	if ((safe_strlen(inf_name) < 4) || (strcmp(inf_name + safe_strlen(inf_name) - 4, ".inf") != 0)) {
 		wdi_err("Inf name provided must have a '.inf' extension");
-		r = WDI_ERROR_INVALID_PARAM;
-		goto out;
+		return NULL;
 	}
+	return inf_name;
+}
+
+// Set the directory where the driver files are created, and create it if it doesn't exist
+static int get_drv_path(const char* path, char* drv_path, struct dir_cache* cache)
+{
+	char* tmp;
 
 	if (path != NULL) {
-		static_strcpy(drv_path, path);
+		safe_strcpy(drv_path, MAX_PATH, path);
 	} else {
 		// Try to use the user's temp dir
-		char* tmp = getenvU("TEMP");
+		tmp = getenvU("TEMP");
 		if (tmp == NULL) {
 			wdi_err("No path provided and unable to use TEMP");
-			r = WDI_ERROR_INVALID_PARAM;
-			goto out;
-		} else {
-			static_strcpy(drv_path, tmp);
-			free(tmp);
-			wdi_info("No path provided - extracting to '%s'", drv_path);
+			return WDI_ERROR_INVALID_PARAM;
 		}
+		safe_strcpy(drv_path, MAX_PATH, tmp);
+		free(tmp);
+		wdi_info("No path provided - extracting to '%s'", drv_path);
+	}
+	return cached_check_dir(cache, drv_path);
+}
+
+// Create the inf for a device in drv_path, and set the path of the matching cat in cat_path
+static int write_inf(struct wdi_device_info* device_info, const char* drv_path, const char* inf,
+	const char* cat_name, struct wdi_options_prepare_driver* options, int driver_type, char* cat_path)
+{
+	const char* inf_name = filename(inf);
+	char inf_path[MAX_PATH];
+	FILE* fd;
+	int r;
+
+	// Populate the inf and cat paths
+	if ( (strlen(drv_path) >= MAX_PATH) || (strlen(inf_name) >= MAX_PATH) ||
+		 ((strlen(drv_path) + strlen(inf_name)) > (MAX_PATH - 2)) ) {
+		wdi_err("Qualified path for inf file is too long: '%s\\%s", drv_path, inf_name);
+		return WDI_ERROR_RESOURCE;
 	}
+	safe_strcpy(inf_path, sizeof(inf_path), drv_path);
+	safe_strcat(inf_path, sizeof(inf_path), "\\");
+	safe_strcat(inf_path, sizeof(inf_path), inf_name);
+	safe_strcpy(cat_path, MAX_PATH, inf_path);
+	cat_path[safe_strlen(cat_path)-3] = 'c';
+	cat_path[safe_strlen(cat_path)-2] = 'a';
+	cat_path[safe_strlen(cat_path)-1] = 't';
 
-	// Try to create directory if it doesn't exist
-	r = check_dir(drv_path, TRUE);
+	fd = fopen_as_userU(inf_path, "w");
+	if (fd == NULL) {
+		wdi_err("Failed to create file: %s", inf_path);
+		return WDI_ERROR_ACCESS;
+	}
+	r = create_inf(device_info, inf, cat_name, options, driver_type, inf_file_write, fd);
+	fclose(fd);
 	if (r != WDI_SUCCESS) {
+		DeleteFileU(inf_path);
+		return r;
+	}
+	wdi_info("Successfully created '%s'", inf_path);
+	return WDI_SUCCESS;
+}
+
+/*
+ * Tokenize the cat template of driver_type into dst, and add the files it lists to cat_list,
+ * which must have room for at least CAT_LIST_MAX_ENTRIES entries.
+ * Returns the number of entries, or a WDI error code.
+ */
+static int get_cat_list(int driver_type, char** dst, const char** cat_list)
+{
+	char* token;
+	int nb_entries = 0;
+	long cat_file_size;
+
+	// Tokenize the cat file (for WDF version)
+	if ((cat_file_size = wdi_tokenize_resource(cat_template[driver_type], &cat_compiled[driver_type],
+		dst, inf_entities, "#", "#")) <= 0) {
+		wdi_err("Could not tokenize cat file (%d)", cat_file_size);
+		return WDI_ERROR_ACCESS;
+	}
+
+	// Build the filename list
+	for (token = strtok(*dst, "\n\r"); token != NULL; token = strtok(NULL, "\n\r")) {
+		// Eliminate leading, trailing spaces & comments (#...)
+		while (isspace(*token)) token++;
+		while (strlen(token) && isspace(token[strlen(token)-1]))
+			token[strlen(token)-1] = 0;
+		if ((*token == '#') || (*token == 0))
+			continue;
+		cat_list[nb_entries++] = token;
+		if (nb_entries >= CAT_LIST_MAX_ENTRIES) {
+			wdi_warn("More than %d cat entries - ignoring the rest", CAT_LIST_MAX_ENTRIES);
+			break;
+		}
+	}
+	return nb_entries;
+}
+
+// Check if testsigning is enabled
+// https://social.msdn.microsoft.com/Forums/Windowsapps/en-US/e6c1be93-7003-4594-b8e4-18ab4a75d273/detecting-testsigning-onoff-via-api
+static BOOL is_test_signing_enabled(void)
+{
+	PF_DECL_LIBRARY(Ntdll);
+	PF_TYPE_DECL(NTAPI, NTSTATUS, NtQuerySystemInformation, (SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG));
+	SYSTEM_CODEINTEGRITY_INFORMATION sci = { 0 };
+	ULONG dwcbSz = 0;
+	BOOL r = FALSE;
+
+	PF_INIT(NtQuerySystemInformation, Ntdll);
+	if (pfNtQuerySystemInformation != NULL) {
+		sci.Length = sizeof(sci);
+		if (pfNtQuerySystemInformation((SYSTEM_INFORMATION_CLASS)0x67, &sci, sizeof(sci), &dwcbSz) >= 0 && dwcbSz == sizeof(sci))
+			r = !!(sci.CodeIntegrityOptions & 0x02);
+		wdi_info("Test signing is: %s", r ? "Enabled" : "Disabled");
+	}
+	return r;
+}
+
+// Failures to create or sign a cat file are fatal on Windows 10 when test signing is not enabled
+static int cat_failure(const char* msg, int error, BOOL test_signing)
+{
+	if (nWindowsVersion >= WINDOWS_10 && !test_signing) {
+		wdi_err("%s", msg);
+		return error;
+	}
+	wdi_warn("%s", msg);
+	return WDI_SUCCESS;
+}
+
+// Set the hardware ID of the last created inf, which is either "USB\VID_####&PID_####[&MI_##]"
+// or the MS Compatible ID
+#define get_cat_hw_id(hw_id, options, driver_type) static_sprintf(hw_id, "USB\\%s", \
+	((options != NULL) && (options->use_wcid_driver))? \
+	ms_compat_id[driver_type]:inf_entities[DEVICE_HARDWARE_ID].replace)
+
+/*
+ * Create the cat of the inf last created in drv_path, and self-sign it unless disabled.
+ * Returns WDI_SUCCESS, or a WDI error code if the failure is fatal.
+ */
+static int create_cat(const char* drv_path, const char* inf_name, const char* cat_path,
+	struct wdi_options_prepare_driver* options, int driver_type)
+{
+	const char* cat_list[CAT_LIST_MAX_ENTRIES+1];
+	const char* hw_id_list[1];
+	char hw_id[40], cert_subject[64];
+	char *dst = NULL;
+	int nb_entries, r = WDI_SUCCESS;
+	BOOL test_signing;
+
+	wdi_info("Creating and self-signing a .cat file...");
+
+	nb_entries = get_cat_list(driver_type, &dst, cat_list);
+	if (nb_entries < 0) {
+		return nb_entries;
+	}
+	// Add the inf name to our list
+	cat_list[nb_entries++] = inf_name;
+
+	get_cat_hw_id(hw_id, options, driver_type);
+	static_sprintf(cert_subject, "CN=%s (libwdi autogenerated)", hw_id);
+	hw_id_list[0] = hw_id;
+	test_signing = is_test_signing_enabled();
+
+	if (!CreateCat(cat_path, hw_id_list, 1, drv_path, cat_list, nb_entries)) {
+		r = cat_failure("Could not create cat file", WDI_ERROR_CAT_MISSING, test_signing);
+	} else if ((options != NULL) && (!options->disable_signing) && (!SelfSignFile(cat_path,
+		(options->cert_subject != NULL)?options->cert_subject:cert_subject))) {
+		r = cat_failure("Could not sign cat file", WDI_ERROR_UNSIGNED, test_signing);
+	}
+	safe_free(dst);
+	return r;
+}
+
+// Create an inf and extract coinstallers in the directory pointed by path
+int LIBWDI_API wdi_prepare_driver(struct wdi_device_info* device_info, const char* path,
+								  const char* inf, struct wdi_options_prepare_driver* options)
+{
+	struct dir_cache cache = { { NULL }, 0, 0 };
+	const char* inf_name;
+	char drv_path[MAX_PATH], cat_path[MAX_PATH];
+	int driver_type = WDI_WINUSB, r = WDI_ERROR_OTHER;
+	uint32_t required_tags = RES_TAG_ARCH_MASK | RES_TAG_DRIVER_MASK;
+
+	MUTEX_START;
+
+	GET_WINDOWS_VERSION;
+	if (nWindowsVersion < WINDOWS_7) {
+		wdi_err("This version of Windows is no longer supported");
+		r = WDI_ERROR_NOT_SUPPORTED;
 		goto out;
 	}
 
-	if (options != NULL) {
-		driver_type = options->driver_type;
+	if ((device_info == NULL) || (inf == NULL)) {
+		wdi_err("One of the required parameter is NULL");
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
 	}
 
-	// Ensure driver_type is what we expect
-	if ((driver_type < 0) || (driver_type > WDI_USER)) {
-		wdi_err("Program assertion failed - Unknown driver type");
+	// Check the inf file provided
+	inf_name = get_inf_name(inf);
+	if (inf_name == NULL) {
 		r = WDI_ERROR_INVALID_PARAM;
 		goto out;
 	}
 
-	if (!wdi_is_driver_supported(driver_type, &driver_version[driver_type])) {
-		for (driver_type = 0; driver_type < WDI_NB_DRIVERS; driver_type++) {
-			if (wdi_is_driver_supported(driver_type, NULL)) {
-				wdi_warn("unsupported or no driver type specified, will use %s",
-					driver_display_name[driver_type]);
-				break;
-			}
-		}
-		if (driver_type == WDI_NB_DRIVERS) {
-			wdi_warn("Program assertion failed - no driver supported");
-			r = WDI_ERROR_NOT_FOUND;
-			goto out;
-		}
+	r = get_drv_path(path, drv_path, &cache);
+	if (r != WDI_SUCCESS) {
+		goto out;
 	}
 
-	// If the target is libusb-win32 and we have the K DLLs, add them to the inf
-	if ((driver_type == WDI_LIBUSB0) && (wdi_is_driver_supported(WDI_LIBUSBK, NULL))) {
-		wdi_info("K driver available - adding the libusbK DLLs to the libusb-win32 inf");
-		static_strcpy(inf_entities[LK_COMMA].replace, ",");
-		static_strcpy(inf_entities[LK_DLL].replace, "libusbk.dll");
-		static_strcpy(inf_entities[LK_X86_DLL].replace, "libusbk_x86.dll");
-		static_strcpy(inf_entities[LK_EQ_X86].replace, "= 1,x86");
-		static_strcpy(inf_entities[LK_EQ_X64].replace, "= 1,amd64");
+	r = get_driver_type(options, &driver_type);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+
+	if ((options != NULL) && (options->extract_required_only)) {
+		required_tags = get_required_tags(driver_type);
 	}
 
 	// For custom drivers, as we cannot autogenerate the inf, simply extract binaries
 	if (driver_type == WDI_USER) {
 		wdi_info("Custom driver - extracting binaries only (no inf/cat creation)");
-		r = extract_binaries(drv_path);
+		r = extract_binaries(drv_path, (options != NULL) && (options->skip_unchanged), required_tags, &cache);
 		goto out;
 	}
 
@@ -1374,228 +2185,486 @@ int LIBWDI_API wdi_prepare_driver(struct wdi_device_info* device_info, const cha
 		goto out;
 	}
 
-	r = extract_binaries(drv_path);
+	r = extract_binaries(drv_path, (options != NULL) && (options->skip_unchanged), required_tags, &cache);
 	if (r != WDI_SUCCESS) {
 		goto out;
 	}
 
-	// Populate the inf and cat names & paths
-	if ( (strlen(drv_path) >= MAX_PATH) || (strlen(inf_name) >= MAX_PATH) ||
-		 ((strlen(drv_path) + strlen(inf_name)) > (MAX_PATH - 2)) ) {
-		wdi_err("Qualified path for inf file is too long: '%s\\%s", drv_path, inf_name);
-		r = WDI_ERROR_RESOURCE;
+	r = write_inf(device_info, drv_path, inf, NULL, options, driver_type, cat_path);
+	if (r != WDI_SUCCESS) {
 		goto out;
 	}
-	safe_strcpy(inf_path, sizeof(inf_path), drv_path);
-	safe_strcat(inf_path, sizeof(inf_path), "\\");
-	safe_strcat(inf_path, sizeof(inf_path), inf_name);
-	safe_strcpy(cat_path, sizeof(cat_path), inf_path);
-	if (safe_strlen(cat_path) < 4) {
-		wdi_err("Qualified path for inf file is too short: '%s", cat_path);
-		r = WDI_ERROR_RESOURCE;
+
+	if (IsUserAnAdmin()) {
+		// Try to create and self-sign the cat file to remove security prompts
+		if ((options != NULL) && (options->disable_cat)) {
+			wdi_info(".cat generation disabled by user");
+			r = WDI_SUCCESS;
+			goto out;
+		}
+		r = create_cat(drv_path, inf_name, cat_path, options, driver_type);
 		goto out;
+	} else {
+		wdi_info("No .cat file generated (missing elevated privileges)");
 	}
-	cat_path[safe_strlen(cat_path)-3] = 'c';
-	cat_path[safe_strlen(cat_path)-2] = 'a';
-	cat_path[safe_strlen(cat_path)-1] = 't';
+	r = WDI_SUCCESS;
 
-	static_strcpy(inf_entities[INF_FILENAME].replace, inf_name);
-	cat_name = safe_strdup(inf_name);
-	if (cat_name == NULL) {
-		r = WDI_ERROR_RESOURCE;
+out:
+	free_dir_cache(&cache);
+	CloseHandle(mutex);
+	return r;
+}
+
+/*
+ * Create the infs of nb_devices devices in the directory pointed by path, with the driver
+ * files only extracted once. The cat files are all signed with the same certificate, and
+ * if the batch_cat_name option is set, a single cat, for all the devices, is created.
+ */
+int LIBWDI_API wdi_prepare_driver_batch(struct wdi_device_info* device_info, int nb_devices,
+	const char* path, const char** inf, struct wdi_options_prepare_driver* options)
+{
+	const char **cat_list = NULL, **cat_path_list = NULL, **hw_id_list = NULL;
+	const char *cat_name = NULL, *inf_name;
+	char drv_path[MAX_PATH], cat_path[MAX_PATH], cert_subject[64];
+	char *dst = NULL, (*cat_paths)[MAX_PATH] = NULL, (*hw_ids)[40] = NULL;
+	int i, nb_entries, nb_cats, driver_type = WDI_WINUSB, r = WDI_ERROR_OTHER;
+	uint32_t required_tags = RES_TAG_ARCH_MASK | RES_TAG_DRIVER_MASK;
+	BOOL test_signing;
+	struct dir_cache cache = { { NULL }, 0, 0 };
+
+	// This call uses the same inf entities as wdi_prepare_driver()
+	MUTEX_START_NAMED("wdi_prepare_driver");
+
+	GET_WINDOWS_VERSION;
+	if (nWindowsVersion < WINDOWS_7) {
+		wdi_err("This version of Windows is no longer supported");
+		r = WDI_ERROR_NOT_SUPPORTED;
 		goto out;
 	}
-	cat_name[safe_strlen(inf_name)-3] = 'c';
-	cat_name[safe_strlen(inf_name)-2] = 'a';
-	cat_name[safe_strlen(inf_name)-1] = 't';
-	static_strcpy(inf_entities[CAT_FILENAME].replace, cat_name);
-	safe_free(cat_name);
 
-	// Populate the Device Description and Hardware ID
-	static_strcpy(inf_entities[DEVICE_DESCRIPTION].replace, device_info->desc);
-	if ((options != NULL) && (options->use_wcid_driver)) {
-		static_strcpy(inf_entities[DEVICE_HARDWARE_ID].replace, ms_compat_id[driver_type]);
-		static_strcpy(inf_entities[USE_DEVICE_INTERFACE_GUID].replace, "NoDeviceInterfaceGUID");
-	} else {
-		if (device_info->is_composite) {
-			static_sprintf(inf_entities[DEVICE_HARDWARE_ID].replace, "VID_%04X&PID_%04X&MI_%02X",
-				device_info->vid, device_info->pid, device_info->mi);
-		} else {
-			static_sprintf(inf_entities[DEVICE_HARDWARE_ID].replace, "VID_%04X&PID_%04X",
-				device_info->vid, device_info->pid);
-		}
-		static_strcpy(inf_entities[USE_DEVICE_INTERFACE_GUID].replace, "AddDeviceInterfaceGUID");
+	if ((device_info == NULL) || (inf == NULL) || (nb_devices <= 0)) {
+		wdi_err("One of the required parameter is NULL");
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
 	}
 
-	// Find out if we have an Android device
-	for (i=0; i<ARRAYSIZE(android_device); i++) {
-		if ((android_device[i].vid == device_info->vid) && (android_device[i].pid == device_info->pid)) {
-			is_android_device = TRUE;
-			break;
+	if ((options != NULL) && (options->batch_cat_name != NULL)) {
+		cat_name = filename(options->batch_cat_name);
+		if ((safe_strlen(cat_name) < 4) || (strcmp(cat_name + safe_strlen(cat_name) - 4, ".cat") != 0)) {
+			wdi_err("Cat name provided must have a '.cat' extension");
+			r = WDI_ERROR_INVALID_PARAM;
+			goto out;
 		}
 	}
 
-	// Populate the Device Interface GUID
-	if ((options != NULL) && (options->use_wcid_driver)) {
-		strguid = "UNUSED";
-	} else if ((options != NULL) && (options->device_guid != NULL)) {
-		strguid = options->device_guid;
-	} else if (is_android_device) {
-		wdi_info("Using Android Device Interface GUID");
-		strguid = (char*)android_device_guid;
-	} else {
-		IGNORE_RETVAL(CoCreateGuid(&guid));
-		strguid = guid_to_string(guid);
+	r = get_drv_path(path, drv_path, &cache);
+	if (r != WDI_SUCCESS) {
+		goto out;
 	}
-	static_sprintf(inf_entities[DEVICE_INTERFACE_GUID].replace, "%s", strguid);
 
-	// Resolve the Manufacturer (Vendor Name)
-	if ((options != NULL) && (options->vendor_name != NULL)) {
-		static_strcpy(inf_entities[DEVICE_MANUFACTURER].replace, options->vendor_name);
-	} else {
-		vendor_name = wdi_get_vendor_name(device_info->vid);
-		if (vendor_name == NULL) {
-			vendor_name = "(Undefined Vendor)";
-		}
-		static_strcpy(inf_entities[DEVICE_MANUFACTURER].replace, vendor_name);
+	r = get_driver_type(options, &driver_type);
+	if (r != WDI_SUCCESS) {
+		goto out;
 	}
 
-	// Set the WDF and KMDF versions for WinUSB and libusbK
-	static_sprintf(inf_entities[WDF_VERSION].replace, "%05d", WDF_VER);
-	static_sprintf(inf_entities[KMDF_VERSION].replace, "%d.%d", WDF_VER/1000, WDF_VER%1000);
+	if ((options != NULL) && (options->extract_required_only)) {
+		required_tags = get_required_tags(driver_type);
+	}
 
-	// Extra check, in case somebody modifies our code
-	if ((driver_type < 0) && (driver_type >= WDI_USER)) {
-		wdi_err("Program assertion failed - driver_version[] index out of range");
-		r = WDI_ERROR_OTHER;
+	// For custom drivers, as we cannot autogenerate the infs, simply extract binaries
+	if (driver_type == WDI_USER) {
+		wdi_info("Custom driver - extracting binaries only (no inf/cat creation)");
+		r = extract_binaries(drv_path, (options != NULL) && (options->skip_unchanged), required_tags, &cache);
 		goto out;
 	}
 
-	// Write the date and version data
-	file_time.dwHighDateTime = driver_version[driver_type].dwFileDateMS;
-	file_time.dwLowDateTime = driver_version[driver_type].dwFileDateLS;
-	if ( ((file_time.dwHighDateTime == 0) && (file_time.dwLowDateTime == 0))
-	  || (!FileTimeToLocalFileTime(&file_time, &local_time))
-	  || (!FileTimeToSystemTime(&local_time, &system_time)) ) {
-		GetLocalTime(&system_time);
+	// Validate all the devices before we create anything
+	for (i = 0; i < nb_devices; i++) {
+		if ((inf[i] == NULL) || (get_inf_name(inf[i]) == NULL) || (device_info[i].desc == NULL)) {
+			wdi_err("Invalid inf name or device ID for device #%d - aborting", i);
+			r = WDI_ERROR_INVALID_PARAM;
+			goto out;
+		}
 	}
-	static_sprintf(inf_entities[DRIVER_DATE].replace,
-		"%02d/%02d/%04d", system_time.wMonth, system_time.wDay, system_time.wYear);
-	static_sprintf(inf_entities[DRIVER_VERSION].replace, "%d.%d.%d.%d",
-		(int)driver_version[driver_type].dwFileVersionMS>>16, (int)driver_version[driver_type].dwFileVersionMS&0xFFFF,
-		(int)driver_version[driver_type].dwFileVersionLS>>16, (int)driver_version[driver_type].dwFileVersionLS&0xFFFF);
 
-	// Tokenize the inf
-	if ((options != NULL) && (options->external_inf))
-		inf_file_size = wdi_tokenize_file(inf, &dst, inf_entities, "#", "#", 0);
-	else
-		inf_file_size = wdi_tokenize_resource(inf_template[driver_type], &dst, inf_entities, "#", "#", 0);
-	if (inf_file_size > 0) {
-		fd = fopen_as_userU(inf_path, "w");
-		if (fd == NULL) {
-			wdi_err("Failed to create file: %s", inf_path);
-			r = WDI_ERROR_ACCESS;
+	r = extract_binaries(drv_path, (options != NULL) && (options->skip_unchanged), required_tags, &cache);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+
+	cat_list = (const char**)calloc(CAT_LIST_MAX_ENTRIES + nb_devices, sizeof(char*));
+	cat_path_list = (const char**)calloc(nb_devices, sizeof(char*));
+	hw_id_list = (const char**)calloc(nb_devices, sizeof(char*));
+	cat_paths = calloc(nb_devices, sizeof(*cat_paths));
+	hw_ids = calloc(nb_devices, sizeof(*hw_ids));
+	if ((cat_list == NULL) || (cat_path_list == NULL) || (hw_id_list == NULL) ||
+		(cat_paths == NULL) || (hw_ids == NULL)) {
+		r = WDI_ERROR_RESOURCE;
+		goto out;
+	}
+
+	// The infs all use the same compiled template, and only differ by their token values
+	for (i = 0; i < nb_devices; i++) {
+		r = write_inf(&device_info[i], drv_path, inf[i], cat_name, options, driver_type, cat_paths[i]);
+		if (r != WDI_SUCCESS) {
 			goto out;
 		}
-		// Converting to UTF-16 is the only way to get devices using a
-		// non-English locale to display properly in device manager. UTF-8 will not do.
-		wdst = utf8_to_wchar(dst);
-		if (wdst == NULL) {
-			wdi_err("Could not convert '%s' to UTF-16", dst);
-			safe_free(dst);
+		get_cat_hw_id(hw_ids[i], options, driver_type);
+		hw_id_list[i] = hw_ids[i];
+	}
+
+	if (!IsUserAnAdmin()) {
+		wdi_info("No .cat file generated (missing elevated privileges)");
+		r = WDI_SUCCESS;
+		goto out;
+	}
+	// Try to create and self-sign the cat files to remove security prompts
+	if ((options != NULL) && (options->disable_cat)) {
+		wdi_info(".cat generation disabled by user");
+		r = WDI_SUCCESS;
+		goto out;
+	}
+	wdi_info("Creating and self-signing the .cat files...");
+
+	nb_entries = get_cat_list(driver_type, &dst, cat_list);
+	if (nb_entries < 0) {
+		r = nb_entries;
+		goto out;
+	}
+	test_signing = is_test_signing_enabled();
+
+	if (cat_name != NULL) {
+		// A single cat, that lists all the infs and hardware IDs
+		for (i = 0; i < nb_devices; i++)
+			cat_list[nb_entries + i] = filename(inf[i]);
+		if ( (strlen(drv_path) + strlen(cat_name)) > (MAX_PATH - 2) ) {
+			wdi_err("Qualified path for cat file is too long: '%s\\%s", drv_path, cat_name);
 			r = WDI_ERROR_RESOURCE;
 			goto out;
 		}
-		fwrite(&bom, 2, 1, fd);	// Write the BOM
-		fwrite(wdst, 2, wcslen(wdst), fd);
-		fclose(fd);
-		safe_free(wdst);
-		safe_free(dst);
+		safe_strcpy(cat_path, sizeof(cat_path), drv_path);
+		safe_strcat(cat_path, sizeof(cat_path), "\\");
+		safe_strcat(cat_path, sizeof(cat_path), cat_name);
+		if (!CreateCat(cat_path, hw_id_list, nb_devices, drv_path, cat_list, nb_entries + nb_devices)) {
+			r = cat_failure("Could not create cat file", WDI_ERROR_CAT_MISSING, test_signing);
+			goto out;
+		}
+		cat_path_list[0] = cat_path;
+		nb_cats = 1;
 	} else {
-		wdi_err("Could not tokenize inf file (%d)", inf_file_size);
-		r = WDI_ERROR_ACCESS;
+		// One cat per inf, where only the cats that could be created are signed
+		for (i = 0, nb_cats = 0; i < nb_devices; i++) {
+			cat_list[nb_entries] = filename(inf[i]);
+			if (!CreateCat(cat_paths[i], &hw_id_list[i], 1, drv_path, cat_list, nb_entries + 1)) {
+				r = cat_failure("Could not create cat file", WDI_ERROR_CAT_MISSING, test_signing);
+				if (r != WDI_SUCCESS) {
+					goto out;
+				}
+				continue;
+			}
+			cat_path_list[nb_cats++] = cat_paths[i];
+		}
+	}
+
+	// Creating the certificate is the costly part of signing, so it is only done once
+	static_sprintf(cert_subject, "CN=%s (libwdi autogenerated)", hw_ids[0]);
+	if ((nb_cats != 0) && (options != NULL) && (!options->disable_signing) && (!SelfSignFiles(cat_path_list, nb_cats,
+		(options->cert_subject != NULL)?options->cert_subject:cert_subject))) {
+		r = cat_failure("Could not sign cat files", WDI_ERROR_UNSIGNED, test_signing);
 		goto out;
 	}
-	wdi_info("Successfully created '%s'", inf_path);
+	r = WDI_SUCCESS;
 
-	if (IsUserAnAdmin()) {
-		// Try to create and self-sign the cat file to remove security prompts
-		if ((options != NULL) && (options->disable_cat)) {
-			wdi_info(".cat generation disabled by user");
-			r = WDI_SUCCESS;
-			goto out;
-		}
-		wdi_info("Creating and self-signing a .cat file...");
+out:
+	safe_free(dst);
+	free((void*)cat_list);
+	free((void*)cat_path_list);
+	free((void*)hw_id_list);
+	free(cat_paths);
+	free(hw_ids);
+	free_dir_cache(&cache);
+	CloseHandle(mutex);
+	return r;
+}
 
-		// Tokenize the cat file (for WDF version)
-		if ((cat_file_size = wdi_tokenize_resource(cat_template[driver_type],
-			&dst, inf_entities, "#", "#", 0)) <= 0) {
-			wdi_err("Could not tokenize cat file (%d)", cat_file_size);
-			r = WDI_ERROR_ACCESS;
-			goto out;
+// Send the embedded binary resources that match required_tags to a package sink
+static int sink_binaries(wdi_package_sink sink, void* context, uint32_t required_tags)
+{
+	struct wdi_package_file file;
+	int i, r;
+
+	for (i=0; i<res_count; i++) {
+		// Ignore tokenizer files
+		if ((res_table[i].subdir[0] == 0) || !is_required_resource(&res_table[i], required_tags)) {
+			continue;
+		}
+		file.subdir = res_table[i].subdir;
+		file.name = res_table[i].name;
+		file.size = res_table[i].size;
+		file.creation_time = res_table[i].creation_time;
+		file.data = get_resource_data(&res_table[i]);
+		if (file.data == NULL) {
+			return WDI_ERROR_RESOURCE;
+		}
+		r = sink(context, &file);
+		free_resource_data(&res_table[i], file.data);
+		if (r != 0) {
+			wdi_err("Package sink aborted on '%s\\%s'", file.subdir, file.name);
+			return WDI_ERROR_USER_CANCEL;
 		}
+	}
+	return WDI_SUCCESS;
+}
 
-		// Build the filename list
-		nb_entries = 0;
-		token = strtok(dst, "\n\r");
-		do {
-			// Eliminate leading, trailing spaces & comments (#...)
-			while (isspace(*token)) token++;
-			while (strlen(token) && isspace(token[strlen(token)-1]))
-				token[strlen(token)-1] = 0;
-			if ((*token == '#') || (*token == 0))
-				continue;
-			cat_list[nb_entries++] = token;
-			if (nb_entries >= CAT_LIST_MAX_ENTRIES) {
-				wdi_warn("More than %d cat entries - ignoring the rest", CAT_LIST_MAX_ENTRIES);
-				break;
-			}
-		} while ((token = strtok(NULL, "\n\r")) != NULL);
-
-		// Add the inf name to our list
-		cat_list[nb_entries++] = inf_name;
-
-		// the DEVICE_HARDWARE_ID is either "VID_####&PID_####[&MI_##]" or the MS Compatible ID
-		static_sprintf(hw_id, "USB\\%s", ((options != NULL) && (options->use_wcid_driver))?
-			ms_compat_id[driver_type]:inf_entities[DEVICE_HARDWARE_ID].replace);
-		static_sprintf(cert_subject, "CN=%s (libwdi autogenerated)", hw_id);
-
-		// Check if testsigning is enabled
-		// https://social.msdn.microsoft.com/Forums/Windowsapps/en-US/e6c1be93-7003-4594-b8e4-18ab4a75d273/detecting-testsigning-onoff-via-api
-		PF_INIT(NtQuerySystemInformation, Ntdll);
-		if (pfNtQuerySystemInformation != NULL) {
-			sci.Length = sizeof(sci);
-			if (pfNtQuerySystemInformation((SYSTEM_INFORMATION_CLASS)0x67, &sci, sizeof(sci), &dwcbSz) >= 0 && dwcbSz == sizeof(sci))
-				is_test_signing_enabled = !!(sci.CodeIntegrityOptions & 0x02);
-			wdi_info("Test signing is: %s", is_test_signing_enabled ? "Enabled" : "Disabled");
-		}
-
-		// Failures on the following are fatal on Windows 10 when test signing is not enabled
-		if (!CreateCat(cat_path, hw_id, drv_path, cat_list, nb_entries)) {
-			if (nWindowsVersion >= WINDOWS_10 && !is_test_signing_enabled) {
-				wdi_err("Could not create cat file");
-				return WDI_ERROR_CAT_MISSING;
-			}
-			wdi_warn("Could not create cat file");
-		} else if ((options != NULL) && (!options->disable_signing) && (!SelfSignFile(cat_path,
-			(options->cert_subject != NULL)?options->cert_subject:cert_subject))) {
-			if (nWindowsVersion >= WINDOWS_10 && !is_test_signing_enabled) {
-				wdi_err("Could not sign cat file");
-				return WDI_ERROR_UNSIGNED;
-			}
-			wdi_warn("Could not sign cat file");
+/*
+ * As a cat can only be created and signed from files on disk, create it in a temporary
+ * directory, from the inf in inf_buf and the driver binaries, and send it to the sink.
+ */
+static int sink_cat(const struct inf_buffer* inf_buf, const char* inf_name,
+	struct wdi_options_prepare_driver* options, int driver_type, uint32_t required_tags,
+	wdi_package_sink sink, void* context)
+{
+	struct wdi_package_file file;
+	char tmp_path[MAX_PATH], drv_path[MAX_PATH], inf_path[MAX_PATH], cat_path[MAX_PATH];
+	char* data = NULL;
+	long size;
+	struct dir_cache cache = { { NULL }, 0, 0 };
+	FILE* fd;
+	int r;
+
+	if (GetTempPathU(sizeof(tmp_path), tmp_path) == 0) {
+		wdi_err("Unable to get the temp directory: %s", wdi_windows_error_str(0));
+		return WDI_ERROR_RESOURCE;
+	}
+	static_sprintf(drv_path, "%slibwdi_%08lX_%08lX", tmp_path,
+		(unsigned long)GetCurrentProcessId(), (unsigned long)GetTickCount());
+	if (strlen(drv_path) + strlen(inf_name) + 2 > MAX_PATH) {
+		wdi_err("Qualified path for inf file is too long: '%s\\%s", drv_path, inf_name);
+		return WDI_ERROR_RESOURCE;
+	}
+	r = cached_check_dir(&cache, drv_path);
+	if (r != WDI_SUCCESS) {
+		return r;
+	}
+
+	r = extract_binaries(drv_path, FALSE, required_tags, &cache);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+
+	// The cat must be created from the very same inf as the one in the package
+	static_sprintf(inf_path, "%s\\%s", drv_path, inf_name);
+	fd = fopen_as_userU(inf_path, "wb");
+	if (fd == NULL) {
+		wdi_err("Failed to create file: %s", inf_path);
+		r = WDI_ERROR_ACCESS;
+		goto out;
+	}
+	r = (fwrite(inf_buf->data, 1, inf_buf->size, fd) == inf_buf->size) ? WDI_SUCCESS : WDI_ERROR_IO;
+	if ((fclose(fd) != 0) || (r != WDI_SUCCESS)) {
+		wdi_err("Could not write file '%s'", inf_path);
+		r = WDI_ERROR_IO;
+		goto out;
+	}
+	static_strcpy(cat_path, inf_path);
+	cat_path[safe_strlen(cat_path)-3] = 'c';
+	cat_path[safe_strlen(cat_path)-2] = 'a';
+	cat_path[safe_strlen(cat_path)-1] = 't';
+
+	r = create_cat(drv_path, inf_name, cat_path, options, driver_type);
+	// A non fatal failure to create the cat leaves us without one
+	if ((r != WDI_SUCCESS) || (GetFileAttributesU(cat_path) == INVALID_FILE_ATTRIBUTES)) {
+		goto out;
+	}
+	data = wdi_read_file(cat_path, &size);
+	if (data == NULL) {
+		r = WDI_ERROR_IO;
+		goto out;
+	}
+	file.subdir = ".";
+	file.name = filename(cat_path);
+	file.data = (const unsigned char*)data;
+	file.size = size;
+	file.creation_time = (INT64)time(NULL);
+	if (sink(context, &file) != 0) {
+		wdi_err("Package sink aborted on '%s'", file.name);
+		r = WDI_ERROR_USER_CANCEL;
+	}
+
+out:
+	safe_free(data);
+	free_dir_cache(&cache);
+	SHDeleteDirectoryExU(NULL, drv_path, FOF_SILENT | FOF_NOERRORUI | FOF_NOCONFIRMATION);
+	return r;
+}
+
+// Generate a driver package in memory and send its files to a sink
+int LIBWDI_API wdi_prepare_driver_to_sink(struct wdi_device_info* device_info, const char* inf,
+	struct wdi_options_prepare_driver* options, wdi_package_sink sink, void* context)
+{
+	const char* inf_ext = ".inf";
+	const char* inf_name;
+	struct wdi_package_file file;
+	struct inf_buffer inf_buf = { NULL, 0, 0 };
+	int driver_type = WDI_WINUSB, r = WDI_ERROR_OTHER;
+	uint32_t required_tags = RES_TAG_ARCH_MASK | RES_TAG_DRIVER_MASK;
+
+	// This call uses the same inf entities as wdi_prepare_driver()
+	MUTEX_START_NAMED("wdi_prepare_driver");
+
+	GET_WINDOWS_VERSION;
+
+	if ((device_info == NULL) || (inf == NULL) || (sink == NULL)) {
+		wdi_err("One of the required parameter is NULL");
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
+	}
+
+	inf_name = filename(inf);
+	if ((safe_strlen(inf_name) < 4) || (strcmp(inf_name + safe_strlen(inf_name) - 4, inf_ext) != 0)) {
+		wdi_err("Inf name provided must have a '.inf' extension");
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
+	}
+
+	r = get_driver_type(options, &driver_type);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+
+	if ((options != NULL) && (options->extract_required_only)) {
+		required_tags = get_required_tags(driver_type);
+	}
+
+	// For custom drivers, as we cannot autogenerate the inf, only provide the binaries
+	if (driver_type == WDI_USER) {
+		wdi_info("Custom driver - providing binaries only (no inf creation)");
+		r = sink_binaries(sink, context, required_tags);
+		goto out;
+	}
+
+	if (device_info->desc == NULL) {
+		wdi_err("No device ID was given for the device - aborting");
+		r = WDI_ERROR_INVALID_PARAM;
+		goto out;
+	}
+
+	r = sink_binaries(sink, context, required_tags);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+
+	r = create_inf(device_info, inf, NULL, options, driver_type, inf_buffer_write, &inf_buf);
+	if (r != WDI_SUCCESS) {
+		goto out;
+	}
+	file.subdir = ".";
+	file.name = inf_name;
+	file.data = inf_buf.data;
+	file.size = inf_buf.size;
+	file.creation_time = (INT64)time(NULL);
+	if (sink(context, &file) != 0) {
+		wdi_err("Package sink aborted on '%s'", inf_name);
+		r = WDI_ERROR_USER_CANCEL;
+		goto out;
+	}
+
+	if ((options != NULL) && (options->disable_cat)) {
+		wdi_info(".cat generation disabled by user");
+	} else if (IsUserAnAdmin()) {
+		r = sink_cat(&inf_buf, inf_name, options, driver_type, required_tags, sink, context);
+		if (r != WDI_SUCCESS) {
+			goto out;
 		}
-		safe_free(dst);
 	} else {
 		wdi_info("No .cat file generated (missing elevated privileges)");
 	}
+	wdi_info("Successfully generated driver package for '%s'", inf_name);
 	r = WDI_SUCCESS;
 
 out:
+	safe_free(inf_buf.data);
 	CloseHandle(mutex);
 	return r;
 }
 
+struct zip_sink_context {
+	struct zip_writer* zip;
+	BOOL failed;
+};
+
+static int LIBWDI_API zip_sink(void* context, const struct wdi_package_file* file)
+{
+	struct zip_sink_context* ctx = (struct zip_sink_context*)context;
+	char path[MAX_PATH];
+
+	if (safe_strlen(file->subdir) + safe_strlen(file->name) + 2 > sizeof(path)) {
+		wdi_err("Qualified path is too long: '%s\\%s'", file->subdir, file->name);
+		ctx->failed = TRUE;
+		return -1;
+	}
+	if (strcmp(file->subdir, ".") == 0) {
+		static_strcpy(path, file->name);
+	} else {
+		static_sprintf(path, "%s\\%s", file->subdir, file->name);
+	}
+	if (zip_add(ctx->zip, path, file->data, file->size, file->creation_time) != 0) {
+		wdi_err("Could not add '%s' to the zip archive", path);
+		ctx->failed = TRUE;
+		return -1;
+	}
+	return 0;
+}
+
+// Generate a driver package as a single zip archive, without any intermediate files
+int LIBWDI_API wdi_prepare_driver_to_zip(struct wdi_device_info* device_info, const char* zip_path,
+	const char* inf, struct wdi_options_prepare_driver* options)
+{
+	struct zip_sink_context ctx = { NULL, FALSE };
+	FILE* fd;
+	int r, io_error;
+
+	if (zip_path == NULL) {
+		wdi_err("One of the required parameter is NULL");
+		return WDI_ERROR_INVALID_PARAM;
+	}
+
+	fd = fopen_as_userU(zip_path, "wb");
+	if (fd == NULL) {
+		wdi_err("Could not create file '%s' (%s)", zip_path, wdi_windows_error_str(0));
+		return WDI_ERROR_ACCESS;
+	}
+	ctx.zip = zip_create(fwrite_block, fd,
+		((options != NULL) && (options->zip_store)) ? ZIP_STORE : ZIP_DEFLATE);
+	if (ctx.zip == NULL) {
+		r = WDI_ERROR_RESOURCE;
+		goto out;
+	}
+
+	r = wdi_prepare_driver_to_sink(device_info, inf, options, zip_sink, &ctx);
+	if (ctx.failed) {
+		r = WDI_ERROR_IO;
+	} else if ((r == WDI_SUCCESS) && (zip_finish(ctx.zip) != 0)) {
+		wdi_err("Could not write file '%s'", zip_path);
+		r = WDI_ERROR_IO;
+	}
+
+out:
+	zip_free(ctx.zip);
+	// The archive is only complete once the buffered data has been flushed
+	io_error = ferror(fd);
+	if (((fclose(fd) != 0) || io_error) && (r == WDI_SUCCESS)) {
+		wdi_err("Could not write file '%s'", zip_path);
+		r = WDI_ERROR_IO;
+	}
+	if (r != WDI_SUCCESS) {
+		DeleteFileU(zip_path);
+	} else {
+		wdi_info("Successfully created '%s'", zip_path);
+	}
+	return r;
+}
+
 // Handle messages received from the elevated installer through the pipe
 static int process_message(char* buffer, DWORD size)
 {
@@ -2017,6 +3086,7 @@ int LIBWDI_API wdi_install_trusted_certificate(const char* cert_name,
 	int i, r;
 	HWND hWnd = NULL;
 	BOOL disable_warning = FALSE;
+	const unsigned char* data;
 
 	GET_WINDOWS_VERSION;
 	if (nWindowsVersion < WINDOWS_7) {
@@ -2031,12 +3101,8 @@ int LIBWDI_API wdi_install_trusted_certificate(const char* cert_name,
 	}
 
 	if (IsUserAnAdmin()) {
-		for (i=0; i<nb_resources; i++) {
-			if (safe_strcmp(cert_name, resource[i].name) == 0) {
-				break;
-			}
-		}
-		if (i == nb_resources) {
+		i = find_resource(NULL, cert_name);
+		if (i < 0) {
 			wdi_err("Unable to locate certificate '%s' in embedded resources", cert_name);
 			r = WDI_ERROR_NOT_FOUND;
 			goto out;
@@ -2047,11 +3113,18 @@ int LIBWDI_API wdi_install_trusted_certificate(const char* cert_name,
 			disable_warning = options->disable_warning;
 		}
 
-		if (!AddCertToTrustedPublisher((BYTE*)resource[i].data, (DWORD)resource[i].size, disable_warning, hWnd)) {
+		data = get_resource_data(&res_table[i]);
+		if (data == NULL) {
+			r = WDI_ERROR_RESOURCE;
+			goto out;
+		}
+		if (!AddCertToTrustedPublisher((BYTE*)data, (DWORD)res_table[i].size, disable_warning, hWnd)) {
 			wdi_warn("Could not add certificate '%s' as Trusted Publisher", cert_name);
+			free_resource_data(&res_table[i], data);
 			r = WDI_ERROR_RESOURCE;
 			goto out;
 		}
+		free_resource_data(&res_table[i], data);
 		wdi_info("Certificate '%s' successfully added as Trusted Publisher", cert_name);
 		r = WDI_SUCCESS;
 		goto out;
@@ -203,6 +203,15 @@ struct wdi_options_prepare_driver {
 	BOOL use_wcid_driver;
 	/** Use an externally provided inf file */
 	BOOL external_inf;
+	/** Don't rewrite the driver files that already exist with the same content */
+	BOOL skip_unchanged;
+	/** Only extract the files needed by the driver type on the current platform */
+	BOOL extract_required_only;
+	/** Store the files without compression in the archive of wdi_prepare_driver_to_zip() */
+	BOOL zip_store;
+	/** Name of a single cat file, for all the infs created by wdi_prepare_driver_batch(),
+	  * instead of one cat per inf */
+	char* batch_cat_name;
 };
 
 // wdi_install_driver options:
@@ -223,6 +232,26 @@ struct wdi_options_install_cert {
 	BOOL disable_warning;
 };
 
+// File of a driver package, as provided to a wdi_package_sink
+struct wdi_package_file {
+	/** Subdirectory of the file in the package, with '\' separators ("." for the root) */
+	const char* subdir;
+	/** Name of the file */
+	const char* name;
+	/** Content of the file, which is only valid during the sink call */
+	const unsigned char* data;
+	/** Size of the file */
+	size_t size;
+	/** Creation time of the file, as a Unix time */
+	INT64 creation_time;
+};
+
+/*
+ * Callback receiving the files of a driver package, one at a time
+ * Must return 0 to continue, or non-zero to abort the generation of the package.
+ */
+typedef int (LIBWDI_API *wdi_package_sink)(void* context, const struct wdi_package_file* file);
+
 /*
  * Convert a libwdi error to a human readable error message
  */
@@ -240,6 +269,16 @@ LIBWDI_EXP BOOL LIBWDI_API wdi_is_driver_supported(int driver_type, VS_FIXEDFILE
  */
 LIBWDI_EXP BOOL LIBWDI_API wdi_is_file_embedded(const char* path, const char* name);
 
+/*
+ * Use the resources from a resource pack file (.wdipack) instead of the embedded ones
+ * The pack is mapped in memory, and remains in use until the next call.
+ * path can be NULL, to revert to the embedded resources.
+ * This call is serialized with wdi_prepare_driver() and the other calls that extract
+ * resources, but wdi_is_driver_supported() and wdi_is_file_embedded() are lock-free
+ * and must not be called while a pack is being loaded.
+ */
+LIBWDI_EXP int LIBWDI_API wdi_load_resource_pack(const char* path);
+
 /*
  * Retrieve the full Vendor name from a Vendor ID (VID)
  */
@@ -263,6 +302,30 @@ LIBWDI_EXP int LIBWDI_API wdi_destroy_list(struct wdi_device_info* list);
 LIBWDI_EXP int LIBWDI_API wdi_prepare_driver(struct wdi_device_info* device_info, const char* path,
 								  const char* inf_name, struct wdi_options_prepare_driver* options);
 
+/*
+ * Same as wdi_prepare_driver(), for the nb_devices devices of the device_info array, with
+ * inf_name[i] being the inf of device_info[i]. The driver files are only extracted once,
+ * and the cat files are signed with a single certificate.
+ */
+LIBWDI_EXP int LIBWDI_API wdi_prepare_driver_batch(struct wdi_device_info* device_info, int nb_devices,
+								  const char* path, const char** inf_name, struct wdi_options_prepare_driver* options);
+
+/*
+ * Same as wdi_prepare_driver(), but the files of the driver package are generated in memory
+ * and sent to sink, instead of being written to a directory. As it can only be created and
+ * signed from files on disk, the cat file is generated in a temporary directory, which
+ * requires elevated privileges, as with wdi_prepare_driver().
+ */
+LIBWDI_EXP int LIBWDI_API wdi_prepare_driver_to_sink(struct wdi_device_info* device_info, const char* inf_name,
+								  struct wdi_options_prepare_driver* options, wdi_package_sink sink, void* context);
+
+/*
+ * Same as wdi_prepare_driver_to_sink(), but the driver package is written in a single pass
+ * as a zip archive, where the files are deflated unless the zip_store option is set.
+ */
+LIBWDI_EXP int LIBWDI_API wdi_prepare_driver_to_zip(struct wdi_device_info* device_info, const char* zip_path,
+								  const char* inf_name, struct wdi_options_prepare_driver* options);
+
 /*
  * Install a driver for a specific device
  */
@@ -24,8 +24,10 @@
 #define LOGBUF_SIZE                512
 
 // Prevent two exclusive libwdi calls from running at the same time
-#define MUTEX_START char mutex_name[10+sizeof(__FUNCTION__)]; HANDLE mutex;                \
-	safe_snprintf(mutex_name, 10+sizeof(__FUNCTION__), "Global\\%s", __FUNCTION__);        \
+#define MUTEX_START MUTEX_START_NAMED(__FUNCTION__)
+// Same as above, but using the mutex of the call designated by name (a string literal)
+#define MUTEX_START_NAMED(name) char mutex_name[10+sizeof(name)]; HANDLE mutex;              \
+	safe_snprintf(mutex_name, 10+sizeof(name), "Global\\%s", name);                         \
 	mutex = CreateMutexA(NULL, TRUE, mutex_name);                                          \
 	if (mutex == NULL) return WDI_ERROR_RESOURCE;                                          \
 	if (GetLastError() == ERROR_ALREADY_EXISTS) { CloseHandle(mutex); return WDI_ERROR_BUSY; }
@@ -0,0 +1,147 @@
+/*
+ * Library for USB automated driver installation - resource packs
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Memory leaks detection - define _CRTDBG_MAP_ALLOC as preprocessor macro */
+#ifdef _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include <string.h>
+
+#include "pack.h"
+
+static __inline uint32_t read32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static __inline uint64_t read64(const uint8_t* p)
+{
+	return (uint64_t)read32(p) | ((uint64_t)read32(&p[4]) << 32);
+}
+
+static __inline void write32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static __inline void write64(uint8_t* p, uint64_t v)
+{
+	write32(p, (uint32_t)v);
+	write32(&p[4], (uint32_t)(v >> 32));
+}
+
+// Serialize a pack header into buf, which must be PACK_HEADER_SIZE bytes
+void pack_write_header(uint8_t* buf, uint32_t nb_entries, uint32_t strings_offset,
+	uint32_t strings_size, uint64_t pack_size)
+{
+	memcpy(buf, PACK_MAGIC, 8);
+	write32(&buf[8], PACK_VERSION);
+	write32(&buf[12], nb_entries);
+	write32(&buf[16], strings_offset);
+	write32(&buf[20], strings_size);
+	write64(&buf[24], pack_size);
+}
+
+// Serialize a table of contents entry into buf, which must be PACK_ENTRY_SIZE bytes
+void pack_write_entry(uint8_t* buf, uint32_t name_offset, uint32_t subdir_offset,
+	const struct pack_entry* entry)
+{
+	int i;
+
+	write32(&buf[0], name_offset);
+	write32(&buf[4], subdir_offset);
+	write32(&buf[8], entry->flags);
+	write32(&buf[12], entry->tags);
+	write64(&buf[16], entry->offset);
+	write64(&buf[24], entry->size);
+	write64(&buf[32], entry->compressed_size);
+	write64(&buf[40], (uint64_t)entry->creation_time);
+	for (i = 0; i < PACK_VERSION_INFO_SIZE; i++)
+		write32(&buf[48 + 4 * i], entry->version_info[i]);
+	memcpy(&buf[48 + 4 * PACK_VERSION_INFO_SIZE], entry->hash, PACK_HASH_SIZE);
+	memcpy(&buf[48 + 4 * PACK_VERSION_INFO_SIZE + PACK_HASH_SIZE], entry->content_hash, PACK_HASH_SIZE);
+	write32(&buf[48 + 4 * PACK_VERSION_INFO_SIZE + 2 * PACK_HASH_SIZE], 0);
+}
+
+/*
+ * Validate the header of a pack of size bytes, and return its number of entries.
+ * Returns 0 on success.
+ */
+int pack_open(const uint8_t* pack, size_t size, uint32_t* nb_entries)
+{
+	uint32_t strings_offset, strings_size;
+
+	if ((size < PACK_HEADER_SIZE) || (memcmp(pack, PACK_MAGIC, 8) != 0)
+	  || (read32(&pack[8]) != PACK_VERSION) || (read64(&pack[24]) != (uint64_t)size))
+		return -1;
+	*nb_entries = read32(&pack[12]);
+	if (*nb_entries > (size - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE)
+		return -1;
+	// The string table must come after the table of contents, and be NUL terminated
+	strings_offset = read32(&pack[16]);
+	strings_size = read32(&pack[20]);
+	if ( (strings_offset < PACK_HEADER_SIZE + (size_t)*nb_entries * PACK_ENTRY_SIZE)
+	  || (strings_offset > size) || (strings_size == 0) || (strings_size > size - strings_offset)
+	  || (pack[strings_offset + strings_size - 1] != 0) )
+		return -1;
+	return 0;
+}
+
+/*
+ * Read and validate an entry from a pack that was checked with pack_open().
+ * The name, subdir and data of the entry point into the pack.
+ * Returns 0 on success.
+ */
+int pack_read_entry(const uint8_t* pack, size_t size, uint32_t index, struct pack_entry* entry)
+{
+	const uint8_t* buf = &pack[PACK_HEADER_SIZE + (size_t)index * PACK_ENTRY_SIZE];
+	uint32_t strings_offset = read32(&pack[16]), strings_size = read32(&pack[20]);
+	uint32_t name_offset, subdir_offset;
+	uint64_t stored_size;
+	int i;
+
+	if (index >= read32(&pack[12]))
+		return -1;
+	name_offset = read32(&buf[0]);
+	subdir_offset = read32(&buf[4]);
+	if ((name_offset >= strings_size) || (subdir_offset >= strings_size))
+		return -1;
+	entry->name = (const char*)&pack[strings_offset + name_offset];
+	entry->subdir = (const char*)&pack[strings_offset + subdir_offset];
+	entry->flags = read32(&buf[8]);
+	entry->tags = read32(&buf[12]);
+	entry->offset = read64(&buf[16]);
+	entry->size = read64(&buf[24]);
+	entry->compressed_size = read64(&buf[32]);
+	entry->creation_time = (int64_t)read64(&buf[40]);
+	for (i = 0; i < PACK_VERSION_INFO_SIZE; i++)
+		entry->version_info[i] = read32(&buf[48 + 4 * i]);
+	memcpy(entry->hash, &buf[48 + 4 * PACK_VERSION_INFO_SIZE], PACK_HASH_SIZE);
+	memcpy(entry->content_hash, &buf[48 + 4 * PACK_VERSION_INFO_SIZE + PACK_HASH_SIZE], PACK_HASH_SIZE);
+	stored_size = (entry->compressed_size != 0) ? entry->compressed_size : entry->size;
+	if ((entry->offset > (uint64_t)size) || (stored_size > (uint64_t)size - entry->offset))
+		return -1;
+	entry->data = &pack[entry->offset];
+	return 0;
+}
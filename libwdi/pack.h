@@ -0,0 +1,86 @@
+/*
+ * Library for USB automated driver installation - resource packs
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A resource pack holds all the embedded resources in a single file, that can
+ * be mapped in memory and used as is. This file must remain portable, as it is
+ * also used by the embedder, which runs on the build platform.
+ *
+ * All values are little endian, and a pack is laid out as follows:
+ * - a PACK_HEADER_SIZE header:
+ *     magic[8], version (u32), nb_entries (u32), strings_offset (u32),
+ *     strings_size (u32), pack_size (u64)
+ * - the table of contents, with nb_entries PACK_ENTRY_SIZE entries:
+ *     name (u32), subdir (u32), flags (u32), tags (u32), offset (u64),
+ *     size (u64), compressed_size (u64), creation_time (i64),
+ *     version_info (u32[PACK_VERSION_INFO_SIZE]), hash[PACK_HASH_SIZE],
+ *     content_hash[PACK_HASH_SIZE], reserved (u32)
+ *   where name and subdir are offsets in the string table, and offset is the
+ *   position of the data in the pack, which is aligned to PACK_ALIGNMENT.
+ * - the data of each resource, LZ compressed if compressed_size is not 0.
+ *   Identical resources may share the same data.
+ * - the string table, made of NUL terminated strings.
+ */
+#define PACK_MAGIC              "WDIPACK\x1A"
+#define PACK_VERSION            1
+#define PACK_HEADER_SIZE        32
+#define PACK_ENTRY_SIZE         144
+#define PACK_ALIGNMENT          16
+#define PACK_VERSION_INFO_SIZE  13	// VS_FIXEDFILEINFO
+#define PACK_HASH_SIZE          20
+#define PACK_HAS_VERSION        0x00000001
+
+/*
+ * Resource tags, telling which platforms and drivers need a resource.
+ * A resource with no arch (resp. driver) bits set is needed by all arches (resp. drivers).
+ */
+#define RES_TAG_X86             0x00000001
+#define RES_TAG_X64             0x00000002
+#define RES_TAG_ARM64           0x00000004
+#define RES_TAG_ARCH_MASK       0x000000FF
+#define RES_TAG_WINUSB          0x00000100
+#define RES_TAG_LIBUSB0         0x00000200
+#define RES_TAG_LIBUSBK         0x00000400
+#define RES_TAG_DRIVER_MASK     0x0000FF00
+
+struct pack_entry {
+	const char* name;
+	const char* subdir;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t compressed_size;	// 0 if data is not compressed
+	int64_t creation_time;
+	uint32_t flags;
+	uint32_t tags;
+	uint32_t version_info[PACK_VERSION_INFO_SIZE];
+	uint8_t hash[PACK_HASH_SIZE];			// Authenticode digest for PE files
+	uint8_t content_hash[PACK_HASH_SIZE];	// SHA-1 of the whole data
+	const uint8_t* data;		// only set by pack_read_entry()
+};
+
+void pack_write_header(uint8_t* buf, uint32_t nb_entries, uint32_t strings_offset,
+	uint32_t strings_size, uint64_t pack_size);
+void pack_write_entry(uint8_t* buf, uint32_t name_offset, uint32_t subdir_offset,
+	const struct pack_entry* entry);
+int pack_open(const uint8_t* pack, size_t size, uint32_t* nb_entries);
+int pack_read_entry(const uint8_t* pack, size_t size, uint32_t index, struct pack_entry* entry);
@@ -366,6 +366,7 @@ typedef BOOL (WINAPI *CryptCATAdminCalcHashFromFileHandle_t)(
 extern char *wdi_windows_error_str(uint32_t retval);
 extern int nWindowsVersion;
 extern void GetWindowsVersion(void);
+extern BOOL get_resource_hash(const char* subdir, const char* name, uint64_t size, BYTE* hash);
 
 /*
  * FormatMessage does not handle PKI errors
@@ -929,13 +930,14 @@ out:
 }
 
 /*
- * Digitally sign a file and make it system-trusted by:
+ * Digitally sign a set of files and make them system-trusted by:
  * - creating a self signed certificate for code signing
  * - adding this certificate to both the Root and TrustedPublisher system stores
- * - signing the file provided
+ * - signing each of the files provided
  * - deleting the self signed certificate private key so that it cannot be reused
+ * As creating the certificate is the costly part, it is only done once for all the files.
  */
-BOOL SelfSignFile(LPCSTR szFileName, LPCSTR szCertSubject)
+BOOL SelfSignFiles(LPCSTR* szFileNames, DWORD cFileNames, LPCSTR szCertSubject)
 {
 	PF_DECL_LOAD_LIBRARY(MSSign32);
 	PF_DECL_LOAD_LIBRARY(Crypt32);
@@ -955,6 +957,7 @@ BOOL SelfSignFile(LPCSTR szFileName, LPCSTR szCertSubject)
 	SIGNER_CERT signerCert;
 	SIGNER_SIGNATURE_INFO signerSignatureInfo;
 	PSIGNER_CONTEXT pSignerContext = NULL;
+	DWORD i;
 	CRYPT_ATTRIBUTES_ARRAY cryptAttributesArray;
 	CRYPT_ATTRIBUTE cryptAttribute[2];
 	CRYPT_INTEGER_BLOB oidSpOpusInfoBlob, oidStatementTypeBlob;
@@ -983,12 +986,6 @@ BOOL SelfSignFile(LPCSTR szFileName, LPCSTR szCertSubject)
 
 	// Setup SIGNER_FILE_INFO struct
 	signerFileInfo.cbSize = sizeof(SIGNER_FILE_INFO);
-	wszFileName = UTF8toWCHAR(szFileName);
-	if (wszFileName == NULL) {
-		wdi_warn("Unable to convert '%s' to UTF16", szFileName);
-		goto out;
-	}
-	signerFileInfo.pwszFileName = wszFileName;
 	signerFileInfo.hFile = NULL;
 
 	// Prepare SIGNER_SUBJECT_INFO struct
@@ -1032,14 +1029,27 @@ BOOL SelfSignFile(LPCSTR szFileName, LPCSTR szCertSubject)
 	signerSignatureInfo.psAuthenticated = &cryptAttributesArray;
 	signerSignatureInfo.psUnauthenticated = NULL;
 
-	// Sign file with cert
-	hResult = pfSignerSignEx(0, &signerSubjectInfo, &signerCert, &signerSignatureInfo, NULL, NULL, NULL, NULL, &pSignerContext);
-	if (hResult != S_OK) {
-		wdi_warn("SignerSignEx failed: %s", winpki_error_str(hResult));
-		goto out;
+	// Sign the files with cert
+	for (i = 0; i < cFileNames; i++) {
+		wszFileName = UTF8toWCHAR(szFileNames[i]);
+		if (wszFileName == NULL) {
+			wdi_warn("Unable to convert '%s' to UTF16", szFileNames[i]);
+			goto out;
+		}
+		signerFileInfo.pwszFileName = wszFileName;
+		dwIndex = 0;
+		hResult = pfSignerSignEx(0, &signerSubjectInfo, &signerCert, &signerSignatureInfo, NULL, NULL, NULL, NULL, &pSignerContext);
+		if (hResult != S_OK) {
+			wdi_warn("SignerSignEx failed: %s", winpki_error_str(hResult));
+			goto out;
+		}
+		wdi_info("Successfully signed file '%s'", szFileNames[i]);
+		pfSignerFreeSignerContext(pSignerContext);
+		pSignerContext = NULL;
+		free((void*)wszFileName);
+		wszFileName = NULL;
 	}
 	r = TRUE;
-	wdi_info("Successfully signed file '%s'", szFileName);
 
 	// Clean up
 out:
@@ -1061,6 +1071,14 @@ out:
 	return r;
 }
 
+/*
+ * Digitally sign a single file, with a new self signed certificate
+ */
+BOOL SelfSignFile(LPCSTR szFileName, LPCSTR szCertSubject)
+{
+	return SelfSignFiles(&szFileName, 1, szCertSubject);
+}
+
 /*
  * Opens a file and computes the SHA1 Authenticode Hash
  */
@@ -1247,12 +1265,15 @@ static void ScanDirAndHash(HANDLE hCat, LPCSTR szDirName, LPSTR* szFileList, DWO
 	CHAR szDir[MAX_PATH+1];
 	CHAR szSubDir[MAX_PATH+1];
 	CHAR szEntry[MAX_PATH];
+	CHAR szName[MAX_PATH];
 	CHAR szFilePath[MAX_PATH];
 	WCHAR wszDir[MAX_PATH+1];
 	HANDLE hList;
 	WIN32_FIND_DATAW FileData;
 	DWORD i;
 	BYTE pbHash[SHA1_HASH_LENGTH];
+	uint64_t qwFileSize;
+	BOOL bHashed;
 
 	// Get the proper directory path
 	if ( (strlen(szInitialDir) + strlen(szDirName) + 4) > sizeof(szDir) ) {
@@ -1284,12 +1305,18 @@ static void ScanDirAndHash(HANDLE hCat, LPCSTR szDirName, LPSTR* szFileList, DWO
 				ScanDirAndHash(hCat, szSubDir, szFileList, cFileList);
 			}
 		} else {
+			// Resource lookups are case sensitive
+			static_strcpy(szName, szEntry);
+			_strlwr(szEntry);	// must be lowercase for comparison
 			for (i=0; i<cFileList; i++) {
-				_strlwr(szEntry);	// must be lowercase for comparison
 				if (strcmp(szEntry, szFileList[i]) == 0) {
 					static_sprintf(szFilePath, "%s%s%c%s", szInitialDir, szDirName, '\\', szEntry);
-					// TODO: check return value
-					if ( (CalcHash(pbHash, szFilePath)) && AddFileHash(hCat, szEntry, pbHash) ) {
+					// Files we extracted come with their hash, so we only need to hash the other ones
+					qwFileSize = ((uint64_t)FileData.nFileSizeHigh << 32) | FileData.nFileSizeLow;
+					bHashed = get_resource_hash((szDirName[0] == 0) ? "." : &szDirName[1], szName, qwFileSize, pbHash);
+					if (!bHashed)
+						bHashed = CalcHash(pbHash, szFilePath);
+					if ( bHashed && AddFileHash(hCat, szEntry, pbHash) ) {
 						wdi_info("added hash for '%s'",  szFilePath);
 					} else {
 						wdi_warn("could not add hash for '%s' - ignored", szFilePath);
@@ -1304,10 +1331,11 @@ static void ScanDirAndHash(HANDLE hCat, LPCSTR szDirName, LPSTR* szFileList, DWO
 }
 
 /*
- * Create a cat file for driver package signing, and add any listed matching file found in the
- * szSearchDir directory
+ * Create a cat file for driver package signing, for the cHWIDList hardware IDs of szHWIDList,
+ * and add any listed matching file found in the szSearchDir directory
  */
-BOOL CreateCat(LPCSTR szCatPath, LPCSTR szHWID, LPCSTR szSearchDir, LPCSTR* szFileList, DWORD cFileList)
+BOOL CreateCat(LPCSTR szCatPath, LPCSTR* szHWIDList, DWORD cHWIDList, LPCSTR szSearchDir,
+	LPCSTR* szFileList, DWORD cFileList)
 {
 	PF_DECL_LOAD_LIBRARY(WinTrust);
 	PF_DECL(CryptCATOpen);
@@ -1322,6 +1350,7 @@ BOOL CreateCat(LPCSTR szCatPath, LPCSTR szHWID, LPCSTR szSearchDir, LPCSTR* szFi
 	DWORD i;
 	LPWSTR wszCatPath = NULL;
 	LPWSTR wszHWID = NULL;
+	WCHAR wszHWIDName[16];
 	// From the inf2cat /os parameter - doesn't seem to be used by the OS though...
 	LPCWSTR wszOS = L"7_X86,7_X64,8_X86,8_X64,8_ARM,10_X86,10_X64,10_ARM";
 	LPSTR * szLocalFileList;
@@ -1337,19 +1366,28 @@ BOOL CreateCat(LPCSTR szCatPath, LPCSTR szHWID, LPCSTR szSearchDir, LPCSTR* szFi
 		goto out;
 	}
 	wszCatPath = UTF8toWCHAR(szCatPath);
-	wszHWID = UTF8toWCHAR(szHWID);
-	_wcslwr(wszHWID);	// Most of the cat strings are converted to lowercase
 	hCat= pfCryptCATOpen(wszCatPath, CRYPTCAT_OPEN_CREATENEW, hProv, 0, 0);
 	if (hCat == INVALID_HANDLE_VALUE) {
 		wdi_warn("Unable to create file '%s': %s", szCatPath, winpki_error_str(0));
 		goto out;
 	}
 
-	// Setup the general Cat attributes
-	if (pfCryptCATPutCatAttrInfo(hCat, L"HWID1", CRYPTCAT_ATTR_AUTHENTICATED|CRYPTCAT_ATTR_NAMEASCII|CRYPTCAT_ATTR_DATAASCII,
-		2*((DWORD)wcslen(wszHWID)+1), (BYTE*)wszHWID) ==  NULL) {
-		wdi_warn("Failed to set HWID1 cat attribute: %s", winpki_error_str(0));
-		goto out;
+	// Setup the general Cat attributes, with one HWID# attribute per hardware ID, as inf2cat does
+	for (i=0; i<cHWIDList; i++) {
+		wszHWID = UTF8toWCHAR(szHWIDList[i]);
+		if (wszHWID == NULL) {
+			wdi_warn("Unable to convert '%s' to UTF16", szHWIDList[i]);
+			goto out;
+		}
+		_wcslwr(wszHWID);	// Most of the cat strings are converted to lowercase
+		_snwprintf(wszHWIDName, ARRAYSIZE(wszHWIDName), L"HWID%d", i+1);
+		if (pfCryptCATPutCatAttrInfo(hCat, wszHWIDName, CRYPTCAT_ATTR_AUTHENTICATED|CRYPTCAT_ATTR_NAMEASCII|CRYPTCAT_ATTR_DATAASCII,
+			2*((DWORD)wcslen(wszHWID)+1), (BYTE*)wszHWID) ==  NULL) {
+			wdi_warn("Failed to set HWID%d cat attribute: %s", i+1, winpki_error_str(0));
+			goto out;
+		}
+		free(wszHWID);
+		wszHWID = NULL;
 	}
 	if (pfCryptCATPutCatAttrInfo(hCat, L"OS", CRYPTCAT_ATTR_AUTHENTICATED|CRYPTCAT_ATTR_NAMEASCII|CRYPTCAT_ATTR_DATAASCII,
 		2*((DWORD)wcslen(wszOS)+1), (BYTE*)wszOS) == NULL) {
@@ -36,26 +36,39 @@
 #include "config.h"
 #include "tokenizer.h"
 #include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+// Error codes from winerror.h, so that the values returned are the same on all platforms
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_BAD_ARGUMENTS         160
+#define ERROR_STACK_OVERFLOW        1001
+#define ERROR_CIRCULAR_DEPENDENCY   1059
+#define ERROR_CANCELLED             1223
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#endif
 
 #define safe_min(a, b) min((size_t)(a), (size_t)(b))
 #define safe_strncpy(dst, dst_max, src, count) strncpy(dst, src, safe_min(count, dst_max - 1))
 
-// If the dst buffer is to small it grows to what is needed+GROW_SIZE
+// If the dst buffer is to small it grows to what is needed+GROW_SIZE, or doubles
 #define GetDestSize(RequiredSize) RequiredSize+1024
 
-BOOL grow_strcpy(char** DstPtr, char** DstPtrOrig, long* DstPos, long* DstAllocSize,
+static BOOL grow_strcpy(char** DstPtr, char** DstPtrOrig, long* DstPos, long* DstAllocSize,
 					const char* ReplaceString, long ReplaceLength)
 {
 	if (ReplaceString == NULL)
 		return FALSE;
 	if ((*DstPos)+(ReplaceLength) >= (*DstAllocSize))
 	{
-		void *p;
-		*DstAllocSize = GetDestSize((*DstPos) + ReplaceLength);
-		p = realloc((*DstPtr),(*DstAllocSize));
-		if (p == NULL)
-			free(*DstPtr);
-		*DstPtr = p;
+		// grow geometrically, so that large outputs are not copied over and over
+		*DstAllocSize = max(GetDestSize((*DstPos) + ReplaceLength), 2 * (*DstAllocSize));
+		*DstPtr = realloc((*DstPtr),(*DstAllocSize));
 	}
 	if (!(*DstPtr))
 	{
@@ -69,7 +82,315 @@ BOOL grow_strcpy(char** DstPtr, char** DstPtrOrig, long* DstPos, long* DstAllocS
 	return TRUE;
 }
 
+// In recursive mode, the replace value of an entity is expanded once, the first time
+// its token is found, and reused for all the other occurrences.
+#define EXPANSION_NONE 0
+#define EXPANSION_IN_PROGRESS 1
+#define EXPANSION_DONE 2
+
+typedef struct _token_expansion_t
+{
+	char* value;
+	long length;
+	int state;
+}token_expansion_t;
+
+// Hash table of the match names of a token entity list, built once per list, so that
+// a token can be looked up without going through all the entities. Since the first
+// entity that matches wins, only the first of several entities with the same name is
+// indexed. As a name may contain the suffix, the distinct name lengths are also kept,
+// so that all the names that could end at any suffix of the token are tried.
+typedef struct _token_index_t
+{
+	const token_entity_t* token_entities;
+	long* match_lengths; // length of each entity name
+	long* lengths; // distinct name lengths, in ascending order
+	long length_count;
+	long* table; // entity indexes, or -1 for empty slots
+	unsigned long table_mask;
+	long entity_count;
+	token_expansion_t* expansions; // expanded replace values, in recursive mode only
+}token_index_t;
+
+static unsigned long hash_name(const char* name, long length)
+{
+	unsigned long hash = 2166136261UL;
+	long i;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619UL;
+	return hash;
+}
+
+static void free_token_index(token_index_t* index)
+{
+	long i;
+
+	if (index->expansions)
+	{
+		for (i = 0; i < index->entity_count; i++)
+			free(index->expansions[i].value);
+		free(index->expansions);
+	}
+	free(index->match_lengths);
+	free(index->lengths);
+	free(index->table);
+}
+
+static BOOL build_token_index(token_index_t* index, const token_entity_t* token_entities)
+{
+	unsigned long table_size = 16, slot;
+	long i, j, entity_count;
+
+	memset(index, 0, sizeof(token_index_t));
+	index->token_entities = token_entities;
+	for (entity_count = 0; token_entities[entity_count].match; entity_count++);
+	index->entity_count = entity_count;
+	while (table_size < 2 * (unsigned long)entity_count)
+		table_size <<= 1;
+	index->table_mask = table_size - 1;
+
+	index->match_lengths = malloc((entity_count + 1) * sizeof(long));
+	index->lengths = malloc((entity_count + 1) * sizeof(long));
+	index->table = malloc(table_size * sizeof(long));
+	if (!index->match_lengths || !index->lengths || !index->table)
+	{
+		free_token_index(index);
+		return FALSE;
+	}
+	for (slot = 0; slot < table_size; slot++)
+		index->table[slot] = -1;
+
+	for (i = 0; i < entity_count; i++)
+	{
+		index->match_lengths[i] = (long)strlen(token_entities[i].match);
+
+		// insert the length, if not known yet, while keeping the list sorted
+		for (j = 0; (j < index->length_count) && (index->lengths[j] < index->match_lengths[i]); j++);
+		if ((j == index->length_count) || (index->lengths[j] != index->match_lengths[i]))
+		{
+			memmove(&index->lengths[j + 1], &index->lengths[j], (index->length_count - j) * sizeof(long));
+			index->lengths[j] = index->match_lengths[i];
+			index->length_count++;
+		}
+
+		// insert the name, unless an earlier entity already has it
+		slot = hash_name(token_entities[i].match, index->match_lengths[i]) & index->table_mask;
+		while (index->table[slot] >= 0)
+		{
+			j = index->table[slot];
+			if ( (index->match_lengths[j] == index->match_lengths[i])
+			  && (memcmp(token_entities[j].match, token_entities[i].match, index->match_lengths[i]) == 0) )
+				break;
+			slot = (slot + 1) & index->table_mask;
+		}
+		if (index->table[slot] < 0)
+			index->table[slot] = i;
+	}
+	return TRUE;
+}
+
+// returns the index of the first entity named after the length bytes of name, or -1.
+static long lookup_token(const token_index_t* index, const char* name, long length)
+{
+	unsigned long slot = hash_name(name, length) & index->table_mask;
+	long i;
+
+	while ((i = index->table[slot]) >= 0)
+	{
+		if ( (index->match_lengths[i] == length)
+		  && (memcmp(index->token_entities[i].match, name, length) == 0) )
+			return i;
+		slot = (slot + 1) & index->table_mask;
+	}
+	return -1;
+}
+
+// returns the index of the first entity whose name, followed by the suffix, starts src, or -1.
+static long find_token(const token_index_t* index, const char* src, long src_count,
+					   const char* tok_suffix, long tok_suffix_size)
+{
+	long i, j, match = -1;
+
+	for (i = 0; i < index->length_count; i++)
+	{
+		// the lengths are sorted, so no longer name can fit either
+		if (src_count < (index->lengths[i] + tok_suffix_size))
+			break;
+		if (memcmp(src + index->lengths[i], tok_suffix, tok_suffix_size) != 0)
+			continue;
+		j = lookup_token(index, src, index->lengths[i]);
+		if ((j >= 0) && ((match < 0) || (j < match)))
+			match = j;
+	}
+	return match;
+}
+
+// returns the first token prefix of src that leaves room for a suffix, or NULL.
+static const char* find_prefix(const char* src, long src_count,
+							   const char* tok_prefix, long tok_prefix_size, long tok_suffix_size)
+{
+	const char* match_start = src;
+	const char* last = src + src_count - tok_prefix_size - tok_suffix_size;
+
+	while (match_start <= last)
+	{
+		match_start = memchr(match_start, tok_prefix[0], last - match_start + 1);
+		if (!match_start)
+			break;
+		if (memcmp(match_start, tok_prefix, tok_prefix_size) == 0)
+			return match_start;
+		match_start++;
+	}
+	return NULL;
+}
+
+static long expand_token(const token_index_t* index, long entity, const char* tok_prefix,
+						 const char* tok_suffix, int depth);
+
+// emits the tokenized text of src to a sink, in the order it is produced: the text up to
+// each token prefix, and then either the replace value or, if no token matched, the prefix.
+// In recursive mode, the replace values are emitted expanded.
+// Returns: less than 0 on error, 0 on success.
+static long tokenize_emit(const char* src,
+				   long src_count,
+				   const token_index_t* index,
+				   const char* tok_prefix,
+				   const char* tok_suffix,
+				   token_sink_t sink,
+				   void* sink_context,
+				   int depth)
+{
+	const char* match_start;
+	const char* replace;
+	long match_replace_pos;
+	long tok_prefix_size;
+	long tok_suffix_size;
+	long match_length;
+	long replace_length;
+	long r;
+
+	tok_prefix_size = (long)strlen(tok_prefix);
+	tok_suffix_size = (long)strlen(tok_suffix);
+
+	while(src_count > (tok_prefix_size + tok_suffix_size))
+	{
+		// search for a token prefix
+		match_start = find_prefix(src, src_count, tok_prefix, tok_prefix_size, tok_suffix_size);
+		if (!match_start) break;
+
+		// found a token prefix, emit all the text up to its start
+		match_length = (long)(match_start-src);
+		if ((r = sink(src, match_length, sink_context)) != 0)
+			return (r < 0) ? r : -ERROR_CANCELLED;
+
+		src+=match_length+tok_prefix_size;
+		src_count-=(match_length+tok_prefix_size);
+
+		// look the token up
+		match_replace_pos = find_token(index, src, src_count, tok_suffix, tok_suffix_size);
+		if (match_replace_pos >= 0)
+		{
+			// found a valid token match
+			if (index->expansions)
+			{
+				r = expand_token(index, match_replace_pos, tok_prefix, tok_suffix, depth);
+				if (r < 0)
+					return r;
+				replace = index->expansions[match_replace_pos].value;
+				replace_length = index->expansions[match_replace_pos].length;
+			}
+			else
+			{
+				replace = index->token_entities[match_replace_pos].replace;
+				replace_length = index->token_entities[match_replace_pos].replace_length;
+			}
+			if ((r = sink(replace, replace_length, sink_context)) != 0)
+				return (r < 0) ? r : -ERROR_CANCELLED;
+
+			match_length = index->match_lengths[match_replace_pos];
+			src+=match_length+tok_suffix_size;
+			src_count-=(match_length+tok_suffix_size);
+		}
+		else
+		{
+			// No matches were found; leave it as-is.
+			if ((r = sink(tok_prefix, tok_prefix_size, sink_context)) != 0)
+				return (r < 0) ? r : -ERROR_CANCELLED;
+		}
+	}
+
+	if (src_count > 0)
+	{
+		if ((r = sink(src, src_count, sink_context)) != 0)
+			return (r < 0) ? r : -ERROR_CANCELLED;
+	}
+	return 0;
+}
+
+typedef struct _token_buffer_t
+{
+	char* data;
+	char** dst;
+	long pos;
+	long alloc_size;
+}token_buffer_t;
+
+// sink that appends the tokenized text to a growing buffer.
+static int buffer_sink(const char* data, long size, void* context)
+{
+	token_buffer_t* buffer = (token_buffer_t*)context;
+
+	// on error, grow_strcpy() frees the buffer and sets data to NULL
+	if (!grow_strcpy(&buffer->data, buffer->dst, &buffer->pos, &buffer->alloc_size, data, size))
+		return -ERROR_NOT_ENOUGH_MEMORY;
+	return 0;
+}
+
+// expands the replace value of an entity, found at nesting level depth, unless it has
+// already been expanded. A value that ends up containing its own token is an error.
+// Returns: less than 0 on error, 0 on success.
+static long expand_token(const token_index_t* index, long entity, const char* tok_prefix,
+						 const char* tok_suffix, int depth)
+{
+	token_expansion_t* expansion = &index->expansions[entity];
+	const token_entity_t* token_entity = &index->token_entities[entity];
+	token_buffer_t buffer;
+	char* value;
+	long r;
+
+	if (expansion->state == EXPANSION_DONE)
+		return 0;
+	if (expansion->state == EXPANSION_IN_PROGRESS)
+		return -ERROR_CIRCULAR_DEPENDENCY;
+	if (depth >= TOKENIZE_MAX_DEPTH)
+		return -ERROR_STACK_OVERFLOW;
+	expansion->state = EXPANSION_IN_PROGRESS;
+
+	buffer.pos = 0;
+	buffer.alloc_size = GetDestSize(token_entity->replace_length);
+	buffer.dst = &value;
+	value = buffer.data = malloc(buffer.alloc_size);
+	if (!buffer.data)
+		return -ERROR_NOT_ENOUGH_MEMORY;
+
+	r = tokenize_emit(token_entity->replace, token_entity->replace_length, index, tok_prefix, tok_suffix,
+		buffer_sink, &buffer, depth + 1);
+	if (r < 0)
+	{
+		free(buffer.data);
+		return r;
+	}
+	buffer.data[buffer.pos] = '\0';
+	expansion->value = buffer.data;
+	expansion->length = buffer.pos;
+	expansion->state = EXPANSION_DONE;
+	return 0;
+}
+
 // replaces tokens in text.
+// In recursive mode, tokens found in replace values are replaced too, to any depth up to
+// TOKENIZE_MAX_DEPTH. A token that ends up being part of its own value is an error.
 // Returns: less than 0 on error, 0 if src is empty,
 //          number of chars written to dst on success.
 // NOTE: On success dst must be freed by the calling function.
@@ -81,27 +402,15 @@ long tokenize_string(const char* src, // text to bo tokenized
 				   const char* tok_suffix, // the token suffix example:")"
 				   int recursive) // allows tokenzing tokens in tokens
 {
-	const token_entity_t* next_match;
-	long match_replace_pos;
-	const char* match_start;
-	long tok_prefix_size;
-	long tok_suffix_size;
-	int match_found;
-	long match_length;
-	long replace_length;
-	long dst_pos;
-	long dst_alloc_size;
-	char* pDst;
-	long match_count;
+	token_index_t index;
+	token_buffer_t buffer;
+	long r;
 
 	if (!src || !dst || !token_entities || !src_count || !tok_prefix || !tok_suffix)
 		return -ERROR_BAD_ARGUMENTS;
 
-	tok_prefix_size = (long)strlen(tok_prefix);
-	tok_suffix_size = (long)strlen(tok_suffix);
-
 	// token prefix and suffix markers is required
-	if (!tok_prefix_size || !tok_suffix_size)
+	if (!tok_prefix[0] || !tok_suffix[0])
 		return -ERROR_BAD_ARGUMENTS;
 
 	// if the src buffer count <= 0 assume it is null terminated
@@ -110,116 +419,386 @@ long tokenize_string(const char* src, // text to bo tokenized
 	// nothing to do
 	if (src_count == 0) return 0;
 
+	if (!build_token_index(&index, token_entities))
+		return -ERROR_NOT_ENOUGH_MEMORY;
+	if (recursive)
+	{
+		index.expansions = calloc(index.entity_count + 1, sizeof(token_expansion_t));
+		if (!index.expansions)
+		{
+			free_token_index(&index);
+			return -ERROR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
 	// Set the initial buffer size.
-	dst_alloc_size = GetDestSize(src_count);
-	*dst = pDst = malloc(dst_alloc_size);
-	if (!pDst)
+	buffer.alloc_size = GetDestSize(src_count);
+	buffer.dst = dst;
+	buffer.pos = 0;
+	*dst = buffer.data = malloc(buffer.alloc_size);
+	if (!buffer.data)
+	{
+		free_token_index(&index);
 		return -ERROR_NOT_ENOUGH_MEMORY;
-	dst_pos=0;
+	}
 
-	match_count=0;
+	r = tokenize_emit(src, src_count, &index, tok_prefix, tok_suffix, buffer_sink, &buffer, 0);
+	free_token_index(&index);
+	if (r < 0)
+	{
+		free(buffer.data);
+		*dst = NULL;
+		return r;
+	}
 
-	while(src_count > (tok_prefix_size + tok_suffix_size))
+	// grow_strcpy is aware an extra char is always needed for null.
+	buffer.data[buffer.pos]='\0';
+
+	// return the new size (excluding null)
+	return buffer.pos;
+}
+
+// counts the chars emitted by tokenize_to_sink(), before passing them on.
+typedef struct _token_count_t
+{
+	token_sink_t sink;
+	void* context;
+	long count;
+}token_count_t;
+
+static int count_sink(const char* data, long size, void* context)
+{
+	token_count_t* count = (token_count_t*)context;
+
+	// skip the empty runs, such as the text between two adjacent tokens
+	if (size == 0)
+		return 0;
+	count->count += size;
+	return count->sink(data, size, count->context);
+}
+
+// replaces tokens in text, and emits the result to a sink, in segments, as it is
+// produced, rather than into a buffer. Unlike tokenize_string(), the segments are
+// passed as is, including any NUL they contain, and recursive mode is not supported.
+// Returns: less than 0 on error (including any error returned by the sink),
+//          number of chars emitted on success.
+long tokenize_to_sink(const char* src, // text to be tokenized
+				   long src_count, // length of src
+				   const token_entity_t* token_entities, // match/replace token list
+				   const char* tok_prefix, // the token prefix example:"$("
+				   const char* tok_suffix, // the token suffix example:")"
+				   token_sink_t sink, // callback that receives the output segments
+				   void* sink_context) // context passed to the sink
+{
+	token_index_t index;
+	token_count_t count;
+	long r;
+
+	if (!src || !token_entities || !tok_prefix || !tok_suffix || !sink)
+		return -ERROR_BAD_ARGUMENTS;
+	if (!tok_prefix[0] || !tok_suffix[0])
+		return -ERROR_BAD_ARGUMENTS;
+
+	// if the src buffer count < 0 assume it is null terminated
+	if (src_count < 0) src_count = (long)strlen(src);
+
+	if (!build_token_index(&index, token_entities))
+		return -ERROR_NOT_ENOUGH_MEMORY;
+	count.sink = sink;
+	count.context = sink_context;
+	count.count = 0;
+	r = tokenize_emit(src, src_count, &index, tok_prefix, tok_suffix, count_sink, &count, 0);
+	free_token_index(&index);
+	return (r < 0) ? r : count.count;
+}
+
+typedef struct _token_segment_t
+{
+	long literal_offset; // start of the literal text, in the template text
+	long literal_length;
+	int slot; // index of the token entity that follows the literal, or -1
+}token_segment_t;
+
+struct _token_template_t
+{
+	char* text; // literal text of all the segments
+	token_segment_t* segments;
+	long segment_count;
+	long literal_size;
+};
+
+// Adds a segment, for the literal text that was appended since the previous one.
+static BOOL add_segment(token_template_t* tpl, long* segment_alloc, long text_pos, int slot)
+{
+	token_segment_t* segment;
+	long literal_offset = 0;
+
+	if (tpl->segment_count >= *segment_alloc)
+	{
+		*segment_alloc = (*segment_alloc == 0) ? 64 : 2 * (*segment_alloc);
+		segment = realloc(tpl->segments, (*segment_alloc) * sizeof(token_segment_t));
+		if (!segment)
+			return FALSE;
+		tpl->segments = segment;
+	}
+	if (tpl->segment_count > 0)
+	{
+		segment = &tpl->segments[tpl->segment_count - 1];
+		literal_offset = segment->literal_offset + segment->literal_length;
+	}
+	segment = &tpl->segments[tpl->segment_count++];
+	segment->literal_offset = literal_offset;
+	segment->literal_length = text_pos - literal_offset;
+	segment->slot = slot;
+	return TRUE;
+}
+
+// compiles a template, by looking up its tokens the same way as tokenize_string().
+// Returns: NULL on error.
+// NOTE: The template must be freed with tokenize_free().
+token_template_t* tokenize_compile(const char* src, // text to be compiled
+						 long src_count, // length of src
+						 const token_entity_t* token_entities, // match/replace token list
+						 const char* tok_prefix, // the token prefix example:"$("
+						 const char* tok_suffix) // the token suffix example:")"
+{
+	token_template_t* tpl;
+	const char* match_start;
+	long tok_prefix_size;
+	long tok_suffix_size;
+	long match_length;
+	long text_pos = 0;
+	long segment_alloc = 0;
+	token_index_t index;
+	long i;
+
+	if (!src || !token_entities || !src_count || !tok_prefix || !tok_suffix)
+		return NULL;
+
+	tok_prefix_size = (long)strlen(tok_prefix);
+	tok_suffix_size = (long)strlen(tok_suffix);
+	if (!tok_prefix_size || !tok_suffix_size)
+		return NULL;
+
+	if (src_count < 0) src_count = (long)strlen(src);
+
+	if (!build_token_index(&index, token_entities))
+		return NULL;
+	tpl = calloc(1, sizeof(token_template_t));
+	if (!tpl)
+		goto error;
+	// The literal text can only be smaller than the template
+	tpl->text = malloc(src_count + 1);
+	if (!tpl->text)
+		goto error;
+
+	while (src_count > (tok_prefix_size + tok_suffix_size))
 	{
 		// search for a token prefix
-		match_start = src;
-		while(match_start && strncmp(match_start, tok_prefix, tok_prefix_size) != 0)
-		{
-			match_start++;
-			if ((match_start + tok_prefix_size + tok_suffix_size) > (src+src_count))
-			{
-				match_start = NULL;
-				break;
-			}
-		}
+		match_start = find_prefix(src, src_count, tok_prefix, tok_prefix_size, tok_suffix_size);
 		if (!match_start) break;
 
-		// found a token prefix
-		match_replace_pos=0;
-		match_found=0;
-		match_length = (long)(match_start-src);
+		// the text up to the prefix is literal
+		match_length = (long)(match_start - src);
+		memcpy(&tpl->text[text_pos], src, match_length);
+		text_pos += match_length;
+		src += match_length + tok_prefix_size;
+		src_count -= match_length + tok_prefix_size;
 
-		// copy all the text up to the tok_prefix start from src to dst.
-		if (!grow_strcpy(&pDst, dst, &dst_pos, &dst_alloc_size, src, match_length))
+		// the first entity with a matching name wins
+		i = find_token(&index, src, src_count, tok_suffix, tok_suffix_size);
+		if (i >= 0)
 		{
-			return -ERROR_NOT_ENOUGH_MEMORY;
+			if (!add_segment(tpl, &segment_alloc, text_pos, (int)i))
+				goto error;
+			match_length = index.match_lengths[i];
+			src += match_length + tok_suffix_size;
+			src_count -= match_length + tok_suffix_size;
 		}
+		else
+		{
+			// No matches were found; leave it as-is.
+			memcpy(&tpl->text[text_pos], tok_prefix, tok_prefix_size);
+			text_pos += tok_prefix_size;
+		}
+	}
 
-		src+=match_length+tok_prefix_size;
-		src_count-=(match_length+tok_prefix_size);
+	if (src_count > 0)
+	{
+		memcpy(&tpl->text[text_pos], src, src_count);
+		text_pos += src_count;
+	}
+	if (!add_segment(tpl, &segment_alloc, text_pos, -1))
+		goto error;
+	tpl->literal_size = text_pos;
+	free_token_index(&index);
+	return tpl;
+
+error:
+	free_token_index(&index);
+	tokenize_free(tpl);
+	return NULL;
+}
 
-		// iterate through the match/replace tokens
-		while ((next_match=&token_entities[match_replace_pos++]))
-		{
-			// the match and replace fields must both be set
-			if (!next_match->match || (match_replace_pos == 0 && next_match->replace[0] == 0))
-			{
-				break;
-			}
-			match_length=(long)strlen(next_match->match);
+// renders a compiled template, with the replace values of the entity list it was compiled
+// against, in a single pass and exactly sized allocation.
+// Returns: less than 0 on error, 0 if the template is empty,
+//          number of chars written to dst on success.
+// NOTE: On success dst must be freed by the calling function.
+long tokenize_render(const token_template_t* tpl, // compiled template
+						 char** dst, // destination buffer (must be freed)
+						 const token_entity_t* token_entities) // match/replace token list
+{
+	const token_segment_t* segment;
+	long i, dst_size, replace_length;
+	char* pDst;
 
-			// if this token will be longer than what's left in src buffer, skip it.
-			if (src_count < (match_length+tok_suffix_size))
-				continue; // not found
+	if (!tpl || !dst || !token_entities)
+		return -ERROR_BAD_ARGUMENTS;
 
-			// check for a match suffix
-			if (strncmp(src+match_length,tok_suffix,tok_suffix_size)!=0)
-				continue; // not found
+	dst_size = tpl->literal_size;
+	for (i = 0; i < tpl->segment_count; i++)
+	{
+		if (tpl->segments[i].slot >= 0)
+			dst_size += token_entities[tpl->segments[i].slot].replace_length;
+	}
+	// nothing to do
+	if (dst_size == 0) return 0;
 
-			if (strncmp(src,next_match->match,match_length)==0)
-			{
-				// found a valid token match
-				replace_length=(long)strlen(next_match->replace);
-
-				if (!grow_strcpy(&pDst, dst, &dst_pos, &dst_alloc_size,
-					next_match->replace, replace_length))
-				{
-					return -ERROR_NOT_ENOUGH_MEMORY;
-				}
-
-				src+=match_length+tok_suffix_size;
-				src_count-=(match_length+tok_suffix_size);
-				match_found=1;
-				match_count++;
-				break;
-			}
-		}
-		if (!match_found)
+	*dst = pDst = malloc(dst_size + 1);
+	if (!pDst)
+		return -ERROR_NOT_ENOUGH_MEMORY;
+	for (i = 0; i < tpl->segment_count; i++)
+	{
+		segment = &tpl->segments[i];
+		memcpy(pDst, &tpl->text[segment->literal_offset], segment->literal_length);
+		pDst += segment->literal_length;
+		if (segment->slot >= 0)
 		{
-			// No matches were found; leave it as-is.
-			if (!grow_strcpy(&pDst, dst, &dst_pos, &dst_alloc_size,
-				tok_prefix, tok_prefix_size))
-			{
-				return -ERROR_NOT_ENOUGH_MEMORY;
-			}
+			replace_length = token_entities[segment->slot].replace_length;
+			memcpy(pDst, token_entities[segment->slot].replace, replace_length);
+			pDst += replace_length;
 		}
 	}
+	*pDst = '\0';
+	return dst_size;
+}
+
+// renders a compiled template to a sink, one segment at a time, without building the result.
+// Returns: less than 0 on error (including any error returned by the sink),
+//          number of chars emitted on success.
+long tokenize_render_to_sink(const token_template_t* tpl, // compiled template
+						 const token_entity_t* token_entities, // match/replace token list
+						 token_sink_t sink, // callback that receives the output segments
+						 void* sink_context) // context passed to the sink
+{
+	token_count_t count;
+	const token_segment_t* segment;
+	const token_entity_t* token_entity;
+	long i;
+	int r;
 
-	match_length=src_count;
-	if (match_length > 0)
+	if (!tpl || !token_entities || !sink)
+		return -ERROR_BAD_ARGUMENTS;
+
+	count.sink = sink;
+	count.context = sink_context;
+	count.count = 0;
+	for (i = 0; i < tpl->segment_count; i++)
 	{
-		if (!grow_strcpy(&pDst, dst, &dst_pos, &dst_alloc_size, src, match_length))
+		segment = &tpl->segments[i];
+		if ((r = count_sink(&tpl->text[segment->literal_offset], segment->literal_length, &count)) != 0)
+			return (r < 0) ? r : -ERROR_CANCELLED;
+		if (segment->slot >= 0)
 		{
-			return -ERROR_NOT_ENOUGH_MEMORY;
+			token_entity = &token_entities[segment->slot];
+			if ((r = count_sink(token_entity->replace, token_entity->replace_length, &count)) != 0)
+				return (r < 0) ? r : -ERROR_CANCELLED;
 		}
 	}
-	// grow_strcpy is aware an extra char is always needed for null.
-	pDst[dst_pos]='\0';
+	return count.count;
+}
+
+void tokenize_free(token_template_t* tpl)
+{
+	if (!tpl)
+		return;
+	free(tpl->text);
+	free(tpl->segments);
+	free(tpl);
+}
 
-	if (recursive && match_count)
+// Replace values are copied into blocks of this size, or of their own size if larger
+#define TOKEN_ARENA_BLOCK_SIZE 1024
+
+struct _token_arena_block_t
+{
+	token_arena_block_t* next;
+	long size;
+	long used;
+	// followed by the block data
+};
+
+// sets the replace value of an entity to a copy of value, stored in the arena.
+// Returns: FALSE if the copy could not be allocated, in which case the value is empty.
+BOOL token_set(token_arena_t* arena, token_entity_t* entity, const char* value)
+{
+	token_arena_block_t* block = arena->blocks;
+	long length, size;
+	char* data;
+
+	if (!value)
+		value = "";
+	length = (long)strlen(value);
+	if (!block || (block->size - block->used < length + 1))
 	{
-		// if recursive mode is true, keep re-tokenizing until no matches are found
-		*dst = NULL;
-		dst_pos = tokenize_string(pDst,dst_pos,dst,
-			token_entities,tok_prefix,tok_suffix,recursive);
+		size = max(TOKEN_ARENA_BLOCK_SIZE, length + 1);
+		block = malloc(sizeof(token_arena_block_t) + size);
+		if (!block)
+		{
+			arena->failed = TRUE;
+			entity->replace = "";
+			entity->replace_length = 0;
+			return FALSE;
+		}
+		block->size = size;
+		block->used = 0;
+		if (arena->blocks && (size > TOKEN_ARENA_BLOCK_SIZE))
+		{
+			// an oversized value gets a block of its own, linked behind the head,
+			// so that the head keeps being filled by the values that follow
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		}
+		else
+		{
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+	}
+	data = (char*)(block + 1) + block->used;
+	memcpy(data, value, length + 1);
+	block->used += length + 1;
+	entity->replace = data;
+	entity->replace_length = length;
+	return TRUE;
+}
+
+// frees all the values stored in the arena, which can then be reused.
+void token_arena_free(token_arena_t* arena)
+{
+	token_arena_block_t* block;
 
-		// free the old dst buffer
-		free(pDst);
+	while (arena->blocks)
+	{
+		block = arena->blocks;
+		arena->blocks = block->next;
+		free(block);
 	}
-	// return the new size (excluding null)
-	return dst_pos;
+	arena->failed = FALSE;
 }
 
+#if defined(_WIN32)
 // tokenizes a resource stored in the current module.
 long tokenize_resource(LPCSTR resource_name,
 					 LPCSTR resource_type,
@@ -254,3 +833,4 @@ long tokenize_resource(LPCSTR resource_name,
 		token_entities, tok_prefix, tok_suffix, recursive);
 
 }
+#endif
@@ -20,14 +20,60 @@
 #ifndef _TOKENIZER_H
 #define _TOKENIZER_H
 
+#if defined(_WIN32)
 #include <windows.h>
+#else
+// The tokenizer can also be built on a non Windows host, e.g. for testing
+typedef int BOOL;
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+#endif
 
+/*
+ * The replace value of a token is a view of replace_length chars, followed by a NUL, that
+ * must remain valid for as long as the entity list is used. Values that are built at runtime
+ * can be stored in a token arena, and static strings can be used as is.
+ */
 typedef struct _token_entity_t
 {
 	const char* match;
-	char replace[1024];
+	const char* replace;
+	long replace_length;
 }token_entity_t;
 
+#define token_set_static(entity, value) do { (entity)->replace = (value); \
+	(entity)->replace_length = (long)strlen(value); } while(0)
+
+/*
+ * A token arena holds copies of replace values, in blocks that are never moved or
+ * reallocated, so that the views remain valid until the arena is freed. If a copy
+ * cannot be allocated, the value is set to empty and failed is set.
+ */
+typedef struct _token_arena_block_t token_arena_block_t;
+
+typedef struct _token_arena_t
+{
+	token_arena_block_t* blocks;
+	BOOL failed;
+}token_arena_t;
+
+BOOL token_set(token_arena_t* arena, token_entity_t* entity, const char* value);
+void token_arena_free(token_arena_t* arena);
+
+/*
+ * In recursive mode, the tokens found in a replace value are replaced too, and each value
+ * is only expanded once. Only the tokens that are whole within a value are expanded: a
+ * token that is formed by a value joined with the text around it, such as "#A#" in
+ * "#X#A#" where X is "#", is left as is. A value that contains its own token, directly
+ * or through other values, fails with ERROR_CIRCULAR_DEPENDENCY, and values nested more
+ * than TOKENIZE_MAX_DEPTH (32) levels deep fail with ERROR_STACK_OVERFLOW.
+ */
+#define TOKENIZE_MAX_DEPTH 32
+
 long tokenize_string(const char* src,
 						 long src_count,
 						 char** dst,
@@ -36,6 +82,47 @@ long tokenize_string(const char* src,
 						 const char* tok_suffix,
 						 int recursive);
 
+/*
+ * Sink that receives the output of tokenize_to_sink(), one segment at a time. The data
+ * is not NUL terminated, and is only valid for the duration of the call.
+ * Must return 0 on success, or a negative error code to abort the tokenization.
+ */
+typedef int (*token_sink_t)(const char* data, long size, void* context);
+
+long tokenize_to_sink(const char* src,
+						 long src_count,
+						 const token_entity_t* token_entities,
+						 const char* tok_prefix,
+						 const char* tok_suffix,
+						 token_sink_t sink,
+						 void* sink_context);
+
+/*
+ * A compiled template is a template where the tokens have been resolved once, against
+ * the match names of a token entity list, into a sequence of literal text segments and
+ * slots. It can then be rendered any number of times, with the replace values that the
+ * list holds at render time. Recursive tokenization is not supported.
+ */
+typedef struct _token_template_t token_template_t;
+
+token_template_t* tokenize_compile(const char* src,
+						 long src_count,
+						 const token_entity_t* token_entities,
+						 const char* tok_prefix,
+						 const char* tok_suffix);
+
+long tokenize_render(const token_template_t* tpl,
+						 char** dst,
+						 const token_entity_t* token_entities);
+
+long tokenize_render_to_sink(const token_template_t* tpl,
+						 const token_entity_t* token_entities,
+						 token_sink_t sink,
+						 void* sink_context);
+
+void tokenize_free(token_template_t* tpl);
+
+#if defined(_WIN32)
 long tokenize_resource(LPCSTR resource_name,
 					 LPCSTR resource_type,
 					 char** dst,
@@ -44,3 +131,4 @@ long tokenize_resource(LPCSTR resource_name,
 					 const char* tok_suffix,
 					 int recursive);
 #endif
+#endif
@@ -0,0 +1,177 @@
+/*
+ * Library for USB automated driver installation - UTF-8 to UTF-16LE writer
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Memory leaks detection - define _CRTDBG_MAP_ALLOC as preprocessor macro */
+#ifdef _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include <string.h>
+
+#include "utf16.h"
+
+#define UTF16_REPLACEMENT_CHAR  0xFFFD
+
+static int utf16_flush_block(struct utf16_writer* w)
+{
+	if (w->error)
+		return -1;
+	if (w->pos != 0) {
+		if (w->write(w->block, 2 * w->pos, w->ctx) != 0) {
+			w->error = 1;
+			return -1;
+		}
+		w->pos = 0;
+	}
+	return 0;
+}
+
+static __inline int put_unit(struct utf16_writer* w, uint16_t unit)
+{
+	if ((w->pos == UTF16_BLOCK_SIZE) && (utf16_flush_block(w) != 0))
+		return -1;
+	w->block[2 * w->pos] = (uint8_t)unit;
+	w->block[2 * w->pos + 1] = (uint8_t)(unit >> 8);
+	w->pos++;
+	return 0;
+}
+
+static int put_code_point(struct utf16_writer* w, uint32_t code_point)
+{
+	if (code_point < 0x10000)
+		return put_unit(w, (uint16_t)code_point);
+	code_point -= 0x10000;
+	if (put_unit(w, (uint16_t)(0xD800 | (code_point >> 10))) != 0)
+		return -1;
+	return put_unit(w, (uint16_t)(0xDC00 | (code_point & 0x3FF)));
+}
+
+void utf16_init(struct utf16_writer* w, utf16_write_t write, void* ctx)
+{
+	memset(w, 0, sizeof(struct utf16_writer));
+	w->write = write;
+	w->ctx = ctx;
+	w->lower = 0x80;
+	w->upper = 0xBF;
+}
+
+/*
+ * Convert size bytes of UTF-8 data, and write them out as UTF-16LE whenever the block
+ * is full. A sequence that is split between two calls is completed on the next one.
+ * Returns 0 on success.
+ */
+int utf16_write_utf8(struct utf16_writer* w, const char* data, size_t size)
+{
+	const uint8_t* src = (const uint8_t*)data;
+	size_t i = 0, run;
+	uint8_t b;
+
+	if (w->error)
+		return -1;
+
+	while (i < size) {
+		// ASCII fast path, that widens runs of 7-bit chars straight into the block
+		if (w->bytes_needed == 0) {
+			if (w->pos == UTF16_BLOCK_SIZE) {
+				if (utf16_flush_block(w) != 0)
+					return -1;
+			}
+			run = UTF16_BLOCK_SIZE - w->pos;
+			if (run > size - i)
+				run = size - i;
+			while ((run != 0) && (src[i] < 0x80)) {
+				w->block[2 * w->pos] = src[i++];
+				w->block[2 * w->pos + 1] = 0;
+				w->pos++;
+				run--;
+			}
+			if ((i == size) || (src[i] < 0x80))
+				continue;
+		}
+
+		b = src[i];
+		if (w->bytes_needed == 0) {
+			// Lead byte, with the range of its first continuation byte restricted to
+			// exclude overlong forms, surrogates and code points above U+10FFFF
+			if ((b >= 0xC2) && (b <= 0xDF)) {
+				w->bytes_needed = 1;
+				w->code_point = b & 0x1F;
+			} else if ((b >= 0xE0) && (b <= 0xEF)) {
+				if (b == 0xE0)
+					w->lower = 0xA0;
+				else if (b == 0xED)
+					w->upper = 0x9F;
+				w->bytes_needed = 2;
+				w->code_point = b & 0x0F;
+			} else if ((b >= 0xF0) && (b <= 0xF4)) {
+				if (b == 0xF0)
+					w->lower = 0x90;
+				else if (b == 0xF4)
+					w->upper = 0x8F;
+				w->bytes_needed = 3;
+				w->code_point = b & 0x07;
+			} else if (put_unit(w, UTF16_REPLACEMENT_CHAR) != 0) {
+				return -1;
+			}
+			i++;
+			continue;
+		}
+
+		if ((b < w->lower) || (b > w->upper)) {
+			// Invalid continuation: replace the incomplete sequence, and process the
+			// byte again, as the start of a new one
+			w->bytes_needed = 0;
+			w->bytes_seen = 0;
+			w->lower = 0x80;
+			w->upper = 0xBF;
+			if (put_unit(w, UTF16_REPLACEMENT_CHAR) != 0)
+				return -1;
+			continue;
+		}
+		w->lower = 0x80;
+		w->upper = 0xBF;
+		w->code_point = (w->code_point << 6) | (b & 0x3F);
+		i++;
+		if (++w->bytes_seen == w->bytes_needed) {
+			w->bytes_needed = 0;
+			w->bytes_seen = 0;
+			if (put_code_point(w, w->code_point) != 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write out all the data converted so far, replacing an incomplete sequence at the
+ * end with U+FFFD. Returns 0 on success.
+ */
+int utf16_flush(struct utf16_writer* w)
+{
+	if (w->bytes_needed != 0) {
+		w->bytes_needed = 0;
+		w->bytes_seen = 0;
+		w->lower = 0x80;
+		w->upper = 0xBF;
+		if (put_unit(w, UTF16_REPLACEMENT_CHAR) != 0)
+			return -1;
+	}
+	return utf16_flush_block(w);
+}
@@ -0,0 +1,54 @@
+/*
+ * Library for USB automated driver installation - UTF-8 to UTF-16LE writer
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming UTF-8 to UTF-16LE transcoder, used to write infs straight from the tokenizer.
+ * This file must remain portable, so that it can be built and tested on any platform.
+ *
+ * UTF-8 data can be fed in any number of pieces, which may split a sequence. It is
+ * converted into a fixed block of UTF16_BLOCK_SIZE code units, which is passed to the
+ * write callback whenever it is full, and on utf16_flush(). As with MultiByteToWideChar,
+ * each maximal invalid subsequence is replaced with U+FFFD.
+ */
+#define UTF16_BLOCK_SIZE        4096
+
+// Callback used to write the UTF-16LE data. Must return 0 on success.
+typedef int (*utf16_write_t)(const void* buf, size_t size, void* ctx);
+
+struct utf16_writer {
+	utf16_write_t write;
+	void* ctx;
+	uint8_t block[2 * UTF16_BLOCK_SIZE];
+	size_t pos;
+	// State of an incomplete UTF-8 sequence
+	uint32_t code_point;
+	int bytes_needed;
+	int bytes_seen;
+	uint8_t lower;
+	uint8_t upper;
+	int error;
+};
+
+void utf16_init(struct utf16_writer* w, utf16_write_t write, void* ctx);
+int utf16_write_utf8(struct utf16_writer* w, const char* data, size_t size);
+int utf16_flush(struct utf16_writer* w);
@@ -35,7 +35,12 @@ s
  */\
 \
 #include <stdlib.h>\
+#if defined(_WIN32)\
 #include "libwdi.h"\
+#else\
+// The vendor table can also be built on a non Windows host, e.g. for testing\
+#define LIBWDI_API\
+#endif\
 \
 struct vendor_name \{\
 	unsigned short vid;\
@@ -57,13 +62,20 @@ static struct vendor_name usb_vendor[] = \{|p
 $a\
 \};\
 \
+// usb.ids lists the vendors by increasing VID, so we can use a binary search\
 const char* LIBWDI_API wdi_get_vendor_name(unsigned short vid)\
 \{\
-	int i;\
+	int low = 0, high = sizeof(usb_vendor)/sizeof(usb_vendor[0]) - 1, mid;\
 \
-	for(i=0; i<sizeof(usb_vendor)/sizeof(usb_vendor[0]); i++) \{\
-		if (usb_vendor[i].vid == vid) \{\
-			return usb_vendor[i].name;\
+	while (low <= high) \{\
+		mid = (low + high) / 2;\
+		if (usb_vendor[mid].vid == vid) \{\
+			return usb_vendor[mid].name;\
+		\}\
+		if (usb_vendor[mid].vid < vid) \{\
+			low = mid + 1;\
+		\} else \{\
+			high = mid - 1;\
 		\}\
 	\}\
 	return NULL;\
@@ -0,0 +1,507 @@
+/*
+ * Library for USB automated driver installation - zip archive writer
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* Memory leaks detection - define _CRTDBG_MAP_ALLOC as preprocessor macro */
+#ifdef _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zip.h"
+
+#define ZIP_LOCAL_HEADER_SIG    0x04034b50
+#define ZIP_DESCRIPTOR_SIG      0x08074b50
+#define ZIP_CENTRAL_HEADER_SIG  0x02014b50
+#define ZIP_END_SIG             0x06054b50
+#define ZIP_VERSION             20	// 2.0, for deflate
+#define ZIP_FLAG_DESCRIPTOR     0x0008
+#define ZIP_FLAG_UTF8           0x0800
+#define ZIP_MAX_ENTRIES         0xFFFF
+
+#define DEFLATE_WINDOW_SIZE     (32 * 1024)
+#define DEFLATE_WINDOW_MASK     (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_MIN_MATCH       3
+#define DEFLATE_MAX_MATCH       258
+#define DEFLATE_MAX_CHAIN       32
+#define DEFLATE_HASH_BITS       15
+#define DEFLATE_END_OF_BLOCK    256
+// Worst case for a fixed Huffman block: 9 bits per literal, plus the header and end of block
+#define DEFLATE_OUT_SIZE        (ZIP_BLOCK_SIZE * 9 / 8 + 16)
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+struct zip_entry {
+	char* path;
+	uint32_t crc;
+	uint32_t compressed_size;
+	uint32_t size;
+	uint32_t offset;
+	uint16_t method;
+	uint16_t flags;
+	uint16_t time;
+	uint16_t date;
+};
+
+struct zip_writer {
+	zip_write_t write;
+	void* ctx;
+	int method;
+	uint64_t pos;
+	struct zip_entry* entry;
+	uint32_t nb_entries;
+	uint32_t max_entries;
+	uint32_t crc_table[256];
+	// Deflate encoder: the fixed Huffman codes are stored bit reversed, ready to be output
+	uint16_t lit_code[288];
+	uint8_t lit_bits[288];
+	uint8_t length_code[DEFLATE_MAX_MATCH + 1];
+	uint8_t dist_code[512];
+	uint32_t* head;				// hash chains, with positions + 1 (0 means none)
+	uint32_t* prev;
+	uint8_t* out;
+	size_t out_size;
+	uint32_t bit_buf;
+	int bit_count;
+};
+
+static __inline void write16(uint8_t* p, uint16_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static __inline void write32(uint8_t* p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static uint16_t reverse_bits(uint16_t code, int bits)
+{
+	uint16_t r = 0;
+	int i;
+
+	for (i = 0; i < bits; i++) {
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+static void init_tables(struct zip_writer* zip)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = (uint32_t)i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+		zip->crc_table[i] = c;
+	}
+
+	// Fixed Huffman literal/length codes (RFC 1951, 3.2.6)
+	for (i = 0; i < 288; i++) {
+		if (i < 144) {
+			zip->lit_code[i] = reverse_bits((uint16_t)(0x30 + i), 8);
+			zip->lit_bits[i] = 8;
+		} else if (i < 256) {
+			zip->lit_code[i] = reverse_bits((uint16_t)(0x190 + i - 144), 9);
+			zip->lit_bits[i] = 9;
+		} else if (i < 280) {
+			zip->lit_code[i] = reverse_bits((uint16_t)(i - 256), 7);
+			zip->lit_bits[i] = 7;
+		} else {
+			zip->lit_code[i] = reverse_bits((uint16_t)(0xC0 + i - 280), 8);
+			zip->lit_bits[i] = 8;
+		}
+	}
+	for (i = 0, j = 0; i <= DEFLATE_MAX_MATCH; i++) {
+		if (i < DEFLATE_MIN_MATCH)
+			continue;
+		while ((j < 28) && (i >= length_base[j + 1]))
+			j++;
+		zip->length_code[i] = (uint8_t)j;
+	}
+	// Distances up to 256 are looked up directly, and the other ones by their value / 128
+	for (i = 0, j = 0; i < 256; i++) {
+		while ((j < 29) && (i + 1 >= dist_base[j + 1]))
+			j++;
+		zip->dist_code[i] = (uint8_t)j;
+	}
+	for (i = 256; i < 512; i++) {
+		while ((j < 29) && (((i - 256) << 7) + 1 >= dist_base[j + 1]))
+			j++;
+		zip->dist_code[i] = (uint8_t)j;
+	}
+}
+
+static __inline int get_dist_code(const struct zip_writer* zip, uint32_t dist)
+{
+	return (dist <= 256) ? zip->dist_code[dist - 1] : zip->dist_code[256 + ((dist - 1) >> 7)];
+}
+
+static uint32_t crc32_update(const struct zip_writer* zip, uint32_t crc, const uint8_t* data, size_t size)
+{
+	size_t i;
+
+	crc = ~crc;
+	for (i = 0; i < size; i++)
+		crc = zip->crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static int zip_write(struct zip_writer* zip, const void* buf, size_t size)
+{
+	if (zip->write(buf, size, zip->ctx) != 0)
+		return -1;
+	zip->pos += size;
+	return 0;
+}
+
+static __inline void put_bits(struct zip_writer* zip, uint32_t value, int bits)
+{
+	zip->bit_buf |= value << zip->bit_count;
+	zip->bit_count += bits;
+	while (zip->bit_count >= 8) {
+		zip->out[zip->out_size++] = (uint8_t)zip->bit_buf;
+		zip->bit_buf >>= 8;
+		zip->bit_count -= 8;
+	}
+}
+
+static __inline void put_literal(struct zip_writer* zip, int lit)
+{
+	put_bits(zip, zip->lit_code[lit], zip->lit_bits[lit]);
+}
+
+static void put_match(struct zip_writer* zip, uint32_t len, uint32_t dist)
+{
+	int code = zip->length_code[len];
+
+	put_literal(zip, 257 + code);
+	if (length_extra[code] != 0)
+		put_bits(zip, len - length_base[code], length_extra[code]);
+	code = get_dist_code(zip, dist);
+	put_bits(zip, reverse_bits((uint16_t)code, 5), 5);
+	if (dist_extra[code] != 0)
+		put_bits(zip, dist - dist_base[code], dist_extra[code]);
+}
+
+static __inline uint32_t deflate_hash(const uint8_t* p)
+{
+	return (((uint32_t)p[0] << 10) ^ ((uint32_t)p[1] << 5) ^ p[2]) & ((1 << DEFLATE_HASH_BITS) - 1);
+}
+
+static __inline void insert_hash(struct zip_writer* zip, const uint8_t* data, uint32_t pos)
+{
+	uint32_t h = deflate_hash(&data[pos]);
+
+	zip->prev[pos & DEFLATE_WINDOW_MASK] = zip->head[h];
+	zip->head[h] = pos + 1;
+}
+
+// Encode data[start, end) as symbols, matching against the previous DEFLATE_WINDOW_SIZE bytes
+static void deflate_symbols(struct zip_writer* zip, const uint8_t* data, uint32_t start, uint32_t end)
+{
+	uint32_t pos = start, cand, next, max_len, len, best_len, best_dist;
+	int chain;
+
+	while (pos < end) {
+		best_len = 0;
+		best_dist = 0;
+		if (end - pos >= DEFLATE_MIN_MATCH) {
+			max_len = end - pos;
+			if (max_len > DEFLATE_MAX_MATCH)
+				max_len = DEFLATE_MAX_MATCH;
+			cand = zip->head[deflate_hash(&data[pos])];
+			for (chain = DEFLATE_MAX_CHAIN; (cand != 0) && (chain > 0); chain--) {
+				cand--;
+				if (pos - cand > DEFLATE_WINDOW_SIZE)
+					break;
+				if (data[cand + best_len] == data[pos + best_len]) {
+					for (len = 0; (len < max_len) && (data[cand + len] == data[pos + len]); len++);
+					if (len > best_len) {
+						best_len = len;
+						best_dist = pos - cand;
+						if (len == max_len)
+							break;
+					}
+				}
+				// Older positions always come next, so this terminates on stale entries
+				next = zip->prev[cand & DEFLATE_WINDOW_MASK];
+				if (next > cand)
+					break;
+				cand = next;
+			}
+			insert_hash(zip, data, pos);
+		}
+		if (best_len >= DEFLATE_MIN_MATCH) {
+			put_match(zip, best_len, best_dist);
+			for (len = 1; len < best_len; len++) {
+				if (end - (pos + len) >= DEFLATE_MIN_MATCH)
+					insert_hash(zip, data, pos + len);
+			}
+			pos += best_len;
+		} else {
+			put_literal(zip, data[pos]);
+			pos++;
+		}
+	}
+}
+
+/*
+ * Compress data as a deflate stream, that is written out at the end of each block.
+ * Blocks use the fixed Huffman codes, unless storing them is smaller.
+ */
+static int deflate_data(struct zip_writer* zip, const uint8_t* data, uint32_t size, uint32_t* compressed_size)
+{
+	uint32_t pos = 0, end, bit_buf, fixed_bits, stored_bits;
+	int last, bit_count;
+
+	memset(zip->head, 0, sizeof(uint32_t) << DEFLATE_HASH_BITS);
+	zip->out_size = 0;
+	zip->bit_buf = 0;
+	zip->bit_count = 0;
+	*compressed_size = 0;
+	do {
+		end = (size - pos > ZIP_BLOCK_SIZE) ? pos + ZIP_BLOCK_SIZE : size;
+		last = (end == size);
+		bit_buf = zip->bit_buf;
+		bit_count = zip->bit_count;
+		put_bits(zip, last, 1);
+		put_bits(zip, 1, 2);	// fixed Huffman codes
+		deflate_symbols(zip, data, pos, end);
+		put_literal(zip, DEFLATE_END_OF_BLOCK);
+		fixed_bits = (uint32_t)zip->out_size * 8 + zip->bit_count - bit_count;
+		// A stored block is aligned to the next byte, and has a 32 bit header
+		stored_bits = 3 + ((8 - ((bit_count + 3) & 7)) & 7) + 32 + (end - pos) * 8;
+		if (fixed_bits > stored_bits) {
+			zip->out_size = 0;
+			zip->bit_buf = bit_buf;
+			zip->bit_count = bit_count;
+			put_bits(zip, last, 1);
+			put_bits(zip, 0, 2);
+			if (zip->bit_count != 0)
+				put_bits(zip, 0, 8 - zip->bit_count);
+			put_bits(zip, (end - pos) & 0xFFFF, 16);
+			put_bits(zip, ~(end - pos) & 0xFFFF, 16);
+			memcpy(&zip->out[zip->out_size], &data[pos], end - pos);
+			zip->out_size += end - pos;
+		}
+		if (last && (zip->bit_count != 0))
+			put_bits(zip, 0, 8 - zip->bit_count);
+		if (zip_write(zip, zip->out, zip->out_size) != 0)
+			return -1;
+		*compressed_size += (uint32_t)zip->out_size;
+		zip->out_size = 0;
+		pos = end;
+	} while (!last);
+	return 0;
+}
+
+// Convert a Unix time to the MS-DOS date and time used by zip
+static void unixtime_to_dostime(int64_t mtime, uint16_t* dos_time, uint16_t* dos_date)
+{
+	time_t t = (time_t)mtime;
+	struct tm* tm = localtime(&t);
+
+	if ((tm == NULL) || (tm->tm_year < 80) || (tm->tm_year > 207)) {
+		*dos_time = 0;
+		*dos_date = (1 << 5) | 1;	// 1980.01.01
+		return;
+	}
+	*dos_time = (uint16_t)((tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2));
+	*dos_date = (uint16_t)(((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday);
+}
+
+/*
+ * Create a zip writer, that uses write to output the archive, with method set to
+ * either ZIP_STORE or ZIP_DEFLATE. Returns NULL on error.
+ */
+struct zip_writer* zip_create(zip_write_t write, void* ctx, int method)
+{
+	struct zip_writer* zip;
+
+	if ((write == NULL) || ((method != ZIP_STORE) && (method != ZIP_DEFLATE)))
+		return NULL;
+	zip = calloc(1, sizeof(struct zip_writer));
+	if (zip == NULL)
+		return NULL;
+	zip->write = write;
+	zip->ctx = ctx;
+	zip->method = method;
+	init_tables(zip);
+	if (method == ZIP_DEFLATE) {
+		zip->head = malloc(sizeof(uint32_t) << DEFLATE_HASH_BITS);
+		zip->prev = malloc(sizeof(uint32_t) * DEFLATE_WINDOW_SIZE);
+		zip->out = malloc(DEFLATE_OUT_SIZE);
+		if ((zip->head == NULL) || (zip->prev == NULL) || (zip->out == NULL)) {
+			zip_free(zip);
+			return NULL;
+		}
+	}
+	return zip;
+}
+
+/*
+ * Add a file to the archive. Backslashes in path are converted to the slashes
+ * required by the zip format. mtime is a Unix time. Returns 0 on success.
+ */
+int zip_add(struct zip_writer* zip, const char* path, const uint8_t* data, size_t size, int64_t mtime)
+{
+	uint8_t buf[30];
+	struct zip_entry* entry;
+	size_t i, path_len = strlen(path);
+
+	if ((zip->nb_entries >= ZIP_MAX_ENTRIES) || (path_len == 0) || (path_len > 0xFFFF)
+	  || ((uint64_t)size >= UINT32_MAX) || (zip->pos >= UINT32_MAX))
+		return -1;
+	if (zip->nb_entries >= zip->max_entries) {
+		uint32_t max_entries = (zip->max_entries == 0) ? 64 : 2 * zip->max_entries;
+		entry = realloc(zip->entry, max_entries * sizeof(struct zip_entry));
+		if (entry == NULL)
+			return -1;
+		zip->entry = entry;
+		zip->max_entries = max_entries;
+	}
+	entry = &zip->entry[zip->nb_entries];
+	memset(entry, 0, sizeof(struct zip_entry));
+	entry->path = malloc(path_len + 1);
+	if (entry->path == NULL)
+		return -1;
+	for (i = 0; i <= path_len; i++) {
+		entry->path[i] = (path[i] == '\\') ? '/' : path[i];
+		if ((uint8_t)path[i] >= 0x80)
+			entry->flags |= ZIP_FLAG_UTF8;
+	}
+	zip->nb_entries++;
+
+	entry->method = (uint16_t)zip->method;
+	entry->size = (uint32_t)size;
+	entry->offset = (uint32_t)zip->pos;
+	entry->crc = crc32_update(zip, 0, data, size);
+	unixtime_to_dostime(mtime, &entry->time, &entry->date);
+	if (entry->method == ZIP_DEFLATE) {
+		// The compressed size is only known once the data has been streamed
+		entry->flags |= ZIP_FLAG_DESCRIPTOR;
+	} else {
+		entry->compressed_size = entry->size;
+	}
+
+	write32(&buf[0], ZIP_LOCAL_HEADER_SIG);
+	write16(&buf[4], ZIP_VERSION);
+	write16(&buf[6], entry->flags);
+	write16(&buf[8], entry->method);
+	write16(&buf[10], entry->time);
+	write16(&buf[12], entry->date);
+	write32(&buf[14], (entry->flags & ZIP_FLAG_DESCRIPTOR) ? 0 : entry->crc);
+	write32(&buf[18], entry->compressed_size);
+	write32(&buf[22], (entry->flags & ZIP_FLAG_DESCRIPTOR) ? 0 : entry->size);
+	write16(&buf[26], (uint16_t)path_len);
+	write16(&buf[28], 0);
+	if ((zip_write(zip, buf, 30) != 0) || (zip_write(zip, entry->path, path_len) != 0))
+		return -1;
+
+	if (entry->method == ZIP_DEFLATE) {
+		if (deflate_data(zip, data, entry->size, &entry->compressed_size) != 0)
+			return -1;
+		write32(&buf[0], ZIP_DESCRIPTOR_SIG);
+		write32(&buf[4], entry->crc);
+		write32(&buf[8], entry->compressed_size);
+		write32(&buf[12], entry->size);
+		if (zip_write(zip, buf, 16) != 0)
+			return -1;
+	} else if ((size != 0) && (zip_write(zip, data, size) != 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+// Write the central directory, which completes the archive. Returns 0 on success.
+int zip_finish(struct zip_writer* zip)
+{
+	uint8_t buf[46];
+	uint64_t start = zip->pos;
+	size_t path_len;
+	uint32_t i;
+
+	for (i = 0; i < zip->nb_entries; i++) {
+		path_len = strlen(zip->entry[i].path);
+		write32(&buf[0], ZIP_CENTRAL_HEADER_SIG);
+		write16(&buf[4], ZIP_VERSION);
+		write16(&buf[6], ZIP_VERSION);
+		write16(&buf[8], zip->entry[i].flags);
+		write16(&buf[10], zip->entry[i].method);
+		write16(&buf[12], zip->entry[i].time);
+		write16(&buf[14], zip->entry[i].date);
+		write32(&buf[16], zip->entry[i].crc);
+		write32(&buf[20], zip->entry[i].compressed_size);
+		write32(&buf[24], zip->entry[i].size);
+		write16(&buf[28], (uint16_t)path_len);
+		memset(&buf[30], 0, 12);	// extra, comment, disk, internal and external attributes
+		write32(&buf[42], zip->entry[i].offset);
+		if ((zip_write(zip, buf, 46) != 0) || (zip_write(zip, zip->entry[i].path, path_len) != 0))
+			return -1;
+	}
+	if (zip->pos >= UINT32_MAX)
+		return -1;
+
+	write32(&buf[0], ZIP_END_SIG);
+	write16(&buf[4], 0);
+	write16(&buf[6], 0);
+	write16(&buf[8], (uint16_t)zip->nb_entries);
+	write16(&buf[10], (uint16_t)zip->nb_entries);
+	write32(&buf[12], (uint32_t)(zip->pos - start));
+	write32(&buf[16], (uint32_t)start);
+	write16(&buf[20], 0);
+	return zip_write(zip, buf, 22);
+}
+
+void zip_free(struct zip_writer* zip)
+{
+	uint32_t i;
+
+	if (zip == NULL)
+		return;
+	for (i = 0; i < zip->nb_entries; i++)
+		free(zip->entry[i].path);
+	free(zip->entry);
+	free(zip->head);
+	free(zip->prev);
+	free(zip->out);
+	free(zip);
+}
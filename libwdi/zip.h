@@ -0,0 +1,46 @@
+/*
+ * Library for USB automated driver installation - zip archive writer
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming zip archive writer, used to produce driver packages in a single pass.
+ * This file must remain portable, so that it can be built and tested on any platform.
+ *
+ * The archive is only ever appended to, through a write callback. With ZIP_DEFLATE,
+ * each file is compressed in blocks of ZIP_BLOCK_SIZE, using the fixed Huffman codes
+ * of deflate (or stored blocks, when they are smaller), and its CRC and sizes follow
+ * the data in a data descriptor. Zip64 is not supported, so archives and the files
+ * they contain must be smaller than 4 GB.
+ */
+#define ZIP_STORE               0
+#define ZIP_DEFLATE             8
+#define ZIP_BLOCK_SIZE          (32 * 1024)
+
+// Callback used to write the archive. Must return 0 on success.
+typedef int (*zip_write_t)(const void* buf, size_t size, void* ctx);
+
+struct zip_writer;
+
+struct zip_writer* zip_create(zip_write_t write, void* ctx, int method);
+int zip_add(struct zip_writer* zip, const char* path, const uint8_t* data, size_t size, int64_t mtime);
+int zip_finish(struct zip_writer* zip);
+void zip_free(struct zip_writer* zip);
@@ -0,0 +1,111 @@
+/*
+ * Library for USB automated driver installation - compression benchmarks
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "test.h"
+
+#define BENCH_SIZE		(64 * 1024 * 1024)
+
+// Same as the callback libwdi uses when extracting a resource
+static int fwrite_block(const void* buf, size_t size, void* ctx)
+{
+	return (fwrite(buf, 1, size, (FILE*)ctx) == size) ? 0 : -1;
+}
+
+static void report(const char* name, double t, size_t size)
+{
+	printf("  BENCH  %s: %d MB in %.3fs (%.1f MB/s)\n", name, (int)(size >> 20), t, (size >> 20) / t);
+}
+
+/*
+ * Compare the extraction of a compressed resource, as done by write_resource(),
+ * against the plain write of an uncompressed one, on 64 MB of PE like data.
+ */
+int main(void)
+{
+	uint8_t *src = NULL, *dst = NULL, *out = NULL;
+	size_t dst_size, size;
+	uint32_t seed = 1;
+	FILE* fd = NULL;
+	double t;
+	int r = 1;
+
+	src = malloc(BENCH_SIZE);
+	out = malloc(BENCH_SIZE);
+	dst_size = lz_compress_bound(BENCH_SIZE);
+	dst = malloc(dst_size);
+	fd = tmpfile();
+	if ((src == NULL) || (out == NULL) || (dst == NULL) || (fd == NULL)) {
+		fprintf(stderr, "Could not allocate buffers\n");
+		goto out;
+	}
+	fill_test_data(src, BENCH_SIZE, TEST_DATA_MIXED, &seed);
+
+	t = bench_time();
+	size = lz_compress(src, BENCH_SIZE, dst, dst_size);
+	t = bench_time() - t;
+	if (size == 0) {
+		fprintf(stderr, "Could not compress data\n");
+		goto out;
+	}
+	report("compress", t, BENCH_SIZE);
+	printf("  BENCH  ratio: %.1f%%\n", 100.0 * size / BENCH_SIZE);
+
+	t = bench_time();
+	if (lz_decompress(dst, size, out, BENCH_SIZE) != 0) {
+		fprintf(stderr, "Could not decompress data\n");
+		goto out;
+	}
+	t = bench_time() - t;
+	report("decompress to memory", t, BENCH_SIZE);
+	if (memcmp(src, out, BENCH_SIZE) != 0) {
+		fprintf(stderr, "Decompressed data does not match\n");
+		goto out;
+	}
+
+	t = bench_time();
+	if ((fwrite_block(src, BENCH_SIZE, fd) != 0) || (fflush(fd) != 0)) {
+		fprintf(stderr, "Could not write file\n");
+		goto out;
+	}
+	t = bench_time() - t;
+	report("extract uncompressed", t, BENCH_SIZE);
+
+	rewind(fd);
+	t = bench_time();
+	if ((lz_decompress_stream(dst, size, BENCH_SIZE, fwrite_block, fd) != 0) || (fflush(fd) != 0)) {
+		fprintf(stderr, "Could not decompress to file\n");
+		goto out;
+	}
+	t = bench_time() - t;
+	report("extract compressed", t, BENCH_SIZE);
+	r = 0;
+
+out:
+	if (fd != NULL)
+		fclose(fd);
+	free(src);
+	free(dst);
+	free(out);
+	return r;
+}
@@ -0,0 +1,61 @@
+/*
+ * Library for USB automated driver installation - embedder benchmarks
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define EMBEDDER_NO_MAIN
+#include "embedder.c"
+#include "test.h"
+
+#define BENCH_SIZE		(100 * 1024 * 1024)
+
+// Time the formatting of a 100 MB payload, which is about the size of a full driver set
+int main(void)
+{
+	unsigned char* buffer = malloc(BENCH_SIZE);
+	chunk_t c;
+	size_t i;
+	double t;
+	uint32_t seed = 1;
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Could not allocate buffer\n");
+		return 1;
+	}
+	for (i = 0; i < BENCH_SIZE; i++)
+		buffer[i] = (unsigned char)test_rand(&seed);
+	init_hex_table();
+
+	memset(&c, 0, sizeof(c));
+	t = bench_time();
+	dump_buffer_hex(&c, buffer, BENCH_SIZE);
+	t = bench_time() - t;
+	printf("  BENCH  hex emitter: %d MB in %.3fs (%.1f MB/s), %.1f MB of output\n",
+		BENCH_SIZE >> 20, t, (BENCH_SIZE >> 20) / t, c.size / (1024.0 * 1024.0));
+	free(c.data);
+
+	memset(&c, 0, sizeof(c));
+	t = bench_time();
+	dump_buffer_string(&c, buffer, BENCH_SIZE);
+	t = bench_time() - t;
+	printf("  BENCH  string emitter: %d MB in %.3fs (%.1f MB/s), %.1f MB of output\n",
+		BENCH_SIZE >> 20, t, (BENCH_SIZE >> 20) / t, c.size / (1024.0 * 1024.0));
+	free(c.data);
+
+	free(buffer);
+	return (c.error == 0) ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/*
+ * Library for USB automated driver installation - inf generation benchmark
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "test.h"
+
+// The sources are included, so that their allocations can be counted
+static size_t nb_allocs = 0;
+
+static void* counting_malloc(size_t size)
+{
+	nb_allocs++;
+	return malloc(size);
+}
+
+static void* counting_calloc(size_t count, size_t size)
+{
+	nb_allocs++;
+	return calloc(count, size);
+}
+
+static void* counting_realloc(void* ptr, size_t size)
+{
+	nb_allocs++;
+	return realloc(ptr, size);
+}
+
+#define malloc(size) counting_malloc(size)
+#define calloc(count, size) counting_calloc(count, size)
+#define realloc(ptr, size) counting_realloc(ptr, size)
+#include "tokenizer.c"
+#include "utf16.c"
+#include "inf.c"
+#undef malloc
+#undef calloc
+#undef realloc
+
+#if !defined(TEMPLATE_DIR)
+#define TEMPLATE_DIR "../libwdi"
+#endif
+
+#define NB_DEVICES		100000
+#define MAX_TEMPLATES	16
+
+struct device {
+	char inf_name[24];
+	char desc[48];
+	char guid[40];
+	uint16_t vid;
+	uint16_t pid;
+	uint8_t mi;
+	int is_composite;
+	int is_wcid;
+	const char* vendor_name;
+};
+
+static int count_write(const void* buf, size_t size, void* ctx)
+{
+	(void)buf;
+	*(size_t*)ctx += size;
+	return 0;
+}
+
+static int name_cmp(const void* a, const void* b)
+{
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static char* read_template(const char* name, long* size)
+{
+	char path[512];
+	char* buf = NULL;
+	FILE* fd;
+
+	snprintf(path, sizeof(path), "%s/%s", TEMPLATE_DIR, name);
+	fd = fopen(path, "rb");
+	if (fd == NULL)
+		return NULL;
+	fseek(fd, 0, SEEK_END);
+	*size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	buf = malloc(*size + 1);
+	if ((buf != NULL) && (fread(buf, 1, *size, fd) != (size_t)*size)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fd);
+	return buf;
+}
+
+// Devices as different as the ones libwdi sees: composite, WCID, unknown vendors, non ASCII descriptions
+static void make_devices(struct device* dev)
+{
+	static const char* vendors[] = { "Akeo Consulting", "Microsoft Corporation", "Google Inc.", NULL };
+	uint32_t seed = 1;
+	int i;
+
+	for (i = 0; i < NB_DEVICES; i++) {
+		snprintf(dev[i].inf_name, sizeof(dev[i].inf_name), "device_%06d.inf", i);
+		snprintf(dev[i].desc, sizeof(dev[i].desc), (i % 10 == 0) ?
+			"P\xC3\xA9riph\xC3\xA9rique USB %d" : "Synthetic USB Device %d", i);
+		snprintf(dev[i].guid, sizeof(dev[i].guid), "{%08X-%04X-%04X-%04X-%04X%08X}", test_rand(&seed),
+			test_rand(&seed) & 0xFFFF, test_rand(&seed) & 0xFFFF, test_rand(&seed) & 0xFFFF,
+			test_rand(&seed) & 0xFFFF, test_rand(&seed));
+		dev[i].vid = (uint16_t)test_rand(&seed);
+		dev[i].pid = (uint16_t)test_rand(&seed);
+		dev[i].is_composite = (i % 4 == 0);
+		dev[i].mi = (uint8_t)(i % 8);
+		dev[i].is_wcid = (i % 16 == 0);
+		dev[i].vendor_name = vendors[test_rand(&seed) % (sizeof(vendors) / sizeof(vendors[0]))];
+	}
+}
+
+/*
+ * Generate the inf of 100k devices from every inf template, the way libwdi does: the
+ * template is compiled once, and then, for each device, the token values are set and
+ * the template is rendered as UTF-16. The output is counted but not written.
+ */
+int main(void)
+{
+	char* templates[MAX_TEMPLATES];
+	struct device* dev = NULL;
+	struct inf_params params;
+	token_arena_t arena = { 0 };
+	token_template_t* compiled = NULL;
+	struct dirent* entry;
+	DIR* dir;
+	char* src = NULL;
+	size_t len, output, compile_allocs, set_allocs, render_allocs;
+	double t;
+	long size;
+	int i, j, nb_templates = 0, r = 1;
+
+	dir = opendir(TEMPLATE_DIR);
+	if (dir == NULL) {
+		fprintf(stderr, "Could not open '%s'\n", TEMPLATE_DIR);
+		return 1;
+	}
+	while (((entry = readdir(dir)) != NULL) && (nb_templates < MAX_TEMPLATES)) {
+		len = strlen(entry->d_name);
+		if ((len > 7) && (strcmp(&entry->d_name[len - 7], ".inf.in") == 0))
+			templates[nb_templates++] = strdup(entry->d_name);
+	}
+	closedir(dir);
+	qsort(templates, nb_templates, sizeof(char*), name_cmp);
+
+	dev = malloc(NB_DEVICES * sizeof(struct device));
+	if ((dev == NULL) || (nb_templates == 0)) {
+		fprintf(stderr, "Could not find any inf template\n");
+		goto out;
+	}
+	make_devices(dev);
+
+	memset(&params, 0, sizeof(params));
+	params.wdf_version = 1011;
+	params.year = 2026;
+	params.month = 10;
+	params.day = 7;
+	params.version_ms = (6 << 16) | 1;
+	params.version_ls = (7600 << 16) | 16385;
+
+	for (i = 0; i < nb_templates; i++) {
+		src = read_template(templates[i], &size);
+		if (src == NULL) {
+			fprintf(stderr, "Could not read '%s/%s'\n", TEMPLATE_DIR, templates[i]);
+			goto out;
+		}
+		nb_allocs = 0;
+		compiled = tokenize_compile(src, size, inf_entities, "#", "#");
+		compile_allocs = nb_allocs;
+		if (compiled == NULL) {
+			fprintf(stderr, "Could not compile '%s'\n", templates[i]);
+			goto out;
+		}
+
+		output = 0;
+		set_allocs = 0;
+		render_allocs = 0;
+		t = bench_time();
+		for (j = 0; j < NB_DEVICES; j++) {
+			params.inf_name = dev[j].inf_name;
+			params.desc = dev[j].desc;
+			params.compat_id = dev[j].is_wcid ? "MS_COMP_WINUSB" : NULL;
+			params.vid = dev[j].vid;
+			params.pid = dev[j].pid;
+			params.mi = dev[j].mi;
+			params.is_composite = dev[j].is_composite;
+			params.device_guid = dev[j].guid;
+			params.vendor_name = dev[j].vendor_name;
+			nb_allocs = 0;
+			token_arena_free(&arena);
+			if (inf_set_entities(&arena, inf_entities, &params) != 0)
+				break;
+			set_allocs += nb_allocs;
+			nb_allocs = 0;
+			if (inf_render(compiled, NULL, 0, inf_entities, count_write, &output) <= 0)
+				break;
+			render_allocs += nb_allocs;
+		}
+		t = bench_time() - t;
+		if (j != NB_DEVICES) {
+			fprintf(stderr, "Could not generate the inf of device #%d from '%s'\n", j, templates[i]);
+			goto out;
+		}
+		printf("  BENCH  %s: %d infs in %.3fs (%.0f infs/s, %.1f MB/s), allocations: %d to compile, "
+			"%.2f per device to set the values, %.2f per render\n", templates[i], NB_DEVICES, t,
+			NB_DEVICES / t, output / (1048576.0 * t), (int)compile_allocs, (double)set_allocs / NB_DEVICES,
+			(double)render_allocs / NB_DEVICES);
+		tokenize_free(compiled);
+		compiled = NULL;
+		free(src);
+		src = NULL;
+	}
+	r = 0;
+
+out:
+	tokenize_free(compiled);
+	token_arena_free(&arena);
+	free(src);
+	free(dev);
+	for (i = 0; i < nb_templates; i++)
+		free(templates[i]);
+	return r;
+}
@@ -0,0 +1,120 @@
+/*
+ * Library for USB automated driver installation - batch preparation benchmark
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Unlike the other benchmarks, this one is a Windows program that links with libwdi,
+ * as it measures the whole driver preparation, including the extraction of the files,
+ * and the creation and signing of the cat files.
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libwdi.h"
+#include "test.h"
+
+#define DEFAULT_NB_DEVICES	32
+#define MAX_DEVICES			1000
+
+// Delete a directory that was created by the benchmark, along with its content
+static void remove_dir(const char* path)
+{
+	char pattern[MAX_PATH], file[MAX_PATH];
+	WIN32_FIND_DATAA fd;
+	HANDLE h;
+
+	_snprintf(pattern, sizeof(pattern), "%s\\*", path);
+	h = FindFirstFileA(pattern, &fd);
+	if (h != INVALID_HANDLE_VALUE) {
+		do {
+			if ((strcmp(fd.cFileName, ".") == 0) || (strcmp(fd.cFileName, "..") == 0))
+				continue;
+			_snprintf(file, sizeof(file), "%s\\%s", path, fd.cFileName);
+			if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				remove_dir(file);
+			else
+				DeleteFileA(file);
+		} while (FindNextFileA(h, &fd));
+		FindClose(h);
+	}
+	RemoveDirectoryA(path);
+}
+
+/*
+ * Compare the preparation of the drivers of N devices, through N calls to
+ * wdi_prepare_driver(), against a single call to wdi_prepare_driver_batch().
+ */
+int main(int argc, char** argv)
+{
+	static struct wdi_device_info dev[MAX_DEVICES];
+	static char desc[MAX_DEVICES][32], inf[MAX_DEVICES][32];
+	static const char* inf_name[MAX_DEVICES];
+	struct wdi_options_prepare_driver opd = { 0 };
+	char tmp[MAX_PATH], single_path[MAX_PATH], batch_path[MAX_PATH];
+	double t1, t2;
+	int i, n = DEFAULT_NB_DEVICES, r = WDI_SUCCESS;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if ((n <= 0) || (n > MAX_DEVICES)) {
+		fprintf(stderr, "The number of devices must be between 1 and %d\n", MAX_DEVICES);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		_snprintf(desc[i], sizeof(desc[i]), "Benchmark Device %d", i);
+		_snprintf(inf[i], sizeof(inf[i]), "bench_device_%04d.inf", i);
+		dev[i].vid = 0x1234;
+		dev[i].pid = (unsigned short)(0x1000 + i);
+		dev[i].desc = desc[i];
+		inf_name[i] = inf[i];
+	}
+	opd.driver_type = WDI_WINUSB;
+	wdi_set_log_level(WDI_LOG_LEVEL_ERROR);
+
+	GetTempPathA(sizeof(tmp), tmp);
+	_snprintf(single_path, sizeof(single_path), "%swdi_bench_single_%lu", tmp, GetCurrentProcessId());
+	_snprintf(batch_path, sizeof(batch_path), "%swdi_bench_batch_%lu", tmp, GetCurrentProcessId());
+
+	t1 = bench_time();
+	for (i = 0; (i < n) && (r == WDI_SUCCESS); i++)
+		r = wdi_prepare_driver(&dev[i], single_path, inf_name[i], &opd);
+	t1 = bench_time() - t1;
+	if (r != WDI_SUCCESS) {
+		fprintf(stderr, "wdi_prepare_driver failed: %s\n", wdi_strerror(r));
+		goto out;
+	}
+
+	t2 = bench_time();
+	r = wdi_prepare_driver_batch(dev, n, batch_path, inf_name, &opd);
+	t2 = bench_time() - t2;
+	if (r != WDI_SUCCESS) {
+		fprintf(stderr, "wdi_prepare_driver_batch failed: %s\n", wdi_strerror(r));
+		goto out;
+	}
+
+	printf("  BENCH  prepare %d devices: %d calls %.3fs (%.1f ms/device), batch %.3fs (%.1f ms/device), x%.1f\n",
+		n, n, t1, 1000.0 * t1 / n, t2, 1000.0 * t2 / n, t1 / t2);
+
+out:
+	remove_dir(single_path);
+	remove_dir(batch_path);
+	return (r == WDI_SUCCESS) ? 0 : 1;
+}
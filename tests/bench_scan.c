@@ -0,0 +1,151 @@
+/*
+ * Library for USB automated driver installation - user directory scan benchmark
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <config.h>
+#if !defined(USER_DIR)
+// The scanning code is only compiled for USER_DIR, but the benchmark sets its own directory
+#define USER_DIR "."
+#endif
+#define EMBEDDER_NO_MAIN
+#include "embedder.c"
+#include "test.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#define bench_mkdir(path)	_mkdir(path)
+#define bench_rmdir(path)	_rmdir(path)
+#else
+#define bench_mkdir(path)	mkdir(path, 0755)
+#define bench_rmdir(path)	rmdir(path)
+#endif
+
+// 50k files, spread over two levels of directories, as found in a large custom driver set
+#define NB_DIRS				25
+#define NB_SUBDIRS			20
+#define NB_FILES			100
+#define NB_RUNS				5
+
+// Create (or delete, if remove is set) the synthetic tree. Returns 0 on success.
+static int make_tree(const char* root, int remove)
+{
+	char path[MAX_PATH];
+	int i, j, k, r = 0;
+	FILE* fd;
+
+	for (i = 0; i < NB_DIRS; i++) {
+		snprintf(path, sizeof(path), "%s%cdir%02d", root, NATIVE_SEPARATOR, i);
+		if (!remove && (bench_mkdir(path) != 0))
+			return 1;
+		for (j = 0; j < NB_SUBDIRS; j++) {
+			snprintf(path, sizeof(path), "%s%cdir%02d%csub%02d", root, NATIVE_SEPARATOR, i, NATIVE_SEPARATOR, j);
+			if (!remove && (bench_mkdir(path) != 0))
+				return 1;
+			for (k = 0; k < NB_FILES; k++) {
+				snprintf(path, sizeof(path), "%s%cdir%02d%csub%02d%cfile%03d.dll", root,
+					NATIVE_SEPARATOR, i, NATIVE_SEPARATOR, j, NATIVE_SEPARATOR, k);
+				if (remove) {
+					NATIVE_UNLINK(path);
+					continue;
+				}
+				fd = fopen(path, "wb");
+				if (fd == NULL)
+					return 1;
+				fclose(fd);
+			}
+			if (remove) {
+				snprintf(path, sizeof(path), "%s%cdir%02d%csub%02d", root, NATIVE_SEPARATOR, i, NATIVE_SEPARATOR, j);
+				r |= bench_rmdir(path);
+			}
+		}
+		if (remove) {
+			snprintf(path, sizeof(path), "%s%cdir%02d", root, NATIVE_SEPARATOR, i);
+			r |= bench_rmdir(path);
+		}
+	}
+	return r;
+}
+
+// Same as add_user_files(), minus the merging with the fixed files
+static int scan_user_files(void)
+{
+	int i, r = 1;
+#if defined(_WIN32)
+	r = scan_dir("");
+#else
+	DIR* dp = opendir(initial_dir);
+
+	if (dp != NULL) {
+		r = scan_dir(dp, "");
+		closedir(dp);
+	}
+#endif
+	if (r == 0)
+		qsort(user_files.entry, user_files.nb_entries, sizeof(struct emb), user_file_cmp);
+	r = user_files.nb_entries;
+	for (i = 0; i < user_files.nb_entries; i++) {
+		safe_free(user_files.entry[i].file_name);
+		safe_free(user_files.entry[i].extraction_subdir);
+	}
+	safe_free(user_files.entry);
+	user_files.nb_entries = 0;
+	user_files.max_entries = 0;
+	return r;
+}
+
+int main(void)
+{
+	char root[MAX_PATH];
+	const char* tmp = getenv("TMPDIR");
+	double t, best = 1.0e9;
+	int i, n, r = 1;
+
+	snprintf(root, sizeof(root), "%s%cwdi_bench_scan_%d", (tmp != NULL) ? tmp :
+#if defined(_WIN32)
+		".",
+#else
+		"/tmp",
+#endif
+		NATIVE_SEPARATOR, (int)time(NULL));
+	if ((bench_mkdir(root) != 0) || (make_tree(root, 0) != 0)) {
+		fprintf(stderr, "Could not create '%s'\n", root);
+		goto out;
+	}
+	get_full_path(root, initial_dir, sizeof(initial_dir));
+
+	// The first run populates the directory cache, so we report the best of the runs
+	for (i = 0; i < NB_RUNS; i++) {
+		t = bench_time();
+		n = scan_user_files();
+		t = bench_time() - t;
+		if (n != NB_DIRS * NB_SUBDIRS * NB_FILES) {
+			fprintf(stderr, "Found %d files instead of %d\n", n, NB_DIRS * NB_SUBDIRS * NB_FILES);
+			goto out;
+		}
+		if (t < best)
+			best = t;
+	}
+	printf("  BENCH  scan_dir: %d files in %d directories in %.3fs (%.0f files/s)\n",
+		n, NB_DIRS * (NB_SUBDIRS + 1), best, n / best);
+	r = 0;
+
+out:
+	make_tree(root, 1);
+	bench_rmdir(root);
+	return r;
+}
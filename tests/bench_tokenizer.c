@@ -0,0 +1,135 @@
+/*
+ * Library for USB automated driver installation - tokenizer benchmark
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inf.h"
+#include "test.h"
+
+#if !defined(TEMPLATE_DIR)
+#define TEMPLATE_DIR "../libwdi"
+#endif
+
+#define NB_RENDERS		20000
+
+static const char* templates[] = { "winusb.inf.in", "libusb0.inf.in", "libusbk.inf.in", "usbser.inf.in" };
+
+static char* read_template(const char* name, long* size)
+{
+	char path[512];
+	char* buf = NULL;
+	FILE* fd;
+
+	snprintf(path, sizeof(path), "%s/%s", TEMPLATE_DIR, name);
+	fd = fopen(path, "rb");
+	if (fd == NULL)
+		return NULL;
+	fseek(fd, 0, SEEK_END);
+	*size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	buf = calloc(*size + 1, 1);
+	if ((buf != NULL) && (fread(buf, 1, *size, fd) != (size_t)*size)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fd);
+	return buf;
+}
+
+/*
+ * Compare the generation of an inf, as done before, where the template is parsed for
+ * every driver, against a template compiled once and then rendered for every driver.
+ */
+int main(void)
+{
+	struct inf_params params;
+	token_arena_t arena = { 0 };
+	token_template_t* compiled = NULL;
+	char *src = NULL, *dst1 = NULL, *dst2 = NULL;
+	double t1, t2;
+	long size, len1 = 0, len2 = 0;
+	size_t i;
+	int n, r = 1;
+
+	memset(&params, 0, sizeof(params));
+	params.inf_name = "usb_device.inf";
+	params.desc = "Test Device";
+	params.vid = 0x1234;
+	params.pid = 0xABCD;
+	params.device_guid = "{01234567-89AB-CDEF-0123-456789ABCDEF}";
+	params.vendor_name = "Akeo Consulting";
+	params.wdf_version = 1011;
+	params.year = 2026;
+	params.month = 10;
+	params.day = 7;
+	if (inf_set_entities(&arena, inf_entities, &params) != 0) {
+		fprintf(stderr, "Could not set the token values\n");
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(templates) / sizeof(templates[0]); i++) {
+		src = read_template(templates[i], &size);
+		if (src == NULL) {
+			fprintf(stderr, "Could not read '%s/%s'\n", TEMPLATE_DIR, templates[i]);
+			goto out;
+		}
+
+		t1 = bench_time();
+		for (n = 0; n < NB_RENDERS; n++) {
+			free(dst1);
+			len1 = tokenize_string(src, size, &dst1, inf_entities, "#", "#", 0);
+			if (len1 <= 0)
+				break;
+		}
+		t1 = bench_time() - t1;
+
+		t2 = bench_time();
+		compiled = tokenize_compile(src, size, inf_entities, "#", "#");
+		for (n = 0; (compiled != NULL) && (n < NB_RENDERS); n++) {
+			free(dst2);
+			len2 = tokenize_render(compiled, &dst2, inf_entities);
+			if (len2 <= 0)
+				break;
+		}
+		t2 = bench_time() - t2;
+
+		if ((len1 <= 0) || (len2 != len1) || (memcmp(dst1, dst2, len1) != 0)) {
+			fprintf(stderr, "Output for '%s' does not match\n", templates[i]);
+			goto out;
+		}
+		printf("  BENCH  %s: tokenize_string %.2f us, compile+render %.2f us per inf (x%.1f)\n",
+			templates[i], 1e6 * t1 / NB_RENDERS, 1e6 * t2 / NB_RENDERS, t1 / t2);
+
+		tokenize_free(compiled);
+		compiled = NULL;
+		free(src);
+		src = NULL;
+	}
+	r = 0;
+
+out:
+	tokenize_free(compiled);
+	token_arena_free(&arena);
+	free(src);
+	free(dst1);
+	free(dst2);
+	return r;
+}
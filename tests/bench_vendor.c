@@ -0,0 +1,100 @@
+/*
+ * Library for USB automated driver installation - vendor name lookup benchmark
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+// The table is included, so that the lookup can be compared against a scan of it
+#include "vid_data.c"
+#include "test.h"
+
+// The lookup, as it was before the binary search
+static const char* linear_vendor_name(unsigned short vid)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(usb_vendor) / sizeof(usb_vendor[0]); i++) {
+		if (usb_vendor[i].vid == vid)
+			return usb_vendor[i].name;
+	}
+	return NULL;
+}
+
+// Returns the time per lookup, in ns
+static double time_lookups(const char* (*lookup)(unsigned short), const unsigned short* vids,
+	size_t nb_vids, int nb_runs, size_t* nb_found)
+{
+	double t = bench_time();
+	size_t i, found = 0;
+	int n;
+
+	for (n = 0; n < nb_runs; n++) {
+		for (i = 0; i < nb_vids; i++)
+			found += (lookup(vids[i]) != NULL);
+	}
+	t = bench_time() - t;
+	*nb_found = found / nb_runs;
+	return 1e9 * t / ((double)nb_runs * nb_vids);
+}
+
+static void report(const char* name, double t1, double t2)
+{
+	printf("  BENCH  wdi_get_vendor_name, %s: %.1f ns per lookup, against %.1f ns for a scan (x%.0f)\n",
+		name, t2, t1, t1 / t2);
+}
+
+/*
+ * Time the lookup of every possible VID, and of the VIDs of the table only, which is
+ * the common case of a real device, and check that the results match a linear scan.
+ */
+int main(void)
+{
+	static unsigned short all_vids[65536];
+	static unsigned short known_vids[sizeof(usb_vendor) / sizeof(usb_vendor[0])];
+	size_t i, j, nb_known = sizeof(usb_vendor) / sizeof(usb_vendor[0]), found1, found2;
+	uint32_t seed = 1;
+	unsigned short tmp;
+	double t1, t2;
+
+	for (i = 0; i < 65536; i++) {
+		all_vids[i] = (unsigned short)i;
+		if (wdi_get_vendor_name((unsigned short)i) != linear_vendor_name((unsigned short)i)) {
+			fprintf(stderr, "Lookup of VID %04X does not match\n", (unsigned)i);
+			return 1;
+		}
+	}
+	// Look the known VIDs up in random order, so that the branches cannot be predicted
+	for (i = 0; i < nb_known; i++)
+		known_vids[i] = usb_vendor[i].vid;
+	for (i = nb_known - 1; i > 0; i--) {
+		j = test_rand(&seed) % (i + 1);
+		tmp = known_vids[i];
+		known_vids[i] = known_vids[j];
+		known_vids[j] = tmp;
+	}
+
+	t1 = time_lookups(linear_vendor_name, all_vids, 65536, 5, &found1);
+	t2 = time_lookups(wdi_get_vendor_name, all_vids, 65536, 500, &found2);
+	if (found1 != found2)
+		return 1;
+	report("all VIDs", t1, t2);
+	t1 = time_lookups(linear_vendor_name, known_vids, nb_known, 50, &found1);
+	t2 = time_lookups(wdi_get_vendor_name, known_vids, nb_known, 5000, &found2);
+	if ((found1 != nb_known) || (found2 != nb_known))
+		return 1;
+	report("known VIDs", t1, t2);
+	return 0;
+}
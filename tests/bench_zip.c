@@ -0,0 +1,85 @@
+/*
+ * Library for USB automated driver installation - zip writer benchmarks
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zip.h"
+#include "test.h"
+
+// A driver package is a few large DLLs/SYS and a handful of small files
+#define BENCH_FILE_SIZE		(4 * 1024 * 1024)
+#define BENCH_NB_FILES		16
+
+// Count the output, without any I/O, so that only the writer is timed
+static int count_write(const void* buf, size_t size, void* ctx)
+{
+	(void)buf;
+	*(size_t*)ctx += size;
+	return 0;
+}
+
+int main(void)
+{
+	const int methods[] = { ZIP_STORE, ZIP_DEFLATE };
+	const char* names[] = { "store", "deflate" };
+	const int types[] = { TEST_DATA_MIXED, TEST_DATA_TEXT, TEST_DATA_RANDOM };
+	const char* type_names[] = { "PE like", "text", "random" };
+	struct zip_writer* zip;
+	uint8_t* data = malloc(BENCH_FILE_SIZE);
+	size_t total, size = (size_t)BENCH_FILE_SIZE * BENCH_NB_FILES;
+	uint32_t seed = 1;
+	double t;
+	char path[32];
+	int i, m, d, r = 1;
+
+	if (data == NULL) {
+		fprintf(stderr, "Could not allocate buffer\n");
+		return 1;
+	}
+	for (d = 0; d < 3; d++) {
+		fill_test_data(data, BENCH_FILE_SIZE, types[d], &seed);
+		for (m = 0; m < 2; m++) {
+			total = 0;
+			zip = zip_create(count_write, &total, methods[m]);
+			if (zip == NULL)
+				goto out;
+			t = bench_time();
+			for (i = 0; i < BENCH_NB_FILES; i++) {
+				snprintf(path, sizeof(path), "amd64\\file%02d.dll", i);
+				if (zip_add(zip, path, data, BENCH_FILE_SIZE, 1700000000) != 0)
+					break;
+			}
+			if ((i != BENCH_NB_FILES) || (zip_finish(zip) != 0)) {
+				fprintf(stderr, "Could not create archive\n");
+				zip_free(zip);
+				goto out;
+			}
+			t = bench_time() - t;
+			zip_free(zip);
+			printf("  BENCH  zip %s, %s data: %d MB in %.3fs (%.1f MB/s), ratio %.1f%%\n", names[m],
+				type_names[d], (int)(size >> 20), t, (size >> 20) / t, 100.0 * total / size);
+		}
+	}
+	r = 0;
+
+out:
+	free(data);
+	return r;
+}
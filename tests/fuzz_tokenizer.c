@@ -0,0 +1,237 @@
+/*
+ * Library for USB automated driver installation - tokenizer fuzzing harness
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Fuzzing harness for tokenize_string(), tokenize_to_sink() and compiled templates, with
+ * arbitrary prefixes, suffixes, entity lists and recursive mode. It is meant to be built
+ * with the sanitizers, and aborts if the variants don't agree:
+ * - libFuzzer:  make fuzz_tokenizer CC_FOR_BUILD=clang HOST_CFLAGS="-fsanitize=fuzzer,address,undefined -DFUZZ_LIBFUZZER"
+ *               ./fuzz_tokenizer corpus_dir
+ * - AFL:        make fuzz_tokenizer CC_FOR_BUILD=afl-clang-fast HOST_CFLAGS="-fsanitize=address"
+ *               afl-fuzz -i seeds -o findings ./fuzz_tokenizer
+ * - Otherwise, the inputs are read from the files given on the command line, from stdin,
+ *   or generated with --random <count>, which is what 'make check' does.
+ *
+ * The input is a flags byte, followed by the prefix, the suffix, and the name and value of
+ * each entity, all NUL terminated, and then by the text to tokenize, which can contain NULs.
+ * Flags: bit 0 recursive mode, bit 1 NUL terminated text, bits 2-4 number of entities.
+ * Recursive mode is only used for inputs of up to FUZZ_MAX_RECURSIVE_SIZE bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenizer.h"
+#include "test.h"
+
+#define FUZZ_FLAG_RECURSIVE		0x01
+#define FUZZ_FLAG_NUL_TERMINATED	0x02
+#define FUZZ_MAX_ENTITIES		7
+#define FUZZ_MAX_INPUT_SIZE		(1024 * 1024)
+// Nested values can grow the output exponentially, which is only bounded for small inputs
+#define FUZZ_MAX_RECURSIVE_SIZE		128
+
+#define FUZZ_CHECK(cond) do { if (!(cond)) { \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); abort(); } } while (0)
+
+struct fuzz_buffer {
+	char* data;
+	long size;
+	long max_size;
+};
+
+static int fuzz_sink(const char* data, long size, void* context)
+{
+	struct fuzz_buffer* b = (struct fuzz_buffer*)context;
+	char* p;
+
+	FUZZ_CHECK(size >= 0);
+	if (b->size + size > b->max_size) {
+		b->max_size = 2 * (b->size + size);
+		p = realloc(b->data, b->max_size);
+		if (p == NULL)
+			return -1;
+		b->data = p;
+	}
+	memcpy(&b->data[b->size], data, size);
+	b->size += size;
+	return 0;
+}
+
+// Copy the next NUL terminated field of the input to its own allocation
+static char* next_field(const uint8_t** data, size_t* size)
+{
+	const uint8_t* end = memchr(*data, 0, *size);
+	size_t len = (end != NULL) ? (size_t)(end - *data) : *size;
+	char* field = malloc(len + 1);
+
+	if (field == NULL)
+		abort();
+	memcpy(field, *data, len);
+	field[len] = 0;
+	*data += (end != NULL) ? len + 1 : len;
+	*size -= (end != NULL) ? len + 1 : len;
+	return field;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	token_entity_t* entities;
+	token_template_t* tpl;
+	token_arena_t arena = { 0 };
+	struct fuzz_buffer b1 = { 0 }, b2 = { 0 };
+	char *prefix, *suffix, *names[FUZZ_MAX_ENTITIES], *src, *dst = NULL;
+	int i, flags, nb_entities, recursive, has_nul;
+	long r, src_count;
+
+	if ((size < 1) || (size > FUZZ_MAX_INPUT_SIZE))
+		return 0;
+	flags = data[0];
+	data++;
+	size--;
+	recursive = (flags & FUZZ_FLAG_RECURSIVE) && (size <= FUZZ_MAX_RECURSIVE_SIZE);
+	nb_entities = (flags >> 2) & 7;
+	prefix = next_field(&data, &size);
+	suffix = next_field(&data, &size);
+	entities = calloc(nb_entities + 1, sizeof(token_entity_t));
+	if (entities == NULL)
+		abort();
+	for (i = 0; i < nb_entities; i++) {
+		names[i] = next_field(&data, &size);
+		entities[i].match = names[i];
+		src = next_field(&data, &size);
+		token_set(&arena, &entities[i], src);
+		free(src);
+	}
+	FUZZ_CHECK(!arena.failed);
+
+	// Use an exact size copy of the text, so that any overread gets caught by the sanitizers
+	src = malloc(size + 1);
+	if (src == NULL)
+		abort();
+	memcpy(src, data, size);
+	if (flags & FUZZ_FLAG_NUL_TERMINATED) {
+		src[size] = 0;
+		src_count = -1;
+		has_nul = 0;
+	} else {
+		src_count = (long)size;
+		has_nul = (memchr(src, 0, size) != NULL);
+	}
+
+	r = tokenize_string(src, src_count, &dst, entities, prefix, suffix, recursive);
+	if (r < 0) {
+		FUZZ_CHECK(recursive || (prefix[0] == 0) || (suffix[0] == 0) || (src_count == 0));
+		goto out;
+	}
+	if (dst != NULL)
+		FUZZ_CHECK(dst[r] == 0);
+	if (recursive)
+		goto out;
+
+	// Without recursion, every variant must produce the same output
+	FUZZ_CHECK(tokenize_to_sink(src, src_count, entities, prefix, suffix, fuzz_sink, &b1) == b1.size);
+	// tokenize_string() copies the text up to any NUL
+	if (!has_nul)
+		FUZZ_CHECK((b1.size == r) && ((r == 0) || (memcmp(b1.data, dst, r) == 0)));
+	tpl = tokenize_compile(src, src_count, entities, prefix, suffix);
+	if (tpl != NULL) {
+		FUZZ_CHECK(tokenize_render_to_sink(tpl, entities, fuzz_sink, &b2) == b1.size);
+		FUZZ_CHECK((b2.size == b1.size) && ((b1.size == 0) || (memcmp(b1.data, b2.data, b1.size) == 0)));
+		free(dst);
+		dst = NULL;
+		r = tokenize_render(tpl, &dst, entities);
+		FUZZ_CHECK(r == b1.size);
+		if (r > 0)
+			FUZZ_CHECK((memcmp(dst, b1.data, r) == 0) && (dst[r] == 0));
+		tokenize_free(tpl);
+	}
+
+out:
+	free(dst);
+	free(b1.data);
+	free(b2.data);
+	free(src);
+	for (i = 0; i < nb_entities; i++)
+		free(names[i]);
+	free(entities);
+	free(prefix);
+	free(suffix);
+	token_arena_free(&arena);
+	return 0;
+}
+
+#if !defined(FUZZ_LIBFUZZER)
+static void run_file(FILE* fd)
+{
+	uint8_t* buf = malloc(FUZZ_MAX_INPUT_SIZE);
+	size_t size;
+
+	if (buf == NULL)
+		abort();
+	size = fread(buf, 1, FUZZ_MAX_INPUT_SIZE, fd);
+	LLVMFuzzerTestOneInput(buf, size);
+	free(buf);
+}
+
+// Random inputs, with few distinct chars, so that prefixes, suffixes and names overlap
+static void run_random(int count)
+{
+	static const char alphabet[] = "#$()ab";
+	uint8_t buf[128];
+	uint32_t seed = 1;
+	size_t i, size;
+	int n;
+
+	for (n = 0; n < count; n++) {
+		size = 1 + test_rand(&seed) % sizeof(buf);
+		buf[0] = (uint8_t)test_rand(&seed);
+		for (i = 1; i < size; i++)
+			buf[i] = (test_rand(&seed) % 6 == 0) ? 0 : alphabet[test_rand(&seed) % (sizeof(alphabet) - 1)];
+		LLVMFuzzerTestOneInput(buf, size);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	FILE* fd;
+	int i;
+
+	if ((argc == 3) && (strcmp(argv[1], "--random") == 0)) {
+		run_random(atoi(argv[2]));
+		printf("  PASS   tokenizer fuzzing (%d random inputs)\n", atoi(argv[2]));
+		return 0;
+	}
+	if (argc == 1) {
+		run_file(stdin);
+		return 0;
+	}
+	for (i = 1; i < argc; i++) {
+		fd = fopen(argv[i], "rb");
+		if (fd == NULL) {
+			fprintf(stderr, "Could not open '%s'\n", argv[i]);
+			return 1;
+		}
+		run_file(fd);
+		fclose(fd);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Library for USB automated driver installation - host tests and benchmarks
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+/*
+ * The tests are plain programs, that return 0 if all their checks passed,
+ * and the benchmarks report their results on stdout.
+ */
+#if defined(__GNUC__)
+#define TEST_UNUSED __attribute__((unused))
+#else
+#define TEST_UNUSED
+#endif
+
+static int test_failures TEST_UNUSED = 0;
+
+#define CHECK(cond) do { if (!(cond)) { test_failures++; \
+	fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define TEST_RESULT(name) ((test_failures == 0) ? (printf("  PASS   %s\n", name), 0) : \
+	(printf("  FAIL   %s (%d failure(s))\n", name, test_failures), 1))
+
+// Monotonic time, in seconds
+static __inline double bench_time(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+// Deterministic pseudo random generator (xorshift32), so that runs can be compared
+static __inline uint32_t test_rand(uint32_t* state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+enum { TEST_DATA_ZEROS, TEST_DATA_RANDOM, TEST_DATA_TEXT, TEST_DATA_MIXED, TEST_DATA_MAX };
+
+// Fill a buffer with data that compresses more or less well
+static __inline void fill_test_data(uint8_t* buf, size_t size, int type, uint32_t* seed)
+{
+	static const char* words[] = { "USB", "\\Device", "WinUSB", "0x0000", "libusb0.sys", "  ", "\r\n", "[Strings]" };
+	size_t i, len;
+	const char* w;
+
+	for (i = 0; i < size; ) {
+		switch (type) {
+		case TEST_DATA_ZEROS:
+			buf[i++] = 0;
+			break;
+		case TEST_DATA_RANDOM:
+			buf[i++] = (uint8_t)test_rand(seed);
+			break;
+		case TEST_DATA_TEXT:
+			w = words[test_rand(seed) % (sizeof(words) / sizeof(words[0]))];
+			for (len = strlen(w); (len != 0) && (i < size); len--)
+				buf[i++] = (uint8_t)*w++;
+			break;
+		default:
+			// Runs of each of the above, as found in PE files
+			len = 1 + test_rand(seed) % 3000;
+			if (len > size - i)
+				len = size - i;
+			fill_test_data(&buf[i], len, test_rand(seed) % TEST_DATA_MIXED, seed);
+			i += len;
+			break;
+		}
+	}
+}
@@ -0,0 +1,181 @@
+/*
+ * Library for USB automated driver installation - compression tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "test.h"
+
+struct stream_buffer {
+	uint8_t* data;
+	size_t size;
+	size_t max_size;
+	int fail_after;		// number of writes before failing, or -1
+};
+
+static int stream_write(const void* buf, size_t size, void* ctx)
+{
+	struct stream_buffer* sb = (struct stream_buffer*)ctx;
+
+	if ((sb->fail_after >= 0) && (sb->fail_after-- == 0))
+		return -1;
+	if (sb->size + size > sb->max_size)
+		return -1;
+	memcpy(&sb->data[sb->size], buf, size);
+	sb->size += size;
+	return 0;
+}
+
+static void test_round_trip(void)
+{
+	const size_t sizes[] = { 0, 1, 2, 13, 100, LZ_BLOCK_SIZE - 1, LZ_BLOCK_SIZE, LZ_BLOCK_SIZE + 1,
+		3 * LZ_BLOCK_SIZE + 12345 };
+	uint8_t *src, *cmp, *dst;
+	size_t i, csize, bound;
+	struct stream_buffer sb;
+	uint32_t seed = 1;
+	int type;
+
+	for (type = 0; type < TEST_DATA_MAX; type++) {
+		for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			bound = lz_compress_bound(sizes[i]);
+			src = malloc(sizes[i] + 1);
+			cmp = malloc(bound + 1);
+			dst = malloc(sizes[i] + 1);
+			CHECK((src != NULL) && (cmp != NULL) && (dst != NULL));
+			if ((src == NULL) || (cmp == NULL) || (dst == NULL))
+				return;
+			fill_test_data(src, sizes[i], type, &seed);
+			csize = lz_compress(src, sizes[i], cmp, bound);
+			CHECK((csize != 0) || (sizes[i] == 0));
+			CHECK(csize <= bound);
+			if ((type == TEST_DATA_ZEROS) && (sizes[i] >= LZ_BLOCK_SIZE))
+				CHECK(csize < sizes[i] / 10);
+
+			memset(dst, 0xAA, sizes[i]);
+			CHECK(lz_decompress(cmp, csize, dst, sizes[i]) == 0);
+			CHECK(memcmp(src, dst, sizes[i]) == 0);
+
+			memset(&sb, 0, sizeof(sb));
+			sb.data = dst;
+			sb.max_size = sizes[i];
+			sb.fail_after = -1;
+			memset(dst, 0xAA, sizes[i]);
+			CHECK(lz_decompress_stream(cmp, csize, sizes[i], stream_write, &sb) == 0);
+			CHECK(sb.size == sizes[i]);
+			CHECK(memcmp(src, dst, sizes[i]) == 0);
+
+			// A failing write must abort the decompression
+			if (sizes[i] != 0) {
+				memset(&sb, 0, sizeof(sb));
+				sb.data = dst;
+				sb.max_size = sizes[i];
+				sb.fail_after = 0;
+				CHECK(lz_decompress_stream(cmp, csize, sizes[i], stream_write, &sb) != 0);
+			}
+
+			// A destination that is too small must be reported
+			if (csize > LZ_BLOCK_HEADER_SIZE)
+				CHECK(lz_compress(src, sizes[i], cmp, LZ_BLOCK_HEADER_SIZE) == 0);
+
+			free(src);
+			free(cmp);
+			free(dst);
+		}
+	}
+}
+
+/*
+ * Corrupted or truncated streams must be rejected, or at least never read or write out
+ * of bounds (which requires building with -fsanitize=address to be detected).
+ */
+static void test_corruption(void)
+{
+	const size_t size = 2 * LZ_BLOCK_SIZE + 777;
+	uint8_t *src, *cmp, *bad, *dst;
+	size_t i, csize;
+	struct stream_buffer sb;
+	uint32_t seed = 2;
+	int n;
+
+	src = malloc(size);
+	cmp = malloc(lz_compress_bound(size));
+	dst = malloc(size);
+	CHECK((src != NULL) && (cmp != NULL) && (dst != NULL));
+	if ((src == NULL) || (cmp == NULL) || (dst == NULL))
+		goto out;
+	fill_test_data(src, size, TEST_DATA_MIXED, &seed);
+	csize = lz_compress(src, size, cmp, lz_compress_bound(size));
+	CHECK(csize != 0);
+
+	// Truncated streams, with the copies allocated to their exact size
+	for (i = 0; i < csize; i += (i < 64) ? 1 : 97) {
+		bad = malloc(i + 1);
+		if (bad == NULL)
+			continue;
+		memcpy(bad, cmp, i);
+		CHECK(lz_decompress(bad, i, dst, size) != 0);
+		memset(&sb, 0, sizeof(sb));
+		sb.data = dst;
+		sb.max_size = size;
+		sb.fail_after = -1;
+		CHECK(lz_decompress_stream(bad, i, size, stream_write, &sb) != 0);
+		free(bad);
+	}
+
+	// Trailing data and wrong sizes
+	CHECK(lz_decompress(cmp, csize, dst, size - 1) != 0);
+	bad = malloc(csize + 1);
+	if (bad != NULL) {
+		memcpy(bad, cmp, csize);
+		bad[csize] = 0;
+		CHECK(lz_decompress(bad, csize + 1, dst, size) != 0);
+		free(bad);
+	}
+
+	// Random corruption, which may go undetected in literals, but must stay in bounds
+	bad = malloc(csize);
+	if (bad == NULL)
+		goto out;
+	for (n = 0; n < 2000; n++) {
+		memcpy(bad, cmp, csize);
+		for (i = 1 + test_rand(&seed) % 4; i > 0; i--)
+			bad[test_rand(&seed) % csize] ^= (uint8_t)(1 + test_rand(&seed) % 255);
+		lz_decompress(bad, csize, dst, size);
+		memset(&sb, 0, sizeof(sb));
+		sb.data = dst;
+		sb.max_size = size;
+		sb.fail_after = -1;
+		lz_decompress_stream(bad, csize, size, stream_write, &sb);
+	}
+	free(bad);
+
+out:
+	free(src);
+	free(cmp);
+	free(dst);
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_corruption();
+	return TEST_RESULT("compress");
+}
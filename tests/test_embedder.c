@@ -0,0 +1,143 @@
+/*
+ * Library for USB automated driver installation - embedder tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define EMBEDDER_NO_MAIN
+#include "embedder.c"
+#include "test.h"
+
+// Straightforward formatting of the hex output, to compare with
+static char* reference_hex(const unsigned char* buffer, size_t size, size_t* len)
+{
+	char* out = malloc(8 * size + 16);
+	size_t i, pos = 0;
+
+	if (out == NULL)
+		return NULL;
+	if (size == 0) {
+		*len = (size_t)sprintf(out, "0x00\n");
+		return out;
+	}
+	for (i = 0; i < size; i++) {
+		if (!(i % HEX_BYTES_PER_LINE))
+			pos += sprintf(&out[pos], "\n\t");
+		pos += sprintf(&out[pos], "0x%02X,", buffer[i]);
+	}
+	pos += sprintf(&out[pos], "\n");
+	*len = pos;
+	return out;
+}
+
+static void test_hex(void)
+{
+	// Include the sizes around the block and line boundaries
+	const size_t sizes[] = { 0, 1, 15, 16, 17, 4095, 4096, 16383, 16384, 16385, 32768, 65536 + 3 };
+	unsigned char* buffer;
+	char* ref;
+	chunk_t c;
+	size_t i, j, ref_len = 0;
+	uint32_t seed = 1;
+
+	init_hex_table();
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		buffer = malloc(sizes[i] + 1);
+		CHECK(buffer != NULL);
+		if (buffer == NULL)
+			return;
+		for (j = 0; j < sizes[i]; j++)
+			buffer[j] = (unsigned char)test_rand(&seed);
+		memset(&c, 0, sizeof(c));
+		// Output that follows other data in the chunk must not be affected
+		chunk_printf(&c, "{");
+		dump_buffer_hex(&c, buffer, sizes[i]);
+		ref = reference_hex(buffer, sizes[i], &ref_len);
+		CHECK(ref != NULL);
+		if (ref == NULL) {
+			free(c.data);
+			free(buffer);
+			return;
+		}
+		CHECK(c.error == 0);
+		CHECK(c.size <= c.max_size);
+		CHECK(c.size == ref_len + 1);
+		if (c.size == ref_len + 1)
+			CHECK(memcmp(&c.data[1], ref, ref_len) == 0);
+		free(ref);
+		free(c.data);
+		free(buffer);
+	}
+}
+
+// Check if a chunk contains the expected text
+static int chunk_has(chunk_t* c, const char* expected)
+{
+	size_t len = strlen(expected);
+	size_t i;
+
+	for (i = 0; i + len <= c->size; i++) {
+		if (memcmp(&c->data[i], expected, len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void test_paths(void)
+{
+	chunk_t c;
+
+	// The section in use is saved and restored
+	memset(&c, 0, sizeof(c));
+	dump_file_incbin(&c, "file_000", "dir/file.bin", 1);
+	CHECK(c.error == 0);
+	CHECK(chunk_has(&c, "__asm__(INCBIN_SECTION\n"));
+	CHECK(chunk_has(&c, "\".incbin \\\"dir/file.bin\\\"\\n\"\n"));
+	CHECK(chunk_has(&c, "\".popsection\\n\");\n"));
+	CHECK(!chunk_has(&c, ".text"));
+	free(c.data);
+
+	// Quotes, backslashes and control characters are escaped for the assembler, then for C
+	memset(&c, 0, sizeof(c));
+	dump_file_incbin(&c, "file_000", "a\"b\\nc", 1);
+	CHECK(c.error == 0);
+#if defined(_WIN32)
+	CHECK(chunk_has(&c, "\".incbin \\\"a\\\\\\\"b/nc\\\"\\n\"\n"));
+#else
+	CHECK(chunk_has(&c, "\".incbin \\\"a\\\\\\\"b\\\\\\\\nc\\\"\\n\"\n"));
+#endif
+	free(c.data);
+	memset(&c, 0, sizeof(c));
+	dump_file_incbin(&c, "file_000", "a\tb", 1);
+	CHECK(chunk_has(&c, "\".incbin \\\"a\\\\011b\\\"\\n\"\n"));
+	free(c.data);
+
+	// #embed doesn't process escapes, so such paths are rejected
+	memset(&c, 0, sizeof(c));
+	CHECK(dump_file_embed(&c, "file_000", "dir/file.bin") == 0);
+	CHECK(chunk_has(&c, "#embed \"dir/file.bin\" if_empty(0)\n"));
+	free(c.data);
+	memset(&c, 0, sizeof(c));
+	CHECK(dump_file_embed(&c, "file_000", "a\"b") != 0);
+	free(c.data);
+}
+
+int main(void)
+{
+	test_hex();
+	test_paths();
+	return TEST_RESULT("embedder");
+}
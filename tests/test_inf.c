@@ -0,0 +1,255 @@
+/*
+ * Library for USB automated driver installation - inf generation tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inf.h"
+#include "test.h"
+
+#if !defined(TEMPLATE_DIR)
+#define TEMPLATE_DIR "../libwdi"
+#endif
+
+static const char* templates[] = { "winusb.inf.in", "libusb0.inf.in", "libusbk.inf.in", "usbser.inf.in" };
+static const char* test_guid = "{01234567-89AB-CDEF-0123-456789ABCDEF}";
+
+struct inf_buffer {
+	uint8_t* data;
+	size_t size;
+	size_t max_size;
+	int fail;
+};
+
+static int inf_buffer_write(const void* buf, size_t size, void* ctx)
+{
+	struct inf_buffer* b = (struct inf_buffer*)ctx;
+	uint8_t* data;
+
+	if (b->fail)
+		return -1;
+	if (b->size + size > b->max_size) {
+		b->max_size = 2 * (b->size + size);
+		data = realloc(b->data, b->max_size);
+		if (data == NULL)
+			return -1;
+		b->data = data;
+	}
+	memcpy(&b->data[b->size], buf, size);
+	b->size += size;
+	return 0;
+}
+
+static char* read_template(const char* name, long* size)
+{
+	char path[512];
+	char* buf = NULL;
+	FILE* fd;
+
+	snprintf(path, sizeof(path), "%s/%s", TEMPLATE_DIR, name);
+	fd = fopen(path, "rb");
+	if (fd == NULL)
+		return NULL;
+	fseek(fd, 0, SEEK_END);
+	*size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	buf = calloc(*size + 1, 1);
+	if ((buf != NULL) && (fread(buf, 1, *size, fd) != (size_t)*size)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fd);
+	return buf;
+}
+
+// Look for a string, given in UTF-8, in UTF-16LE data
+static int utf16_has(const struct inf_buffer* b, const char* str)
+{
+	uint8_t needle[512];
+	struct utf16_writer w;
+	struct inf_buffer n = { needle, 0, sizeof(needle), 0 };
+	size_t i;
+
+	utf16_init(&w, inf_buffer_write, &n);
+	if ((utf16_write_utf8(&w, str, strlen(str)) != 0) || (utf16_flush(&w) != 0))
+		return 0;
+	for (i = 0; i + n.size <= b->size; i += 2) {
+		if (memcmp(&b->data[i], needle, n.size) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void set_default_params(struct inf_params* params)
+{
+	memset(params, 0, sizeof(struct inf_params));
+	params->inf_name = "usb_device.inf";
+	params->desc = "Test Device";
+	params->vid = 0x1234;
+	params->pid = 0xABCD;
+	params->device_guid = test_guid;
+	params->vendor_name = "Akeo Consulting";
+	params->wdf_version = 1011;
+	params->year = 2026;
+	params->month = 10;
+	params->day = 7;
+	params->version_ms = (6 << 16) | 1;
+	params->version_ls = (7600 << 16) | 16385;
+}
+
+// Render each inf template, compiled and as a string, and check the values that were injected
+static void test_templates(void)
+{
+	struct inf_params params;
+	struct inf_buffer b1, b2;
+	token_arena_t arena = { 0 };
+	token_template_t* compiled;
+	char* src;
+	long size, r;
+	size_t i;
+
+	set_default_params(&params);
+	CHECK(inf_set_entities(&arena, inf_entities, &params) == 0);
+	for (i = 0; i < sizeof(templates) / sizeof(templates[0]); i++) {
+		src = read_template(templates[i], &size);
+		CHECK(src != NULL);
+		if (src == NULL) {
+			fprintf(stderr, "Could not read '%s/%s'\n", TEMPLATE_DIR, templates[i]);
+			continue;
+		}
+		compiled = tokenize_compile(src, size, inf_entities, "#", "#");
+		CHECK(compiled != NULL);
+		memset(&b1, 0, sizeof(b1));
+		memset(&b2, 0, sizeof(b2));
+		r = inf_render(compiled, NULL, 0, inf_entities, inf_buffer_write, &b1);
+		CHECK(r > 0);
+		CHECK(inf_render(NULL, src, size, inf_entities, inf_buffer_write, &b2) == r);
+		CHECK((b1.size == b2.size) && (memcmp(b1.data, b2.data, b1.size) == 0));
+
+		// UTF-16LE with a BOM, and every token replaced
+		CHECK((b1.size >= 2) && (b1.data[0] == 0xFF) && (b1.data[1] == 0xFE));
+		CHECK(b1.size % 2 == 0);
+		CHECK(utf16_has(&b1, "usb_device.inf"));
+		CHECK(utf16_has(&b1, "usb_device.cat"));
+		CHECK(utf16_has(&b1, "\"Test Device\""));
+		// usbser.sys is an inbox driver, with a fixed version
+		CHECK(utf16_has(&b1, (i == 3) ? "10/07/2026, 1.0.0.0" : "10/07/2026, 6.1.7600.16385"));
+		CHECK(!utf16_has(&b1, "#DEVICE_"));
+		CHECK(!utf16_has(&b1, "#DRIVER_"));
+		CHECK(!utf16_has(&b1, "_FILENAME#"));
+		if (i != 1) {
+			CHECK(utf16_has(&b1, "VID_1234&PID_ABCD"));
+			CHECK(utf16_has(&b1, test_guid));
+			CHECK(utf16_has(&b1, "Akeo Consulting"));
+		}
+		if (i == 0) {
+			CHECK(utf16_has(&b1, "KmdfLibraryVersion = 1.11"));
+			CHECK(utf16_has(&b1, "WdfCoInstaller01011.dll"));
+			CHECK(utf16_has(&b1, "AddDeviceInterfaceGUID"));
+		}
+
+		// A failure of the write callback must be reported
+		b1.fail = 1;
+		CHECK(inf_render(compiled, NULL, 0, inf_entities, inf_buffer_write, &b1) < 0);
+
+		tokenize_free(compiled);
+		free(b1.data);
+		free(b2.data);
+		free(src);
+	}
+	token_arena_free(&arena);
+}
+
+static void test_entities(void)
+{
+	// "Périphérique ☃", to check the conversion of the device description
+	const char* desc = "P\xC3\xA9riph\xC3\xA9rique \xE2\x98\x83";
+	const uint8_t utf16_desc[] = { 'P',0, 0xE9,0, 'r',0, 'i',0, 'p',0, 'h',0, 0xE9,0, 'r',0,
+		'i',0, 'q',0, 'u',0, 'e',0, ' ',0, 0x03,0x26 };
+	const char* src = "#INF_FILENAME#|#CAT_FILENAME#|#DEVICE_HARDWARE_ID#|#DEVICE_INTERFACE_GUID#|"
+		"#USE_DEVICE_INTERFACE_GUID#|#DEVICE_MANUFACTURER#|#DEVICE_DESCRIPTION#";
+	struct inf_params params;
+	struct inf_buffer b;
+	token_arena_t arena = { 0 };
+	char long_name[240];
+	size_t i;
+
+	// Composite device, with an explicit cat name
+	set_default_params(&params);
+	params.is_composite = 1;
+	params.mi = 2;
+	params.cat_name = "batch.cat";
+	params.vendor_name = NULL;
+	CHECK(inf_set_entities(&arena, inf_entities, &params) == 0);
+	memset(&b, 0, sizeof(b));
+	CHECK(inf_render(NULL, src, (long)strlen(src), inf_entities, inf_buffer_write, &b) > 0);
+	CHECK(utf16_has(&b, "usb_device.inf|batch.cat|VID_1234&PID_ABCD&MI_02|"));
+	CHECK(utf16_has(&b, "|AddDeviceInterfaceGUID|(Undefined Vendor)|"));
+	free(b.data);
+	token_arena_free(&arena);
+
+	// WCID driver, which ignores the GUID
+	set_default_params(&params);
+	params.compat_id = "MS_COMP_WINUSB";
+	params.desc = desc;
+	CHECK(inf_set_entities(&arena, inf_entities, &params) == 0);
+	memset(&b, 0, sizeof(b));
+	CHECK(inf_render(NULL, src, (long)strlen(src), inf_entities, inf_buffer_write, &b) > 0);
+	CHECK(utf16_has(&b, "|MS_COMP_WINUSB|UNUSED|NoDeviceInterfaceGUID|Akeo Consulting|"));
+	CHECK(utf16_has(&b, desc));
+	for (i = 0; i + sizeof(utf16_desc) <= b.size; i += 2) {
+		if (memcmp(&b.data[i], utf16_desc, sizeof(utf16_desc)) == 0)
+			break;
+	}
+	CHECK(i + sizeof(utf16_desc) <= b.size);
+	free(b.data);
+	token_arena_free(&arena);
+
+	// Long inf names, for which the cat name is derived the same way
+	memset(long_name, 'a', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = 0;
+	memcpy(&long_name[sizeof(long_name) - 5], ".inf", 4);
+	set_default_params(&params);
+	params.inf_name = long_name;
+	CHECK(inf_set_entities(&arena, inf_entities, &params) == 0);
+	CHECK(strcmp(inf_entities[INF_FILENAME].replace, long_name) == 0);
+	CHECK(inf_entities[CAT_FILENAME].replace_length == (long)strlen(long_name));
+	CHECK(memcmp(inf_entities[CAT_FILENAME].replace, long_name, sizeof(long_name) - 4) == 0);
+	CHECK(strcmp(&inf_entities[CAT_FILENAME].replace[sizeof(long_name) - 4], "cat") == 0);
+	token_arena_free(&arena);
+
+	// An inf name that cannot have a cat derived from it
+	set_default_params(&params);
+	params.inf_name = "a";
+	CHECK(inf_set_entities(&arena, inf_entities, &params) != 0);
+	token_arena_free(&arena);
+
+	// Android devices get the GUID that Google's tools expect
+	CHECK(inf_android_guid(0x18D1, 0x4EE0) != NULL);
+	CHECK(inf_android_guid(0x04E8, 0x685B) != NULL);
+	CHECK(inf_android_guid(0x1234, 0xABCD) == NULL);
+}
+
+int main(void)
+{
+	test_templates();
+	test_entities();
+	return TEST_RESULT("inf");
+}
@@ -0,0 +1,199 @@
+/*
+ * Library for USB automated driver installation - resource pack tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "test.h"
+
+#define NB_ENTRIES		3
+
+static const char strings[] = "\0winusb.inf.in\0x64\0WdfCoInstaller01011.dll\0libusb0.sys";
+static const uint32_t name_offsets[NB_ENTRIES] = { 1, 19, 43 };
+static const uint32_t subdir_offsets[NB_ENTRIES] = { 0, 15, 15 };
+static const char* names[NB_ENTRIES] = { "winusb.inf.in", "WdfCoInstaller01011.dll", "libusb0.sys" };
+static const char* subdirs[NB_ENTRIES] = { "", "x64", "x64" };
+
+// Layout the pack the same way as the embedder: header, entries, aligned data, then strings
+static size_t build_pack(uint8_t* buf, struct pack_entry* entries)
+{
+	uint64_t offset = PACK_HEADER_SIZE + NB_ENTRIES * PACK_ENTRY_SIZE;
+	uint32_t seed = 1;
+	int i, j;
+
+	memset(entries, 0, NB_ENTRIES * sizeof(struct pack_entry));
+	for (i = 0; i < NB_ENTRIES; i++) {
+		offset = (offset + PACK_ALIGNMENT - 1) & ~((uint64_t)PACK_ALIGNMENT - 1);
+		entries[i].offset = offset;
+		entries[i].size = 100 + 1000 * i;
+		// Pretend that the second file compressed
+		entries[i].compressed_size = (i == 1) ? entries[i].size / 2 : 0;
+		entries[i].creation_time = 0x1D9A2B3C4D5E6F70LL + i;
+		entries[i].tags = (i == 0) ? 0 : (RES_TAG_X64 | ((i == 1) ? RES_TAG_WINUSB : RES_TAG_LIBUSB0));
+		if (i != 0) {
+			entries[i].flags = PACK_HAS_VERSION;
+			for (j = 0; j < PACK_VERSION_INFO_SIZE; j++)
+				entries[i].version_info[j] = test_rand(&seed);
+		}
+		for (j = 0; j < PACK_HASH_SIZE; j++) {
+			entries[i].hash[j] = (uint8_t)test_rand(&seed);
+			entries[i].content_hash[j] = (uint8_t)test_rand(&seed);
+		}
+		pack_write_entry(&buf[PACK_HEADER_SIZE + i * PACK_ENTRY_SIZE], name_offsets[i], subdir_offsets[i], &entries[i]);
+		offset += (entries[i].compressed_size != 0) ? entries[i].compressed_size : entries[i].size;
+		memset(&buf[entries[i].offset], 'a' + i, (size_t)(offset - entries[i].offset));
+	}
+	memcpy(&buf[offset], strings, sizeof(strings));
+	pack_write_header(buf, NB_ENTRIES, (uint32_t)offset, sizeof(strings), offset + sizeof(strings));
+	return (size_t)offset + sizeof(strings);
+}
+
+static void test_round_trip(void)
+{
+	struct pack_entry written[NB_ENTRIES], entry;
+	uint8_t buf[4096];
+	uint32_t nb_entries = 0;
+	size_t size = build_pack(buf, written);
+	int i;
+
+	CHECK(pack_open(buf, size, &nb_entries) == 0);
+	CHECK(nb_entries == NB_ENTRIES);
+	for (i = 0; i < NB_ENTRIES; i++) {
+		memset(&entry, 0, sizeof(entry));
+		CHECK(pack_read_entry(buf, size, i, &entry) == 0);
+		CHECK(strcmp(entry.name, names[i]) == 0);
+		CHECK(strcmp(entry.subdir, subdirs[i]) == 0);
+		CHECK(entry.offset % PACK_ALIGNMENT == 0);
+		CHECK(entry.offset == written[i].offset);
+		CHECK(entry.size == written[i].size);
+		CHECK(entry.compressed_size == written[i].compressed_size);
+		CHECK(entry.creation_time == written[i].creation_time);
+		CHECK(entry.flags == written[i].flags);
+		CHECK(entry.tags == written[i].tags);
+		CHECK(memcmp(entry.version_info, written[i].version_info, sizeof(entry.version_info)) == 0);
+		CHECK(memcmp(entry.hash, written[i].hash, PACK_HASH_SIZE) == 0);
+		CHECK(memcmp(entry.content_hash, written[i].content_hash, PACK_HASH_SIZE) == 0);
+		CHECK(entry.data == &buf[written[i].offset]);
+		CHECK(entry.data[0] == 'a' + i);
+	}
+	CHECK(pack_read_entry(buf, size, NB_ENTRIES, &entry) != 0);
+
+	// An empty pack only has a header and a string table
+	memset(buf, 0, PACK_HEADER_SIZE + 1);
+	pack_write_header(buf, 0, PACK_HEADER_SIZE, 1, PACK_HEADER_SIZE + 1);
+	CHECK(pack_open(buf, PACK_HEADER_SIZE + 1, &nb_entries) == 0);
+	CHECK(nb_entries == 0);
+}
+
+// Check that a pack that was accepted cannot make the reader access anything outside of it
+static int check_pack(const uint8_t* buf, size_t size)
+{
+	struct pack_entry entry;
+	uint32_t i, nb_entries;
+	size_t stored_size;
+
+	if (pack_open(buf, size, &nb_entries) != 0)
+		return -1;
+	for (i = 0; i < nb_entries; i++) {
+		if (pack_read_entry(buf, size, i, &entry) != 0)
+			return -1;
+		CHECK(memchr(entry.name, 0, size - ((const uint8_t*)entry.name - buf)) != NULL);
+		CHECK(memchr(entry.subdir, 0, size - ((const uint8_t*)entry.subdir - buf)) != NULL);
+		stored_size = (size_t)((entry.compressed_size != 0) ? entry.compressed_size : entry.size);
+		CHECK((entry.data >= buf) && (stored_size <= size - (size_t)(entry.data - buf)));
+	}
+	return 0;
+}
+
+static void test_corruption(void)
+{
+	struct pack_entry entries[NB_ENTRIES];
+	uint8_t buf[4096], *copy;
+	uint32_t nb_entries, seed = 1;
+	size_t size, i, pos;
+	int n;
+
+	// Truncated: the size is recorded in the header
+	size = build_pack(buf, entries);
+	for (i = 0; i < size; i++) {
+		copy = malloc(i + 1);
+		CHECK(copy != NULL);
+		if (copy == NULL)
+			return;
+		memcpy(copy, buf, i);
+		CHECK(pack_open(copy, i, &nb_entries) != 0);
+		free(copy);
+	}
+
+	// Invalid header fields
+	buf[0] ^= 1;
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+	build_pack(buf, entries);
+	buf[8] = PACK_VERSION + 1;
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+	build_pack(buf, entries);
+	pack_write_header(buf, 1000, (uint32_t)(size - sizeof(strings)), sizeof(strings), size);
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+	// String table overlapping the entries, too large, or not NUL terminated
+	pack_write_header(buf, NB_ENTRIES, PACK_HEADER_SIZE, (uint32_t)(size - PACK_HEADER_SIZE), size);
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+	pack_write_header(buf, NB_ENTRIES, (uint32_t)(size - sizeof(strings)), sizeof(strings) + 1, size);
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+	pack_write_header(buf, NB_ENTRIES, (uint32_t)(size - sizeof(strings)), sizeof(strings) - 1, size);
+	CHECK(pack_open(buf, size, &nb_entries) != 0);
+
+	// Invalid entries
+	build_pack(buf, entries);
+	pack_write_entry(&buf[PACK_HEADER_SIZE], sizeof(strings), 0, &entries[0]);
+	CHECK(pack_open(buf, size, &nb_entries) == 0);
+	CHECK(pack_read_entry(buf, size, 0, &entries[0]) != 0);
+	build_pack(buf, entries);
+	entries[2].size = size;
+	pack_write_entry(&buf[PACK_HEADER_SIZE + 2 * PACK_ENTRY_SIZE], name_offsets[2], subdir_offsets[2], &entries[2]);
+	CHECK(pack_read_entry(buf, size, 2, &entries[2]) != 0);
+	build_pack(buf, entries);
+	entries[1].offset = UINT64_MAX - 8;
+	pack_write_entry(&buf[PACK_HEADER_SIZE + PACK_ENTRY_SIZE], name_offsets[1], subdir_offsets[1], &entries[1]);
+	CHECK(pack_read_entry(buf, size, 1, &entries[1]) != 0);
+
+	// Random corruption of the header and entries, which must never lead to an out of bounds access
+	for (i = 0; i < 100000; i++) {
+		build_pack(buf, entries);
+		for (n = 1 + test_rand(&seed) % 4; n > 0; n--) {
+			pos = test_rand(&seed) % (PACK_HEADER_SIZE + NB_ENTRIES * PACK_ENTRY_SIZE);
+			buf[pos] = (uint8_t)test_rand(&seed);
+		}
+		// Use an exact size allocation, so that any overread gets caught by the sanitizers
+		copy = malloc(size);
+		CHECK(copy != NULL);
+		if (copy == NULL)
+			return;
+		memcpy(copy, buf, size);
+		check_pack(copy, size);
+		free(copy);
+	}
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_corruption();
+	return TEST_RESULT("pack");
+}
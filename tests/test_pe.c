@@ -0,0 +1,303 @@
+/*
+ * Library for USB automated driver installation - PE parser tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define EMBEDDER_NO_MAIN
+#include "embedder.c"
+#include "test.h"
+
+/*
+ * Layout of the sample PE: the headers, a single .rsrc section at file offset
+ * 0x200 (RVA 0x1000) holding a version resource, and an optional certificate
+ * table appended at 0x400, as produced by the signing of a driver DLL.
+ */
+#define SAMPLE_PE_OPT			0x98
+#define SAMPLE_PE_RSRC			0x200
+#define SAMPLE_PE_RSRC_RVA		0x1000
+#define SAMPLE_PE_VERSION		(SAMPLE_PE_RSRC + 0x58)
+#define SAMPLE_PE_CERT			0x400
+#define SAMPLE_PE_CERT_SIZE		0x10
+#define SAMPLE_PE_SIZE			(SAMPLE_PE_CERT + SAMPLE_PE_CERT_SIZE)
+
+static const uint32_t sample_version[VERSION_INFO_SIZE] = {
+	VERSION_INFO_SIGNATURE, 0x00010000, 0x00060001, 0x1DB10000, 0x00060001, 0x1DB10000,
+	0x3F, 0, 0x40004, 2, 0, 0, 0
+};
+
+static void set_le16(unsigned char* p, uint16_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void set_le32(unsigned char* p, uint32_t v)
+{
+	set_le16(p, (uint16_t)v);
+	set_le16(&p[2], (uint16_t)(v >> 16));
+}
+
+// Build a minimal PE32 or PE32+ with a version resource, and return its size
+static size_t build_sample_pe(unsigned char* buf, int is_pe64, int with_cert)
+{
+	const char* key = "VS_VERSION_INFO";
+	size_t opt_size = is_pe64 ? 0xF0 : 0xE0, dirs = is_pe64 ? 112 : 96, sections, i;
+	unsigned char *rsrc = &buf[SAMPLE_PE_RSRC], *version = &buf[SAMPLE_PE_VERSION];
+
+	memset(buf, 0, SAMPLE_PE_SIZE);
+	buf[0] = 'M';
+	buf[1] = 'Z';
+	set_le32(&buf[0x3C], 0x80);
+	memcpy(&buf[0x80], "PE\0\0", 4);
+	set_le16(&buf[0x84], is_pe64 ? 0x8664 : 0x14C);
+	set_le16(&buf[0x86], 1);
+	set_le16(&buf[0x94], (uint16_t)opt_size);
+	set_le16(&buf[0x96], 0x2102);
+	set_le16(&buf[SAMPLE_PE_OPT], is_pe64 ? 0x20B : 0x10B);
+	// Some code size and entry point, so that the hashed headers aren't all zeroes
+	set_le32(&buf[SAMPLE_PE_OPT + 4], 0x200);
+	set_le32(&buf[SAMPLE_PE_OPT + 16], 0x1000);
+	// A checksum, which the Authenticode digest must ignore
+	set_le32(&buf[SAMPLE_PE_OPT + 64], 0x12345678);
+	set_le32(&buf[SAMPLE_PE_OPT + dirs - 4], 16);
+	set_le32(&buf[SAMPLE_PE_OPT + dirs + 16], SAMPLE_PE_RSRC_RVA);
+	set_le32(&buf[SAMPLE_PE_OPT + dirs + 20], 0x200);
+	if (with_cert) {
+		set_le32(&buf[SAMPLE_PE_OPT + dirs + 32], SAMPLE_PE_CERT);
+		set_le32(&buf[SAMPLE_PE_OPT + dirs + 36], SAMPLE_PE_CERT_SIZE);
+		for (i = 0; i < SAMPLE_PE_CERT_SIZE; i++)
+			buf[SAMPLE_PE_CERT + i] = (unsigned char)(0xC0 + i);
+	}
+
+	sections = SAMPLE_PE_OPT + opt_size;
+	memcpy(&buf[sections], ".rsrc", 5);
+	set_le32(&buf[sections + 8], 0xB4);
+	set_le32(&buf[sections + 12], SAMPLE_PE_RSRC_RVA);
+	set_le32(&buf[sections + 16], 0x200);
+	set_le32(&buf[sections + 20], SAMPLE_PE_RSRC);
+	set_le32(&buf[sections + 36], 0x40000040);
+
+	// Type (RT_VERSION) -> Name (1) -> Language (0x409) -> Data
+	set_le16(&rsrc[0x0E], 1);
+	set_le32(&rsrc[0x10], RT_VERSION_ID);
+	set_le32(&rsrc[0x14], 0x80000018);
+	set_le16(&rsrc[0x18 + 0x0E], 1);
+	set_le32(&rsrc[0x18 + 0x10], 1);
+	set_le32(&rsrc[0x18 + 0x14], 0x80000030);
+	set_le16(&rsrc[0x30 + 0x0E], 1);
+	set_le32(&rsrc[0x30 + 0x10], 0x409);
+	set_le32(&rsrc[0x30 + 0x14], 0x48);
+	set_le32(&rsrc[0x48], SAMPLE_PE_RSRC_RVA + 0x58);
+	set_le32(&rsrc[0x4C], 40 + 4 * VERSION_INFO_SIZE);
+
+	// VS_VERSIONINFO
+	set_le16(&version[0], 40 + 4 * VERSION_INFO_SIZE);
+	set_le16(&version[2], 4 * VERSION_INFO_SIZE);
+	for (i = 0; key[i] != 0; i++)
+		version[6 + 2 * i] = (unsigned char)key[i];
+	for (i = 0; i < VERSION_INFO_SIZE; i++)
+		set_le32(&version[40 + 4 * i], sample_version[i]);
+
+	return with_cert ? SAMPLE_PE_SIZE : SAMPLE_PE_CERT;
+}
+
+static void test_version_info(void)
+{
+	unsigned char* buf = malloc(SAMPLE_PE_SIZE);
+	unsigned char* copy;
+	uint32_t info[VERSION_INFO_SIZE], seed = 1;
+	size_t size, i;
+	int is_pe64, r;
+
+	CHECK(buf != NULL);
+	if (buf == NULL)
+		return;
+	for (is_pe64 = 0; is_pe64 < 2; is_pe64++) {
+		size = build_sample_pe(buf, is_pe64, 1);
+		memset(info, 0, sizeof(info));
+		CHECK(pe_get_version_info(buf, size, info) == 0);
+		CHECK(memcmp(info, sample_version, sizeof(info)) == 0);
+
+		// Truncated files must fail cleanly once the version data is cut
+		for (i = 0; i < size; i++) {
+			copy = malloc(i + 1);
+			CHECK(copy != NULL);
+			if (copy == NULL)
+				break;
+			memcpy(copy, buf, i);
+			r = pe_get_version_info(copy, i, info);
+			CHECK((i >= SAMPLE_PE_VERSION + 40 + 4 * VERSION_INFO_SIZE) ? (r == 0) : (r != 0));
+			free(copy);
+		}
+
+		// Missing or invalid resource
+		build_sample_pe(buf, is_pe64, 0);
+		buf[SAMPLE_PE_RSRC + 0x10] = 3;
+		CHECK(pe_get_version_info(buf, size, info) != 0);
+		build_sample_pe(buf, is_pe64, 0);
+		buf[SAMPLE_PE_VERSION + 40] ^= 1;
+		CHECK(pe_get_version_info(buf, size, info) != 0);
+		build_sample_pe(buf, is_pe64, 0);
+		buf[SAMPLE_PE_VERSION + 6] = 'W';
+		CHECK(pe_get_version_info(buf, size, info) != 0);
+		build_sample_pe(buf, is_pe64, 0);
+		buf[SAMPLE_PE_OPT] = 0x07;
+		CHECK(pe_get_version_info(buf, size, info) != 0);
+		build_sample_pe(buf, is_pe64, 0);
+		buf[0x80] = 'N';
+		CHECK(pe_get_version_info(buf, size, info) != 0);
+
+		// Any corruption must be handled, as every embedded file goes through the parser
+		for (i = 0; i < 20000; i++) {
+			build_sample_pe(buf, is_pe64, 1);
+			for (r = 1 + test_rand(&seed) % 4; r > 0; r--)
+				buf[test_rand(&seed) % SAMPLE_PE_SIZE] = (unsigned char)test_rand(&seed);
+			pe_get_version_info(buf, SAMPLE_PE_SIZE, info);
+		}
+	}
+
+	// Not a PE
+	memset(buf, 0, SAMPLE_PE_SIZE);
+	CHECK(pe_get_version_info(buf, SAMPLE_PE_SIZE, info) != 0);
+	memcpy(buf, "MZ", 2);
+	set_le32(&buf[0x3C], 0xFFFFFFF0);
+	CHECK(pe_get_version_info(buf, SAMPLE_PE_SIZE, info) != 0);
+	CHECK(pe_get_version_info((const unsigned char*)"MZ", 2, info) != 0);
+	free(buf);
+}
+
+// Convert a hash to the same lowercase hex string as sha1sum
+static const char* hash_to_hex(const unsigned char hash[SHA1_HASH_SIZE])
+{
+	static char str[2 * SHA1_HASH_SIZE + 1];
+	int i;
+
+	for (i = 0; i < SHA1_HASH_SIZE; i++)
+		sprintf(&str[2 * i], "%02x", hash[i]);
+	return str;
+}
+
+// Known answers from FIPS 180-2
+static void test_sha1(void)
+{
+	const char* vectors[][2] = {
+		{ "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+	};
+	unsigned char hash[SHA1_HASH_SIZE], *buf = malloc(1000000);
+	size_t i, len, pos;
+	sha1_ctx ctx;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		sha1_init(&ctx);
+		sha1_update(&ctx, (const unsigned char*)vectors[i][0], strlen(vectors[i][0]));
+		sha1_final(&ctx, hash);
+		CHECK(strcmp(hash_to_hex(hash), vectors[i][1]) == 0);
+	}
+
+	// One million 'a', fed in chunks of varying sizes to exercise the partial block handling
+	CHECK(buf != NULL);
+	if (buf == NULL)
+		return;
+	memset(buf, 'a', 1000000);
+	for (len = 1; len <= 1000000; len = len * 7 + 3) {
+		sha1_init(&ctx);
+		for (pos = 0; pos < 1000000; pos += len)
+			sha1_update(&ctx, &buf[pos], (1000000 - pos < len) ? 1000000 - pos : len);
+		sha1_final(&ctx, hash);
+		CHECK(strcmp(hash_to_hex(hash), "34aa973cd4c4daa4f61eeb2bdbad27316534016f") == 0);
+	}
+	free(buf);
+}
+
+/*
+ * The expected digests were computed independently, with Python's hashlib over
+ * the sample files minus the checksum, certificate directory and certificate table.
+ * Signing a file must not change its digest, which is what lets the cat file be
+ * created before the embedded files are signed.
+ */
+static void test_authenticode(void)
+{
+	const char* expected[2] = { "e2d57655b32aa76488ae0494f567845b6c64bfd6", "f1835c1ffd4c3f7db4193b0df08c6787234e376a" };
+	unsigned char hash[SHA1_HASH_SIZE], buf[SAMPLE_PE_SIZE];
+	size_t size;
+	int is_pe64, with_cert;
+
+	for (is_pe64 = 0; is_pe64 < 2; is_pe64++) {
+		for (with_cert = 0; with_cert < 2; with_cert++) {
+			size = build_sample_pe(buf, is_pe64, with_cert);
+			CHECK(pe_get_authenticode_hash(buf, size, hash) == 0);
+			CHECK(strcmp(hash_to_hex(hash), expected[is_pe64]) == 0);
+			// The checksum is excluded
+			set_le32(&buf[SAMPLE_PE_OPT + 64], 0);
+			CHECK(pe_get_authenticode_hash(buf, size, hash) == 0);
+			CHECK(strcmp(hash_to_hex(hash), expected[is_pe64]) == 0);
+			// But not the rest of the headers
+			buf[SAMPLE_PE_OPT + 4] ^= 1;
+			CHECK(pe_get_authenticode_hash(buf, size, hash) == 0);
+			CHECK(strcmp(hash_to_hex(hash), expected[is_pe64]) != 0);
+		}
+	}
+
+	// Not a PE
+	memset(buf, 0, sizeof(buf));
+	CHECK(pe_get_authenticode_hash(buf, sizeof(buf), hash) != 0);
+}
+
+// Print the version of the files given on the command line, e.g. the DLLs of a driver directory
+static int print_version_info(const char* path)
+{
+	unsigned char* buf;
+	uint32_t info[VERSION_INFO_SIZE];
+	size_t size;
+	FILE* fd = fopen(path, "rb");
+
+	if (fd == NULL) {
+		fprintf(stderr, "Could not open '%s'\n", path);
+		return 1;
+	}
+	fseek(fd, 0, SEEK_END);
+	size = (size_t)ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	buf = malloc(size + 1);
+	if ((buf == NULL) || (fread(buf, 1, size, fd) != size)) {
+		fprintf(stderr, "Could not read '%s'\n", path);
+		free(buf);
+		fclose(fd);
+		return 1;
+	}
+	fclose(fd);
+	if (pe_get_version_info(buf, size, info) == 0)
+		printf("  INFO   %s: %d.%d.%d.%d\n", path, info[2] >> 16, info[2] & 0xFFFF, info[3] >> 16, info[3] & 0xFFFF);
+	else
+		printf("  INFO   %s: no version info\n", path);
+	free(buf);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int i;
+
+	test_version_info();
+	test_sha1();
+	test_authenticode();
+	for (i = 1; i < argc; i++)
+		test_failures += print_version_info(argv[i]);
+	return TEST_RESULT("pe");
+}
@@ -0,0 +1,358 @@
+/*
+ * Library for USB automated driver installation - tokenizer tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenizer.h"
+#include "tokenizer_ref.h"
+#include "test.h"
+
+#if !defined(_WIN32)
+#define ERROR_BAD_ARGUMENTS         160
+#define ERROR_STACK_OVERFLOW        1001
+#define ERROR_CIRCULAR_DEPENDENCY   1059
+#endif
+
+#define NB_FUZZ_RUNS	200000
+#define MAX_ENTITIES	10
+#define MAX_SRC_SIZE	40
+
+// Few distinct chars, so that prefixes, suffixes and names overlap in every possible way
+static const char alphabet[] = "#$()ab";
+
+static void rand_string(char* buf, size_t len, int with_nul, uint32_t* seed)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (with_nul && (test_rand(seed) % 8 == 0)) ? 0 : alphabet[test_rand(seed) % (sizeof(alphabet) - 1)];
+	buf[len] = 0;
+}
+
+struct sink_buffer {
+	char data[4 * MAX_SRC_SIZE * 8];
+	long size;
+};
+
+static int buffer_sink(const char* data, long size, void* context)
+{
+	struct sink_buffer* b = (struct sink_buffer*)context;
+
+	if ((size < 0) || (b->size + size > (long)sizeof(b->data)))
+		return -1;
+	memcpy(&b->data[b->size], data, size);
+	b->size += size;
+	return 0;
+}
+
+/*
+ * Compare tokenize_string(), tokenize_to_sink() and compiled templates against the
+ * reference implementation, on random templates, entity lists, prefixes and suffixes.
+ */
+static void test_against_reference(void)
+{
+	static ref_token_entity_t ref_entities[MAX_ENTITIES + 1];
+	static token_entity_t entities[MAX_ENTITIES + 1];
+	static char names[MAX_ENTITIES][4];
+	token_arena_t arena = { 0 };
+	token_template_t* tpl;
+	struct sink_buffer b;
+	char prefix[3], suffix[3], src[MAX_SRC_SIZE + 1];
+	char *ref, *dst;
+	long ref_r, r, src_count;
+	uint32_t seed = 1;
+	int i, j, nb_entities, with_nul;
+	size_t len;
+
+	for (i = 0; i < NB_FUZZ_RUNS; i++) {
+		token_arena_free(&arena);
+		nb_entities = test_rand(&seed) % MAX_ENTITIES;
+		for (j = 0; j < nb_entities; j++) {
+			// Empty names, and several entities with the same name, are allowed
+			rand_string(names[j], test_rand(&seed) % 4, 0, &seed);
+			rand_string(ref_entities[j].replace, test_rand(&seed) % 6, 0, &seed);
+			ref_entities[j].match = entities[j].match = names[j];
+			token_set(&arena, &entities[j], ref_entities[j].replace);
+		}
+		ref_entities[nb_entities].match = entities[nb_entities].match = NULL;
+		CHECK(!arena.failed);
+		rand_string(prefix, 1 + test_rand(&seed) % 2, 0, &seed);
+		rand_string(suffix, 1 + test_rand(&seed) % 2, 0, &seed);
+		with_nul = (test_rand(&seed) % 4 == 0);
+		len = test_rand(&seed) % MAX_SRC_SIZE;
+		rand_string(src, len, with_nul, &seed);
+		src_count = (test_rand(&seed) % 3 == 0) ? -1 : (long)len;
+
+		ref = dst = NULL;
+		ref_r = ref_tokenize_string(src, src_count, &ref, ref_entities, prefix, suffix, 0);
+		r = tokenize_string(src, src_count, &dst, entities, prefix, suffix, 0);
+		CHECK(r == ref_r);
+		if ((r > 0) && (r == ref_r))
+			CHECK(memcmp(dst, ref, r + 1) == 0);
+		// A buffer may be allocated even if nothing was written
+		if (r >= 0)
+			free(dst);
+
+		// The sink and compiled variants copy the source as is, including any NUL
+		if (!with_nul && (ref_r >= 0)) {
+			b.size = 0;
+			CHECK(tokenize_to_sink(src, src_count, entities, prefix, suffix, buffer_sink, &b) == ref_r);
+			CHECK((b.size == ref_r) && ((ref_r == 0) || (memcmp(b.data, ref, ref_r) == 0)));
+			tpl = tokenize_compile(src, src_count, entities, prefix, suffix);
+			CHECK((tpl != NULL) || (len == 0));
+			if (tpl != NULL) {
+				dst = NULL;
+				CHECK(tokenize_render(tpl, &dst, entities) == ref_r);
+				if ((ref_r > 0) && (dst != NULL))
+					CHECK(memcmp(dst, ref, ref_r + 1) == 0);
+				free(dst);
+				b.size = 0;
+				CHECK(tokenize_render_to_sink(tpl, entities, buffer_sink, &b) == ref_r);
+				CHECK((b.size == ref_r) && ((ref_r == 0) || (memcmp(b.data, ref, ref_r) == 0)));
+				tokenize_free(tpl);
+			}
+		}
+		if (ref_r >= 0)
+			free(ref);
+	}
+	token_arena_free(&arena);
+}
+
+// Values longer than the 1 KB the reference could hold must not be truncated
+static void test_long_value(void)
+{
+	token_entity_t entities[] = { { "TOKEN" }, { NULL } };
+	token_arena_t arena = { 0 };
+	char *value = malloc(100000), *dst = NULL;
+
+	CHECK(value != NULL);
+	if (value == NULL)
+		return;
+	memset(value, 'x', 99999);
+	value[99999] = 0;
+	CHECK(token_set(&arena, &entities[0], value));
+	CHECK(tokenize_string("a#TOKEN#b", -1, &dst, entities, "#", "#", 0) == 100001);
+	CHECK((dst != NULL) && (dst[0] == 'a') && (dst[1] == 'x') && (dst[99999] == 'x') && (dst[100000] == 'b'));
+	free(dst);
+	token_arena_free(&arena);
+	free(value);
+}
+
+// An oversized value must not stop the values that follow from sharing a block
+static void test_oversized_value(void)
+{
+	token_entity_t entities[] = { { "A" }, { "B" }, { "C" }, { NULL } };
+	token_arena_t arena = { 0 };
+	char *value = malloc(10000);
+
+	CHECK(value != NULL);
+	if (value == NULL)
+		return;
+	memset(value, 'x', 9999);
+	value[9999] = 0;
+	CHECK(token_set(&arena, &entities[0], "a"));
+	CHECK(token_set(&arena, &entities[1], value));
+	CHECK(token_set(&arena, &entities[2], "c"));
+	CHECK(strcmp(entities[0].replace, "a") == 0);
+	CHECK(strcmp(entities[1].replace, value) == 0);
+	CHECK(strcmp(entities[2].replace, "c") == 0);
+	CHECK(entities[2].replace == entities[0].replace + 2);
+	token_arena_free(&arena);
+	free(value);
+}
+
+// Set the lengths of entities that were initialized with static values
+static void set_static_values(token_entity_t* entities)
+{
+	for (; entities->match != NULL; entities++)
+		token_set_static(entities, entities->replace);
+}
+
+// Tokenize src recursively, and check the result, or the error code if expected is NULL
+static void check_recursive(const token_entity_t* entities, const char* src, const char* expected, long error)
+{
+	char* dst = NULL;
+	long r = tokenize_string(src, -1, &dst, entities, "#", "#", 1);
+
+	if (expected == NULL) {
+		CHECK(r == -error);
+		CHECK(dst == NULL);
+		return;
+	}
+	CHECK(r == (long)strlen(expected));
+	CHECK((dst != NULL) && (strcmp(dst, expected) == 0));
+	free(dst);
+}
+
+static void test_recursion(void)
+{
+	static char names[2 * TOKENIZE_MAX_DEPTH][8], values[2 * TOKENIZE_MAX_DEPTH][16];
+	static token_entity_t chain[2 * TOKENIZE_MAX_DEPTH + 1];
+	token_entity_t nested[] = { { "A", "<#B#>" }, { "B", "b" }, { NULL } };
+	token_entity_t joined[] = { { "X", "#" }, { "A", "a" }, { NULL } };
+	token_entity_t self[] = { { "A", "x#A#" }, { "B", "b" }, { NULL } };
+	token_entity_t mutual[] = { { "A", "#B#" }, { "B", "-#C#" }, { "C", "#A#-" }, { NULL } };
+	ref_token_entity_t ref_joined[] = { { "X", "#" }, { "A", "a" }, { NULL } };
+	char *src, *expected, *dst = NULL;
+	int i, n;
+
+	set_static_values(nested);
+	set_static_values(joined);
+	set_static_values(self);
+	set_static_values(mutual);
+
+	check_recursive(nested, "#A#-#B#-#C#", "<b>-b-#C#", 0);
+	CHECK(tokenize_string("#A#", -1, &dst, nested, "#", "#", 0) == 5);
+	CHECK((dst != NULL) && (strcmp(dst, "<#B#>") == 0));
+	free(dst);
+
+	// A token formed by a value and the text that follows it is no longer expanded
+	check_recursive(joined, "#X#A#", "#A#", 0);
+	dst = NULL;
+	CHECK(ref_tokenize_string("#X#A#", -1, &dst, ref_joined, "#", "#", 1) == 1);
+	CHECK((dst != NULL) && (strcmp(dst, "a") == 0));
+	free(dst);
+
+	// Self and mutual references are errors, but only if the token is used
+	check_recursive(self, "#A#", NULL, ERROR_CIRCULAR_DEPENDENCY);
+	check_recursive(self, "#B##B#", "bb", 0);
+	check_recursive(mutual, "#A#", NULL, ERROR_CIRCULAR_DEPENDENCY);
+	check_recursive(mutual, "x#C#", NULL, ERROR_CIRCULAR_DEPENDENCY);
+
+	// A chain of TOKENIZE_MAX_DEPTH entities is the deepest nesting allowed
+	for (n = TOKENIZE_MAX_DEPTH; n <= TOKENIZE_MAX_DEPTH + 1; n++) {
+		for (i = 0; i < n; i++) {
+			snprintf(names[i], sizeof(names[i]), "T%d", i);
+			if (i == n - 1)
+				snprintf(values[i], sizeof(values[i]), "end");
+			else
+				snprintf(values[i], sizeof(values[i]), "#T%d#", i + 1);
+			chain[i].match = names[i];
+			token_set_static(&chain[i], values[i]);
+		}
+		chain[n].match = NULL;
+		if (n == TOKENIZE_MAX_DEPTH)
+			check_recursive(chain, "(#T0#)", "(end)", 0);
+		else
+			check_recursive(chain, "(#T0#)", NULL, ERROR_STACK_OVERFLOW);
+	}
+
+	// Each level uses the next one twice, which would need 2^30 expansions without memoization
+	for (i = 0; i < 31; i++) {
+		snprintf(names[i], sizeof(names[i]), "L%d", i);
+		if (i == 30)
+			values[i][0] = 0;
+		else
+			snprintf(values[i], sizeof(values[i]), "#L%d##L%d#", i + 1, i + 1);
+		chain[i].match = names[i];
+		token_set_static(&chain[i], values[i]);
+	}
+	chain[31].match = NULL;
+	check_recursive(chain, "a#L0#b", "ab", 0);
+
+	// Many occurrences of the same nested value
+	src = malloc(10000 * 3 + 1);
+	expected = malloc(10000 * 3 + 1);
+	CHECK((src != NULL) && (expected != NULL));
+	if ((src != NULL) && (expected != NULL)) {
+		for (i = 0; i < 10000; i++) {
+			memcpy(&src[3 * i], "#A#", 3);
+			memcpy(&expected[3 * i], "<b>", 3);
+		}
+		src[3 * i] = 0;
+		expected[3 * i] = 0;
+		check_recursive(nested, src, expected, 0);
+	}
+	free(src);
+	free(expected);
+}
+
+static const char* nested_names[MAX_ENTITIES] = { "c", "d", "e", "f", "gh", "ij", "k", "l", "mn", "o" };
+
+// Random text of 'a', 'b' and tokens of the entities that come after first
+static void rand_nested(char* buf, size_t max_len, int first, uint32_t* seed)
+{
+	size_t pos = 0;
+	int k;
+
+	while (pos + 4 < max_len) {
+		k = test_rand(seed) % (MAX_ENTITIES + 4);
+		if (k == MAX_ENTITIES)
+			break;
+		if (k > MAX_ENTITIES)
+			buf[pos++] = 'a' + (k & 1);
+		else if (k > first)
+			pos += sprintf(&buf[pos], "#%s#", nested_names[k]);
+	}
+	buf[pos] = 0;
+}
+
+/*
+ * Compare recursive tokenization against the reference on random nested tokens. Values
+ * only use the entities that follow them, so that there are no cycles, and only contain
+ * the token prefix as part of a whole token, so that no token can be formed by joining.
+ */
+static void test_recursion_against_reference(void)
+{
+	static ref_token_entity_t ref_entities[MAX_ENTITIES + 1];
+	static token_entity_t entities[MAX_ENTITIES + 1];
+	token_arena_t arena = { 0 };
+	char src[4 * MAX_SRC_SIZE];
+	char *ref, *dst;
+	long ref_r, r;
+	uint32_t seed = 1;
+	int i, j;
+
+	for (i = 0; i < NB_FUZZ_RUNS / 10; i++) {
+		token_arena_free(&arena);
+		for (j = 0; j < MAX_ENTITIES; j++) {
+			rand_nested(ref_entities[j].replace, 12, j, &seed);
+			ref_entities[j].match = entities[j].match = nested_names[j];
+			token_set(&arena, &entities[j], ref_entities[j].replace);
+		}
+		ref_entities[MAX_ENTITIES].match = entities[MAX_ENTITIES].match = NULL;
+		rand_nested(src, sizeof(src), -1, &seed);
+		if (src[0] == 0)
+			continue;
+		ref = dst = NULL;
+		ref_r = ref_tokenize_string(src, -1, &ref, ref_entities, "#", "#", 1);
+		r = tokenize_string(src, -1, &dst, entities, "#", "#", 1);
+		// The reference fails, rather than return 0, if a pass ends up with an empty output
+		if (ref_r == -ERROR_BAD_ARGUMENTS)
+			CHECK(r == 0);
+		else
+			CHECK(r == ref_r);
+		if ((r > 0) && (r == ref_r))
+			CHECK(memcmp(dst, ref, r + 1) == 0);
+		free(dst);
+		free(ref);
+	}
+	token_arena_free(&arena);
+}
+
+int main(void)
+{
+	test_against_reference();
+	test_long_value();
+	test_oversized_value();
+	test_recursion();
+	test_recursion_against_reference();
+	return TEST_RESULT("tokenizer");
+}
@@ -0,0 +1,230 @@
+/*
+ * Library for USB automated driver installation - zip writer tests
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zip.h"
+#include "test.h"
+
+/*
+ * The archives are checked for consistency here, but as we don't have an inflater,
+ * the deflate data is only validated by test_zip.sh, which calls this program with
+ * a directory where to write the archives and the expected content of each file.
+ */
+struct test_file {
+	const char* path;		// as passed to zip_add()
+	const char* zip_path;	// as expected in the archive
+	int type;
+	size_t size;
+};
+
+static const struct test_file test_files[] = {
+	{ "empty.txt", "empty.txt", TEST_DATA_TEXT, 0 },
+	{ "one.bin", "one.bin", TEST_DATA_RANDOM, 1 },
+	{ "usb_device.inf", "usb_device.inf", TEST_DATA_TEXT, 3000 },
+	{ "amd64\\winusbcoinstaller2.dll", "amd64/winusbcoinstaller2.dll", TEST_DATA_MIXED, 3 * ZIP_BLOCK_SIZE + 7 },
+	{ "x86/random.bin", "x86/random.bin", TEST_DATA_RANDOM, 100000 },
+	{ "zeros.bin", "zeros.bin", TEST_DATA_ZEROS, 200000 },
+	{ "large.txt", "large.txt", TEST_DATA_TEXT, 1024 * 1024 },
+	{ "p\xC3\xA9riph\xC3\xA9rique.inf", "p\xC3\xA9riph\xC3\xA9rique.inf", TEST_DATA_TEXT, ZIP_BLOCK_SIZE },
+};
+#define NB_TEST_FILES	(sizeof(test_files) / sizeof(test_files[0]))
+
+struct zip_buffer {
+	uint8_t* data;
+	size_t size;
+	size_t max_size;
+};
+
+static int zip_buffer_write(const void* buf, size_t size, void* ctx)
+{
+	struct zip_buffer* b = (struct zip_buffer*)ctx;
+	uint8_t* data;
+
+	if (b->size + size > b->max_size) {
+		b->max_size = 2 * (b->size + size);
+		data = realloc(b->data, b->max_size);
+		if (data == NULL)
+			return -1;
+		b->data = data;
+	}
+	memcpy(&b->data[b->size], buf, size);
+	b->size += size;
+	return 0;
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+	return (uint32_t)get16(p) | ((uint32_t)get16(&p[2]) << 16);
+}
+
+// Straightforward bitwise CRC-32, to compare with
+static uint32_t reference_crc32(const uint8_t* data, size_t size)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i;
+	int j;
+
+	for (i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+static int is_ascii(const char* str)
+{
+	for (; *str != 0; str++) {
+		if ((uint8_t)*str >= 0x80)
+			return 0;
+	}
+	return 1;
+}
+
+// Check the central directory, the local headers and, for stored files, the data
+static void check_archive(const struct zip_buffer* b, int method, uint8_t** data)
+{
+	const uint8_t *end, *cd, *local;
+	uint32_t cd_offset, offset, compressed_size;
+	uint16_t path_len, flags;
+	size_t i;
+
+	CHECK(b->size >= 22);
+	if (b->size < 22)
+		return;
+	end = &b->data[b->size - 22];
+	CHECK(get32(end) == 0x06054b50);
+	CHECK(get16(&end[8]) == NB_TEST_FILES);
+	CHECK(get16(&end[10]) == NB_TEST_FILES);
+	cd_offset = get32(&end[16]);
+	CHECK(cd_offset + get32(&end[12]) == b->size - 22);
+	cd = &b->data[cd_offset];
+	for (i = 0; i < NB_TEST_FILES; i++) {
+		CHECK(get32(cd) == 0x02014b50);
+		flags = get16(&cd[8]);
+		CHECK(get16(&cd[10]) == method);
+		CHECK(get32(&cd[16]) == reference_crc32(data[i], test_files[i].size));
+		compressed_size = get32(&cd[20]);
+		CHECK(get32(&cd[24]) == test_files[i].size);
+		path_len = get16(&cd[28]);
+		CHECK(path_len == strlen(test_files[i].zip_path));
+		CHECK(memcmp(&cd[46], test_files[i].zip_path, path_len) == 0);
+		// Non ASCII paths must be flagged as UTF-8
+		CHECK(((flags & 0x0800) != 0) == !is_ascii(test_files[i].path));
+		offset = get32(&cd[42]);
+		CHECK(offset + 30 + path_len + compressed_size <= cd_offset);
+		local = &b->data[offset];
+		CHECK(get32(local) == 0x04034b50);
+		CHECK(get16(&local[6]) == flags);
+		CHECK(get16(&local[26]) == path_len);
+		CHECK(memcmp(&local[30], test_files[i].zip_path, path_len) == 0);
+		if (method == ZIP_STORE) {
+			CHECK(compressed_size == test_files[i].size);
+			CHECK(memcmp(&local[30 + path_len], data[i], test_files[i].size) == 0);
+		} else {
+			// The data descriptor follows the deflate stream
+			CHECK(get32(&local[30 + path_len + compressed_size]) == 0x08074b50);
+			CHECK(get32(&local[34 + path_len + compressed_size]) == get32(&cd[16]));
+			// Compressible data must shrink, and incompressible data must not grow much
+			if (test_files[i].type != TEST_DATA_RANDOM)
+				CHECK((test_files[i].size < 64) || (compressed_size < test_files[i].size / 2));
+			else
+				CHECK(compressed_size <= test_files[i].size + test_files[i].size / 1000 + 16);
+		}
+		cd += 46 + path_len;
+	}
+}
+
+static int write_file(const char* dir, const char* name, const uint8_t* data, size_t size)
+{
+	char path[1024];
+	FILE* fd;
+	int r;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	fd = fopen(path, "wb");
+	if (fd == NULL) {
+		fprintf(stderr, "Could not create '%s'\n", path);
+		return 1;
+	}
+	r = (size != 0) && (fwrite(data, 1, size, fd) != size);
+	fclose(fd);
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	const int methods[] = { ZIP_STORE, ZIP_DEFLATE };
+	const char* names[] = { "store.zip", "deflate.zip" };
+	uint8_t* data[NB_TEST_FILES];
+	struct zip_writer* zip;
+	struct zip_buffer b;
+	char name[64], list[4096];
+	uint32_t seed = 1;
+	size_t i, pos;
+	int m;
+
+	for (i = 0; i < NB_TEST_FILES; i++) {
+		data[i] = malloc(test_files[i].size + 1);
+		if (data[i] == NULL) {
+			fprintf(stderr, "Could not allocate buffers\n");
+			return 1;
+		}
+		fill_test_data(data[i], test_files[i].size, test_files[i].type, &seed);
+	}
+
+	for (m = 0; m < 2; m++) {
+		memset(&b, 0, sizeof(b));
+		zip = zip_create(zip_buffer_write, &b, methods[m]);
+		CHECK(zip != NULL);
+		if (zip == NULL)
+			continue;
+		for (i = 0; i < NB_TEST_FILES; i++)
+			CHECK(zip_add(zip, test_files[i].path, data[i], test_files[i].size, 1700000000 + 2 * (int64_t)i) == 0);
+		CHECK(zip_finish(zip) == 0);
+		zip_free(zip);
+		check_archive(&b, methods[m], data);
+		if (argc > 1)
+			test_failures += write_file(argv[1], names[m], b.data, b.size);
+		free(b.data);
+	}
+	CHECK(zip_create(zip_buffer_write, &b, 1) == NULL);
+
+	// The expected content, for test_zip.sh: one "<path>\t<reference file>" line per file
+	if (argc > 1) {
+		for (pos = 0, i = 0; i < NB_TEST_FILES; i++) {
+			snprintf(name, sizeof(name), "expected_%d.bin", (int)i);
+			test_failures += write_file(argv[1], name, data[i], test_files[i].size);
+			pos += snprintf(&list[pos], sizeof(list) - pos, "%s\t%s\n", test_files[i].zip_path, name);
+		}
+		test_failures += write_file(argv[1], "expected.txt", (const uint8_t*)list, pos);
+	}
+
+	for (i = 0; i < NB_TEST_FILES; i++)
+		free(data[i]);
+	return TEST_RESULT("zip");
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Check that the archives produced by the zip writer can be tested by unzip,
+# and extracted by Python's zipfile, with the expected content.
+# Usage: test_zip.sh <path of the test_zip program>
+
+test_zip=${1:-./test_zip}
+dir=$(mktemp -d "${TMPDIR:-/tmp}/wdi_test_zip.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+"$test_zip" "$dir" > /dev/null || exit 1
+
+if command -v unzip > /dev/null 2>&1; then
+	for z in store deflate; do
+		unzip -tq "$dir/$z.zip" > "$dir/unzip.log" 2>&1 || { cat "$dir/unzip.log"; echo "  FAIL   zip ($z, unzip)"; exit 1; }
+	done
+	echo "  PASS   zip (unzip)"
+else
+	echo "  SKIP   zip (unzip not found)"
+fi
+
+if command -v python3 > /dev/null 2>&1; then
+	python3 - "$dir" <<'PYTHON' || { echo "  FAIL   zip (python)"; exit 1; }
+import os, sys, zipfile
+d = sys.argv[1]
+with open(os.path.join(d, "expected.txt"), encoding="utf-8") as f:
+    expected = [line.rstrip("\n").split("\t") for line in f if line.strip()]
+for z in ("store", "deflate"):
+    out = os.path.join(d, z)
+    with zipfile.ZipFile(os.path.join(d, z + ".zip")) as zf:
+        assert zf.testzip() is None, z
+        assert sorted(zf.namelist()) == sorted(p for p, _ in expected), z
+        zf.extractall(out)
+    for path, ref in expected:
+        with open(os.path.join(out, path), "rb") as f1, open(os.path.join(d, ref), "rb") as f2:
+            assert f1.read() == f2.read(), "%s: %s" % (z, path)
+PYTHON
+	echo "  PASS   zip (python)"
+else
+	echo "  SKIP   zip (python3 not found)"
+fi
@@ -0,0 +1,37 @@
+/*
+ * Library for USB automated driver installation - reference tokenizer
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "tokenizer.h"
+
+// The token entity, as it was when the replace values were stored inline
+typedef struct _ref_token_entity_t
+{
+	const char* match;
+	char replace[1024];
+}ref_token_entity_t;
+
+long ref_tokenize_string(const char* src,
+						 long src_count,
+						 char** dst,
+						 const ref_token_entity_t* token_entities,
+						 const char* tok_prefix,
+						 const char* tok_suffix,
+						 int recursive);